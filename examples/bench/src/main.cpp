@@ -0,0 +1,571 @@
+// エンジンのホットパスを測るベンチマーク。
+//   各ケースを履歴の長さごとに回し、ns/op・確保回数/op・ピークのバイト数を Serial に出す。
+//   結果は SD の /bench_baseline.json と比べ、遅く・重くなったものに REGRESSION を付ける。
+//   ベースラインが無いとき（または BENCH_SAVE_BASELINE を定義したとき）は今回の結果を保存する。
+//
+//   env:esp32s3box は実機で、env:native は PC で動く（pio run -e native -t exec）。
+//   PC では test/host のスタンドインを使い、SD は ./sdcard、OpenAI の代わりに
+//   プロセス内の StandInServer に問い合わせるので、応答の解析まで毎回測れる。
+#include <vector>
+#include <SD.h>
+#include "SDUtils.h"
+#include "LLMEngine.h"
+#include "LLMDecisionEngine.h"
+#include "ThoughtPlanner.h"
+#include "StringBuilder.h"
+#include "JsonArena.h"
+#ifdef ESP_PLATFORM
+#include <M5Unified.h>
+#include <esp_heap_caps.h>
+#ifdef BENCH_STANDIN_URL
+#include "WiFiHelper.h"
+#define BENCH_STANDIN
+#endif
+#else
+#include <malloc.h>
+#include <pthread.h>
+#include <map>
+#include <new>
+#include "StandInServer.h"
+#define BENCH_STANDIN
+#endif
+
+// ---- malloc の計測（platformio.ini の --wrap で差し替える） ----
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+}
+
+namespace {
+volatile bool counting = false;
+volatile uint32_t allocCount = 0;
+volatile long liveBytes = 0;
+volatile long peakBytes = 0;
+#ifndef ESP_PLATFORM
+// スタンドインサーバーのスレッドの確保は数えない（計測するのは setup() のスレッドだけ）
+pthread_t benchThread;
+#endif
+
+size_t blockSize(void* ptr) {
+#ifdef ESP_PLATFORM
+  return heap_caps_get_allocated_size(ptr);
+#else
+  return malloc_usable_size(ptr);
+#endif
+}
+
+bool countedThread() {
+#ifdef ESP_PLATFORM
+  return true;
+#else
+  return pthread_equal(pthread_self(), benchThread);
+#endif
+}
+
+void track(void* ptr) {
+  if (!ptr || !counting || !countedThread()) return;
+  ++allocCount;
+  liveBytes += blockSize(ptr);
+  if (liveBytes > peakBytes) peakBytes = liveBytes;
+}
+
+void untrack(void* ptr) {
+  if (ptr && counting && countedThread()) liveBytes -= blockSize(ptr);
+}
+}  // namespace
+
+extern "C" {
+void* __wrap_malloc(size_t size) {
+  void* ptr = __real_malloc(size);
+  track(ptr);
+  return ptr;
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+  void* ptr = __real_calloc(n, size);
+  track(ptr);
+  return ptr;
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+  untrack(ptr);
+  void* moved = __real_realloc(ptr, size);
+  if (moved) track(moved);
+  else if (size) track(ptr);  // 失敗したときは元のブロックが残る
+  return moved;
+}
+
+void __wrap_free(void* ptr) {
+  untrack(ptr);
+  __real_free(ptr);
+}
+}
+
+#ifndef ESP_PLATFORM
+// PC の libstdc++ は共有ライブラリの中で malloc を呼ぶので --wrap が効かない。
+// String（std::string）などの確保も数えるため、new / delete をここで malloc に回す
+void* operator new(size_t size) {
+  void* ptr = malloc(size ? size : 1);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return malloc(size ? size : 1); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return malloc(size ? size : 1); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+#endif
+
+// ---- ベンチマーク本体 ----
+
+struct Result {
+  String name;
+  uint32_t nsPerOp;
+  float allocsPerOp;
+  long peakBytes;  // 計測開始時点からの増分
+};
+
+static std::vector<Result> results;
+
+// setup は計測の外で毎回呼ぶ（状態を戻すため）。op だけを iterations 回測る
+template <typename Setup, typename Op>
+void bench(const String& name, int iterations, Setup setup, Op op) {
+  setup();
+  op();  // 初回の確保（String の伸長など）を計測から外す
+
+  uint64_t totalMicros = 0;
+  uint32_t allocs = 0;
+  long peak = 0;
+  for (int i = 0; i < iterations; ++i) {
+    setup();
+    allocCount = 0;
+    liveBytes = 0;
+    peakBytes = 0;
+    counting = true;
+    uint32_t started = micros();
+    op();
+    uint32_t elapsed = micros() - started;
+    counting = false;
+    totalMicros += elapsed;
+    allocs += allocCount;
+    if (peakBytes > peak) peak = peakBytes;
+  }
+
+  Result r{name, (uint32_t)(totalMicros * 1000 / iterations), (float)allocs / iterations, peak};
+  Serial.printf("%-36s %10u ns/op %8.1f allocs/op %8ld peak bytes\n",
+                r.name.c_str(), (unsigned)r.nsPerOp, r.allocsPerOp, r.peakBytes);
+  results.push_back(r);
+}
+
+static const char* kPhrases[] = {
+  "今日はいい天気だね、公園に遊びに行きたいな",
+  "宿題が終わらないよー、算数のプリントがまだ半分残ってる",
+  "新しいゲームを買ってもらったんだ。一緒に遊ぼうよ",
+  "明日は雨が降るらしいから、傘を持っていかないとね",
+};
+
+#ifdef BENCH_STANDIN
+#ifdef ESP_PLATFORM
+static String standInUrl() { return BENCH_STANDIN_URL; }
+#else
+// /v1/bench/<bytes> への応答。計測中に組み立てないよう、先に作っておく
+static std::map<int, String> sizedReplies;
+
+// OpenAI の応答と同じ形の本文を返す。履歴の長さによらず同じ応答にして、解析の差だけを見る
+static StandInServer standIn([](const StandInServer::Request& req, StandInServer::Response& res) {
+  if (req.path.startsWith("/v1/bench/")) {
+    auto it = sizedReplies.find(req.path.substring(10).toInt());
+    if (it != sizedReplies.end()) {
+      res.json(200, it->second);
+      return;
+    }
+  }
+  res.json(200,
+           "{\"id\":\"chatcmpl-bench\",\"object\":\"chat.completion\",\"model\":\"gpt-4o-mini\","
+           "\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\","
+           "\"content\":\"{\\\"message\\\":\\\"うん、公園いいね！一緒に行こうよ\\\",\\\"emotion\\\":\\\"happy\\\"}\"},"
+           "\"finish_reason\":\"stop\"}],"
+           "\"usage\":{\"prompt_tokens\":120,\"completion_tokens\":24,\"total_tokens\":144}}");
+});
+static String standInUrl() { return standIn.url(); }
+#endif
+#endif
+
+static void fillHistory(LLMEngine& llm, int messages) {
+  llm.resetConversation();
+  for (int i = 0; i < messages; ++i) {
+    const char* text = kPhrases[i % 4];
+    if (i % 2 == 0) llm.addUserMessage(text);
+    else llm.addAssistantMessage(text);
+  }
+}
+
+// 以前の buildPayload。毎ターン履歴全体から JsonDocument を作り直してシリアライズしていた。
+// JsonArena の中の確保は malloc を通らないので、allocs/op より ns/op の差を見る
+static String buildPayloadWithDocument(const LLMEngine& llm) {
+  LLMEngine::HistoryView history = llm.getHistory();
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
+  doc["model"] = "gpt-4o-mini";
+  JsonArray messages = doc["messages"].to<JsonArray>();
+  if (!history->systemPrompt().isEmpty()) {
+    JsonObject sys = messages.add<JsonObject>();
+    sys["role"] = "system";
+    sys["content"] = history->systemPrompt();
+  }
+  if (!history->summary().isEmpty()) {
+    JsonObject sum = messages.add<JsonObject>();
+    sum["role"] = "system";
+    sum["content"] = "これまでの会話の要約: " + history->summary();
+  }
+  for (const auto& entry : *history) {
+    JsonObject msg = messages.add<JsonObject>();
+    msg["role"] = entry.role.c_str();
+    msg["content"] = entry.content;
+  }
+  String payload;
+  serializeJson(doc, payload);
+  return payload;
+}
+
+// ThoughtPlanner の非公開のプロンプト組み立てを呼ぶ（ThoughtPlanner の friend）
+class ThoughtPlannerBench {
+public:
+  static void appendRecentPhrases(ThoughtPlanner& planner, StringBuilder& prompt) {
+    planner.appendRecentPhrases(prompt);
+  }
+};
+
+static void benchLLMEngine(int messages) {
+  static LLMEngine llm("sk-bench");
+  String suffix = " (" + String(messages) + " msgs)";
+  llm.setHistoryBudget(64 * 1024);  // 件数だけで比べる（押し出さない）
+
+  bench("buildPayload" + suffix, 200,
+        [&]() { fillHistory(llm, messages); },
+        [&]() { String payload = llm.buildPayload(); });
+
+  bench("buildPayload JsonDocument" + suffix, 200,
+        [&]() { fillHistory(llm, messages); },
+        [&]() { String payload = buildPayloadWithDocument(llm); });
+
+  const Result& fragments = results[results.size() - 2];
+  const Result& document = results.back();
+  Serial.printf("  buildPayload: fragments %u ns/op %.1f allocs/op, JsonDocument %u ns/op %.1f allocs/op\n",
+                (unsigned)fragments.nsPerOp, fragments.allocsPerOp,
+                (unsigned)document.nsPerOp, document.allocsPerOp);
+
+  // 予算を超えた状態で 1 件足し、trimHistory に古い発話を押し出させる
+  bench("addUserMessage+trim" + suffix, 200,
+        [&]() {
+          llm.setHistoryBudget(64 * 1024);
+          fillHistory(llm, messages);
+          llm.setHistoryBudget(llm.getHistory()->bytes() / 2);
+        },
+        [&]() { llm.addUserMessage(kPhrases[0]); });
+  llm.setHistoryBudget(64 * 1024);
+
+  bench("saveHistoryToFile" + suffix, 20,
+        [&]() { fillHistory(llm, messages); },
+        [&]() { llm.saveHistoryToFile("/bench_history.json"); });
+
+  bench("loadHistoryFromFile" + suffix, 20,
+        []() {},
+        [&]() { llm.loadHistoryFromFile("/bench_history.json"); });
+
+  // 独り言のプロンプトに足す「最近の話題」。履歴を走査してキーワードで分類する
+  static ThoughtPlanner planner(&llm);
+  bench("appendRecentPhrases" + suffix, 200,
+        [&]() { fillHistory(llm, messages); },
+        [&]() {
+          JsonArena::Turn turn;
+          StringBuilder prompt(768);
+          ThoughtPlannerBench::appendRecentPhrases(planner, prompt);
+        });
+}
+
+static size_t fileSize(const char* path) {
+  File file = SD.open(path, FILE_READ);
+  return file ? file.size() : 0;
+}
+
+// 履歴の保存形式の比較。JSON（saveHistoryToFile）は毎回全体を書き直し、
+// ジャーナル（HistoryJournal）は増えた発話だけを追記する
+static void benchHistoryFormats(int messages) {
+  static FsJournalStorage storage(SD);
+  static HistoryJournal journal(storage, "");
+  static LLMEngine llm("sk-bench");
+  static bool opened = false;
+  if (!opened) {
+    llm.setHistoryBudget(64 * 1024);
+    llm.setJournal(&journal);
+    llm.switchTopic("bench");
+    opened = true;
+  }
+  String suffix = " (" + String(messages) + " msgs)";
+
+  // 1 ターン分（発話 1 件）を足して保存する
+  bench("persistHistory journal" + suffix, 20,
+        [&]() {
+          fillHistory(llm, messages);
+          llm.persistHistory();
+          llm.addUserMessage(kPhrases[1]);
+        },
+        [&]() { llm.persistHistory(); });
+
+  // トピックを開き直す（park した状態は使わず、ファイルから読む）
+  bench("open journal" + suffix, 20,
+        []() {},
+        [&]() { llm.setJournal(&journal); });
+
+  // 同じ履歴を両方の形式で書いて、ファイルの大きさを比べる
+  fillHistory(llm, messages);
+  llm.saveHistoryToFile("/bench_history.json");
+  journal.compact({});   // ジャーナルを空にする
+  llm.persistHistory();  // fillHistory で積んだ分（Clear + 発話）だけを追記する
+  Serial.printf("  history on SD: json %u bytes, journal %u bytes\n",
+                (unsigned)fileSize("/bench_history.json"),
+                (unsigned)(fileSize("/history_bench.snap") + fileSize("/history_bench.jnl")));
+}
+
+static void benchDecisionEngine(int tools) {
+  static LLMDecisionEngine engine("sk-bench");
+  static int registered = 0;
+  for (; registered < tools; ++registered) {
+    JsonDocument schema;
+    schema["type"] = "object";
+    JsonObject props = schema["properties"].to<JsonObject>();
+    props["value"]["type"] = "integer";
+    props["value"]["description"] = "設定する値";
+    props["label"]["type"] = "string";
+    schema["required"].add("value");
+    engine.registerTool("tool_" + String(registered), "ベンチマーク用のツール", schema,
+                        [](JsonObject) { return String("ok"); });
+  }
+
+  String suffix = " (" + String(tools) + " tools)";
+  bench("buildFunctionSchema" + suffix, 100,
+        []() { engine.invalidateFunctionSchema(); },
+        []() { engine.buildFunctionSchema(); });
+
+#ifdef BENCH_STANDIN
+  // リクエストの組み立て（buildRequestJson）と応答の解析は evaluate 越しに測る
+  static OpenAITransport transport(standInUrl());
+  engine.setTransport(&transport);
+  bench("evaluate (stand-in)" + suffix, 20,
+        []() {
+          engine.clearHistory();
+          engine.addMessage("user", "", kPhrases[0]);
+        },
+        []() {
+          String content;
+          engine.evaluate(content);
+        });
+  Serial.printf("  buildRequestJson %u us, tools %u bytes\n",
+                (unsigned)engine.stats().lastPrepareMicros, (unsigned)engine.stats().toolsBytes);
+#endif
+}
+
+#ifdef BENCH_STANDIN
+static void benchResponseParsing(int messages) {
+  static OpenAITransport transport(standInUrl());
+  static LLMEngine llm("sk-bench");
+  llm.setTransport(&transport);
+  llm.setHistoryBudget(64 * 1024);
+  String suffix = " (" + String(messages) + " msgs)";
+  bench("sendAndReceive (stand-in)" + suffix, 20,
+        [&]() { fillHistory(llm, messages); },
+        [&]() {
+          LLMResponse response;
+          llm.sendAndReceive(response);
+        });
+}
+#endif
+
+#ifndef ESP_PLATFORM
+// 本文が bytes バイトほどになる応答（content の中身と usage）を作る
+static String makeSizedReply(int bytes) {
+  String message;
+  for (int i = 0; (int)message.length() < bytes; ++i) {
+    message += kPhrases[i % 4];
+  }
+  JsonDocument reply;
+  reply["message"] = message;
+  reply["emotion"] = "happy";
+  String content;
+  serializeJson(reply, content);
+
+  JsonDocument doc;
+  doc["id"] = "chatcmpl-bench";
+  doc["object"] = "chat.completion";
+  doc["model"] = "gpt-4o-mini";
+  JsonObject choice = doc["choices"].add<JsonObject>();
+  choice["index"] = 0;
+  choice["message"]["role"] = "assistant";
+  choice["message"]["content"] = content;
+  choice["logprobs"] = nullptr;
+  choice["finish_reason"] = "stop";
+  doc["usage"]["prompt_tokens"] = 120;
+  doc["usage"]["completion_tokens"] = bytes / 3;
+  doc["usage"]["total_tokens"] = 120 + bytes / 3;
+  doc["system_fingerprint"] = "fp_bench";
+
+  String body;
+  serializeJson(doc, body);
+  return body;
+}
+
+// 応答の受け取り方の比較。以前は本文を String に溜めてからフィルタなしで丸ごと解析していた
+// （本文と JsonDocument の 2 つ分がヒープに載る）。今はソケットから直接、フィルタ付きで解析する。
+// どちらも JsonArena を使わず、ヒープの増分をそのまま数える
+static void benchResponseBuffering(int bytes) {
+  static const JsonDocument filter = [] {
+    JsonDocument doc;
+    doc["choices"][0]["message"]["content"] = true;
+    return doc;
+  }();
+  static OpenAITransport transport;
+  sizedReplies[bytes] = makeSizedReply(bytes);
+  transport.setEndpoint(standIn.url(("/v1/bench/" + String(bytes)).c_str()));
+  const String payload = "{\"model\":\"gpt-4o-mini\",\"messages\":[]}";
+  String suffix = " (" + String(bytes) + " B reply)";
+
+  bench("parse buffered String" + suffix, 20,
+        []() {},
+        [&]() {
+          String body;
+          transport.post("sk-bench", payload, body);
+          JsonDocument doc;
+          deserializeJson(doc, body);
+          String content = doc["choices"][0]["message"]["content"].as<String>();
+        });
+
+  bench("parse stream+filter" + suffix, 20,
+        []() {},
+        [&]() {
+          JsonDocument doc;
+          transport.post("sk-bench", payload, [&](HttpBodyStream& body) {
+            DeserializationError error =
+                deserializeJson(doc, body, DeserializationOption::Filter(filter));
+            return !error && body.discardRest(1000);
+          });
+          String content = doc["choices"][0]["message"]["content"].as<String>();
+        });
+
+  const Result& buffered = results[results.size() - 2];
+  const Result& streamed = results.back();
+  Serial.printf("  peak heap for %u B reply: buffered %ld bytes, streamed %ld bytes\n",
+                (unsigned)sizedReplies[bytes].length(), buffered.peakBytes, streamed.peakBytes);
+}
+#endif
+
+// ---- ベースライン ----
+
+static const char* kBaselinePath = "/bench_baseline.json";
+static const float kSlowerRatio = 1.10f;  // 10% 以上遅くなったら回帰とみなす
+
+static bool compareWithBaseline() {
+  JsonDocument baseline;
+  if (!readJsonFromSD(kBaselinePath, baseline)) return false;
+
+  int regressions = 0;
+  for (const auto& r : results) {
+    JsonObjectConst base = baseline[r.name];
+    if (base.isNull()) continue;
+    uint32_t ns = base["ns"] | 0UL;
+    float allocs = base["allocs"] | 0.0f;
+    bool slower = ns > 0 && r.nsPerOp > ns * kSlowerRatio;
+    bool heavier = r.allocsPerOp > allocs + 0.5f;
+    if (slower || heavier) {
+      ++regressions;
+      Serial.printf("REGRESSION %s: %u -> %u ns/op, %.1f -> %.1f allocs/op\n",
+                    r.name.c_str(), (unsigned)ns, (unsigned)r.nsPerOp, allocs, r.allocsPerOp);
+    }
+  }
+  Serial.printf("%d regression(s) against %s\n", regressions, kBaselinePath);
+  return true;
+}
+
+static void saveBaseline() {
+  JsonDocument doc;
+  for (const auto& r : results) {
+    JsonObject obj = doc[r.name].to<JsonObject>();
+    obj["ns"] = r.nsPerOp;
+    obj["allocs"] = r.allocsPerOp;
+    obj["peak"] = r.peakBytes;
+  }
+  if (writeJsonToSD(kBaselinePath, doc)) {
+    Serial.printf("Baseline saved to %s\n", kBaselinePath);
+  }
+}
+
+void setup() {
+#ifdef ESP_PLATFORM
+  M5.begin();
+#endif
+  Serial.begin(115200);
+  delay(1000);
+  JsonArena::instance().configure(64 * 1024, JsonArena::Memory::Psram);
+
+  if (!initSDCard()) {
+    Serial.println("SD card is required for the history and baseline files.");
+    return;
+  }
+#if defined(ESP_PLATFORM) && defined(BENCH_STANDIN)
+  WiFiHelper::setupWiFi();
+#elif !defined(ESP_PLATFORM)
+  benchThread = pthread_self();
+  if (!standIn.start()) {
+    Serial.println("Failed to start the stand-in server.");
+    return;
+  }
+#endif
+
+  Serial.println("---- LLMEngine ----");
+  for (int messages : {4, 8, 16}) {
+    benchLLMEngine(messages);
+    benchHistoryFormats(messages);
+#ifdef BENCH_STANDIN
+    benchResponseParsing(messages);
+#endif
+  }
+#ifndef ESP_PLATFORM
+  Serial.println("---- Response parsing ----");
+  for (int bytes : {1024, 4096, 16384}) {
+    benchResponseBuffering(bytes);
+  }
+#endif
+  Serial.println("---- LLMDecisionEngine ----");
+  for (int tools : {4, 8, 16}) {
+    benchDecisionEngine(tools);
+  }
+
+  JsonArena::Stats arena = JsonArena::instance().stats();
+  Serial.printf("JsonArena: high water %u / %u bytes, %u fallbacks\n",
+                (unsigned)arena.highWater, (unsigned)arena.capacity, (unsigned)arena.fallbacks);
+
+#ifdef BENCH_SAVE_BASELINE
+  saveBaseline();
+#else
+  if (!compareWithBaseline()) saveBaseline();
+#endif
+#ifndef ESP_PLATFORM
+  standIn.stop();
+#endif
+}
+
+void loop() {
+  delay(1000);
+}
+
+#ifndef ESP_PLATFORM
+int main() {
+  setup();
+  return 0;
+}
+#endif
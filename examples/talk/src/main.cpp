@@ -17,6 +17,12 @@
 #include "LLMEngine.h"
 #include "LLMDecisionEngine.h"
 #include "IFunctionProvider.h"
+#include "JsonArena.h"
+#include "Trace.h"
+#include "MemoryAccounting.h"
+#ifdef TRACE_TURNS
+#include <SD.h>
+#endif
 
 using namespace m5avatar;
 
@@ -68,8 +74,8 @@ void playbackTask(void*) {
 void thoughPlanTask(void *args)
 {
   for (;;) {
-    plannerScheduler->tick();
-    delay(100);
+    // 次のプランナーの起床時刻まで眠る（最長 1 秒）
+    delay(plannerScheduler->tick());
   }  
 }
 
@@ -99,6 +105,13 @@ void setup() {
   M5.begin();
   Serial.begin(115200);  // ★これを追加
   delay(100);            // ★シリアル同期用の短い待機
+
+  // ターン中の JsonDocument は PSRAM のアリーナから確保する
+  JsonArena::instance().configure(64 * 1024, JsonArena::Memory::Psram);
+#ifdef TRACE_TURNS
+  // ターンごとに /trace.json を書き出す（Perfetto で開く）
+  Trace::enable(512);
+#endif
   std::vector<String> keys;
   
     // スピーカーの設定
@@ -122,6 +135,17 @@ void setup() {
 
       // LLMエンジンの初期化
       decisionEngine = new LLMDecisionEngine(openaiKey);
+      engineManager = new EngineManager(openaiKey);
+      chat = new ChatEngine(openaiKey);
+      // 返答はストリーミングで受け取り、文ができるたびに読み上げ始める
+      chat->setSentenceCallback(SpeechEngine::enqueueText);
+      engineManager->registerEngine("chat", chat, {"こんにちは", "お話ししよう"});
+      thoughtPlanner = new ThoughtPlanner(chat->getLLMEngine());
+      plannerScheduler = new PlannerScheduler(engineManager);
+      plannerScheduler->addPlanner(thoughtPlanner);
+      // 履歴が予算を超えたら、話していない間に古い発話を要約する（話しかけられたら打ち切る）
+      plannerScheduler->addIdleJob([]() { return chat->summarizeIfNeeded(); },
+                                   []() { chat->cancelSummary(); });
       outputMessage("Scceeded to read /apikey.txt");
     } else {
       M5.Lcd.println("APIキー読み込み失敗");
@@ -173,6 +197,8 @@ void loop() {
       if (t.wasPressed()) {
         // 顔全体をトリガーにしたいなら、全体を対象に
         if (true /* もしくは条件 t.x, t.y */) {
+          // 独り言の問い合わせ中なら打ち切り、帯域とメモリをユーザーのターンに回す
+          plannerScheduler->interrupt();
           engineManager->setState(InteractionState::Listening);
           Serial.println("顔タップ！録音開始");
           waitingForTouch = false;
@@ -183,7 +209,11 @@ void loop() {
           avatar.setExpression(Expression::Happy);
           avatar.setSpeechText("きいてるよ");
           delay(60);
-          String userText = stt.transcribe();
+          String userText;
+          {
+            TRACE_SPAN("STTEngine::transcribe");
+            userText = stt.transcribe();
+          }
           avatar.setSpeechText("");
           avatar.setExpression(Expression::Neutral);
           engineManager->setState(InteractionState::Thinking);
@@ -193,9 +223,16 @@ void loop() {
           delay(60);
 
           LLMResponse replies = engineManager->handle(userText);
-          SpeechEngine::enqueueText(replies.message);
+          // ストリーミングで読み上げ済みの返答は、もう一度キューに入れない
+          if (!replies.alreadySpoken) {
+            TRACE_SPAN("SpeechEngine::enqueueText");
+            SpeechEngine::enqueueText(replies.message);
+          }
           avatar.setSpeechText("");
           avatar.setExpression(emotionFromType(replies.emotion));
+#ifdef TRACE_TURNS
+          Trace::dumpToFile(SD, "/trace.json");
+#endif
 
           waitingForTouch = true;
         }
@@ -203,5 +240,9 @@ void loop() {
     }
   }
 
+  // サブシステムごとのメモリ使用量を 1 分ごとに出す
+  if (waitingForTouch) {
+    MemoryAccounting::instance().reportIfDue(Serial, 60000);
+  }
   delay(10);
 }
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+#include <atomic>
+#include <memory>
+
+/**
+ * 問い合わせの取り消し。コピーは同じフラグを共有するので、
+ * 処理側にコピーを渡しておき、別のタスクから cancel() すればよい。
+ *   none() は取り消されることのないトークン（引数の既定値用）。
+ */
+class CancelToken {
+public:
+  CancelToken() : _flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+  static const CancelToken& none() {
+    static const CancelToken token(nullptr);
+    return token;
+  }
+
+  void cancel() const {
+    if (_flag) _flag->store(true);
+  }
+  bool cancelled() const { return _flag && _flag->load(); }
+
+private:
+  explicit CancelToken(std::nullptr_t) {}
+
+  std::shared_ptr<std::atomic<bool>> _flag;
+};
@@ -1,21 +1,105 @@
 #include "ChatEngine.h"
+#include <SD.h>
 
 ChatEngine::ChatEngine(const String& apiKey)
-  : llm(apiKey) {
+  : llm(apiKey), journalStorage(SD), journal(journalStorage) {
+  llm.setJournal(&journal);
   llm.switchTopic("chat");  // デフォルトトピックをセット
 }
 
 LLMResponse ChatEngine::generateReply(const String& input) {
-  llm.addUserMessage(input);
   LLMResponse result;
+  String topic = llm.currentTopic();
+  bool cacheable = responseCache && !responseCache->bypasses(topic);
+  // キーは発話を積む前の履歴（直前の文脈）から作る
+  uint32_t cacheKey = cacheable ? responseCache->makeKey(input, topic, *llm.getHistory()) : 0;
+
+  if (cacheable && responseCache->lookup(cacheKey, result)) {
+    Serial.printf("[ChatEngine] Cached reply (hit rate %.2f)\n", responseCache->hitRate());
+    llm.addUserMessage(input);
+    llm.addAssistantMessage(result.message);
+    if (onSentence && !speculating) {
+      onSentence(result.message);
+      result.alreadySpoken = true;
+    }
+    finishReply();
+    return result;
+  }
 
-  if (llm.sendAndReceive(result)) {
-    llm.saveHistoryToFile("/spiffs/history_" + llm.currentTopic() + ".json");
+  llm.addUserMessage(input);
+  // 投機実行中は確定するまで話し始められないので、ストリーミングしない
+  bool ok;
+  if (onSentence && !speculating) {
+    // 途中で失敗しても、話し始めた分は読み上げ済みとして返す
+    bool spoke = false;
+    ok = llm.sendAndReceiveStreaming(result, [this, &spoke](const String& sentence) {
+      spoke = true;
+      onSentence(sentence);
+    });
+    result.alreadySpoken = spoke;
+  } else {
+    ok = llm.sendAndReceive(result);
+  }
+  if (ok) {
+    if (cacheable) {
+      if (speculating) {
+        pendingCache.valid = true;
+        pendingCache.key = cacheKey;
+        pendingCache.topic = topic;
+        pendingCache.response = result;
+      } else {
+        responseCache->store(cacheKey, topic, result);
+      }
+    }
+    finishReply();
   }
 
   return result;
 }
 
+void ChatEngine::finishReply() {
+  if (speculating) {
+    pendingSave = true;
+  } else {
+    saveHistory();
+  }
+}
+
+void ChatEngine::beginTurn() {
+  speculating = true;
+  pendingSave = false;
+  pendingCache.valid = false;
+  llm.beginTurn();
+}
+
+void ChatEngine::commitTurn() {
+  llm.commitTurn();
+  speculating = false;
+  if (pendingSave) saveHistory();
+  pendingSave = false;
+  if (pendingCache.valid && responseCache) {
+    responseCache->store(pendingCache.key, pendingCache.topic, pendingCache.response);
+  }
+  pendingCache.valid = false;
+}
+
+void ChatEngine::rollbackTurn() {
+  llm.rollbackTurn();
+  speculating = false;
+  pendingSave = false;
+  pendingCache.valid = false;
+}
+
+bool ChatEngine::summarizeIfNeeded() {
+  if (speculating || !llm.summarizeIfNeeded()) return false;
+  saveHistory();
+  return true;
+}
+
+void ChatEngine::saveHistory() {
+  llm.persistHistory();  // ジャーナルがあれば増えた分の追記だけ
+}
+
 void ChatEngine::switchTopic(const String& topic) {
   llm.switchTopic(topic);
 }
@@ -1,6 +1,8 @@
 #pragma once
 #include "IEngine.h"
 #include "LLMEngine.h"
+#include "ResponseCache.h"
+#include "HistoryJournal.h"
 #include <vector>
 
 
@@ -9,13 +11,54 @@ public:
   ChatEngine(const String& apiKey);
   LLMResponse generateReply(const String& input) override;
 
+  bool supportsRollback() const override { return true; }
+  void beginTurn() override;
+  void commitTurn() override;
+  void rollbackTurn() override;
+
   void switchTopic(const String& topic);
   String currentTopic() const;
 
+  // 設定すると返答をストリーミングで受け取り、文ごとに callback へ渡す
+  // （例: SpeechEngine::enqueueText）。返り値の message は全文のままで、
+  // callback に渡した返答は alreadySpoken が true になる（二重に読み上げないこと）。
+  void setSentenceCallback(LLMEngine::SentenceCallback callback) {
+    onSentence = callback;
+  }
+
+  // 履歴が予算を超えていれば古い発話を要約にまとめて保存する。
+  // アイドル時のバックグラウンドジョブから呼ぶ（PlannerScheduler::addIdleJob）
+  bool summarizeIfNeeded();
+  void cancelSummary() { llm.cancelSummary(); }
+
+  // 設定すると、同じ発話（同じトピック・直前の文脈）には保存済みの返答を使う。
+  // ヒットしても履歴には生成したときと同じように積む（nullptr で無効）
+  void setResponseCache(ResponseCache* cache) { responseCache = cache; }
+
   LLMEngine* getLLMEngine() {
     return &llm;
   }
 
 private:
   LLMEngine llm;
+  // 履歴は SD のジャーナルに追記で保存する（毎ターン JSON 全体を書き直さない）。
+  // 以前の /spiffs/history_<topic>.json は最初に開いたときにスナップショットへ移す
+  FsJournalStorage journalStorage;
+  HistoryJournal journal;
+  LLMEngine::SentenceCallback onSentence;
+  bool speculating = false;
+  bool pendingSave = false;
+  ResponseCache* responseCache = nullptr;
+
+  // 投機実行中の返答は確定してからキャッシュする
+  struct PendingCache {
+    bool valid = false;
+    uint32_t key = 0;
+    String topic;
+    LLMResponse response;
+  };
+  PendingCache pendingCache;
+
+  void finishReply();
+  void saveHistory();
 };
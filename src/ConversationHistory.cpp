@@ -0,0 +1,139 @@
+#include "ConversationHistory.h"
+#include "TextUtils.h"
+#include "MemoryAccounting.h"
+
+// 区切りの "," の分
+static const size_t kSeparatorBytes = 1;
+
+static void serializeMessage(String& out, const char* role, const String& content) {
+  out = "{\"role\":";
+  appendJsonString(out, role, strlen(role));
+  out += ",\"content\":";
+  appendJsonString(out, content);
+  out += '}';
+}
+
+ConversationHistory::ConversationHistory(size_t byteBudget)
+  : _budget(byteBudget) {}
+
+ConversationHistory::~ConversationHistory() {
+  MemoryAccounting::instance().freed(MemoryAccounting::History, _accounted);
+}
+
+size_t ConversationHistory::heapBytes() const {
+  return _bytes + _contentBytes + _system.length() + _systemJson.length() +
+         _summary.length() + _summaryJson.length();
+}
+
+void ConversationHistory::account() {
+  size_t now = heapBytes();
+  MemoryAccounting::instance().resized(MemoryAccounting::History, _accounted, now);
+  _accounted = now;
+}
+
+void ConversationHistory::setSystemPrompt(const String& prompt) {
+  _system = prompt;
+  if (_system.isEmpty()) {
+    _systemJson = "";
+  } else {
+    serializeMessage(_systemJson, "system", _system);
+  }
+  account();
+}
+
+void ConversationHistory::setSummary(const String& summary) {
+  _summary = summary;
+  if (_summary.isEmpty()) {
+    _summaryJson = "";
+  } else {
+    serializeMessage(_summaryJson, "system", "これまでの会話の要約: " + _summary);
+  }
+  account();
+}
+
+void ConversationHistory::fill(Slot& s, const char* role, const String& content) {
+  s.message.role = role;        // content はスロットの既存バッファに上書きする
+  s.message.content = content;
+  serializeMessage(s.json, role, content);
+  _bytes += s.json.length() + kSeparatorBytes;
+  _contentBytes += content.length();
+  ++_count;
+  account();
+}
+
+void ConversationHistory::release(Slot& s) {
+  _bytes -= s.json.length() + kSeparatorBytes;
+  _contentBytes -= s.message.content.length();
+  s.message.content = "";
+  s.json = "";
+  --_count;
+  account();
+}
+
+void ConversationHistory::push(const char* role, const String& content) {
+  if (full()) popFront();
+  fill(_slots[slot(_count)], role, content);
+}
+
+void ConversationHistory::pushFront(const Message& message) {
+  if (full()) return;
+  _head = (_head + kCapacity - 1) % kCapacity;
+  fill(_slots[_head], message.role.c_str(), message.content);
+}
+
+Message ConversationHistory::popFront() {
+  if (_count == 0) return Message();
+  Slot& s = _slots[_head];
+  Message out = s.message;
+  release(s);
+  _head = (_head + 1) % kCapacity;
+  return out;
+}
+
+void ConversationHistory::popBack() {
+  if (_count == 0) return;
+  release(_slots[slot(_count - 1)]);
+}
+
+void ConversationHistory::clear() {
+  while (_count > 0) {
+    popBack();
+  }
+  setSummary("");
+  _head = 0;
+}
+
+const Message& ConversationHistory::at(size_t index) const {
+  return _slots[slot(index)].message;
+}
+
+const String& ConversationHistory::json(size_t index) const {
+  return _slots[slot(index)].json;
+}
+
+size_t ConversationHistory::entryBytes(size_t index) const {
+  return json(index).length() + kSeparatorBytes;
+}
+
+size_t ConversationHistory::serializedBytes() const {
+  size_t total = _bytes;
+  if (!_systemJson.isEmpty()) total += _systemJson.length() + kSeparatorBytes;
+  if (!_summaryJson.isEmpty()) total += _summaryJson.length() + kSeparatorBytes;
+  return total;
+}
+
+void ConversationHistory::appendMessagesJson(String& out) const {
+  bool first = true;
+  auto append = [&](const String& fragment) {
+    if (fragment.isEmpty()) return;
+    if (!first) out += ',';
+    out += fragment;
+    first = false;
+  };
+
+  append(_systemJson);
+  append(_summaryJson);
+  for (size_t i = 0; i < _count; ++i) {
+    append(json(i));
+  }
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <Arduino.h>
+#include "Message.h"
+
+/**
+ * 固定容量のリングバッファで持つ会話履歴。
+ *   system プロンプトはリングの外に固定して持ち、user / assistant の発話だけを
+ *   リングに積む。古いものから、件数ではなく推定バイト数の予算で押し出す。
+ *   スロットの String は使い回すので、ターンごとの再確保・シフトが起きない。
+ *   各発話は追加時に JSON 断片へシリアライズしてスロットに持っておき、
+ *   リクエストの組み立てでは断片をつなぐだけにする（押し出された分だけ無効になる）。
+ */
+class ConversationHistory {
+public:
+  static const size_t kCapacity = 16;
+
+  class const_iterator {
+  public:
+    const_iterator(const ConversationHistory* history, size_t index)
+      : _history(history), _index(index) {}
+    const Message& operator*() const { return _history->at(_index); }
+    const Message* operator->() const { return &_history->at(_index); }
+    const_iterator& operator++() { ++_index; return *this; }
+    bool operator!=(const const_iterator& other) const { return _index != other._index; }
+    bool operator==(const const_iterator& other) const { return _index == other._index; }
+  private:
+    const ConversationHistory* _history;
+    size_t _index;
+  };
+
+  explicit ConversationHistory(size_t byteBudget = 3072);
+  ~ConversationHistory();
+
+  void setSystemPrompt(const String& prompt);
+  const String& systemPrompt() const { return _system; }
+
+  // 古い発話をまとめた要約。system プロンプトの直後に送る
+  void setSummary(const String& summary);
+  const String& summary() const { return _summary; }
+
+  // 予算（発話部分の JSON のバイト数）。1 トークン ≒ 日本語 1 文字 ≒ 3 バイトが目安
+  void setByteBudget(size_t bytes) { _budget = bytes; }
+  size_t byteBudget() const { return _budget; }
+  size_t bytes() const { return _bytes; }
+  size_t estimatedTokens() const { return (_bytes + 2) / 3; }
+
+  // 末尾に追加する。容量が一杯なら最も古い発話を捨てる
+  void push(const char* role, const String& content);
+  void pushFront(const Message& message);
+  Message popFront();
+  void popBack();
+  void clear();  // system プロンプトは残し、要約は消す
+
+  bool full() const { return _count == kCapacity; }
+  bool overBudget() const { return _bytes > _budget; }
+  size_t size() const { return _count; }
+  bool empty() const { return _count == 0; }
+  const Message& at(size_t index) const;  // 0 が最も古い発話
+  const Message& back() const { return at(_count - 1); }
+  const String& json(size_t index) const;  // シリアライズ済みの {"role":..,"content":..}
+  size_t entryBytes(size_t index) const;
+
+  // "messages" 配列の中身（system, 要約, 発話の順）を out に追記する
+  void appendMessagesJson(String& out) const;
+  size_t serializedBytes() const;  // appendMessagesJson が追記するおおよそのバイト数
+  size_t heapBytes() const;  // 持っている文字列の合計（MemoryAccounting の History に計上する）
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, _count); }
+
+private:
+  struct Slot {
+    Message message;
+    String json;
+  };
+
+  Slot _slots[kCapacity];
+  String _system;
+  String _systemJson;
+  String _summary;
+  String _summaryJson;
+  size_t _head = 0;   // 最も古い発話のスロット
+  size_t _count = 0;
+  size_t _bytes = 0;
+  size_t _contentBytes = 0;
+  size_t _accounted = 0;
+  size_t _budget;
+
+  size_t slot(size_t index) const { return (_head + index) % kCapacity; }
+  void fill(Slot& s, const char* role, const String& content);
+  void release(Slot& s);
+  void account();
+};
@@ -1,31 +1,181 @@
 #include "EngineManager.h"
 #include "LLMEngine.h"
+#include "Trace.h"
 #include <vector>
+#ifndef ESP_PLATFORM
+#include <thread>
+#endif
 
 EngineManager::EngineManager(const String& apiKey)
   : classifier(apiKey), state(InteractionState::Idle) {}
 
-void EngineManager::registerEngine(const String& intentName, IEngine* engine) {
+void EngineManager::registerEngine(const String& intentName, IEngine* engine,
+                                   const std::vector<String>& examples) {
+  // 候補インテントが変わると、キャッシュ済みの分類結果は当てにならない
+  if (!engineMap.count(intentName)) {
+    classifier.clearCache();
+  }
   engineMap[intentName] = engine;
+  for (const auto& utterance : examples) {
+    localClassifier.addExample(intentName, utterance);
+  }
+}
+
+void EngineManager::addIntentExample(const String& intentName, const String& utterance) {
+  localClassifier.addExample(intentName, utterance);
+}
+
+bool EngineManager::classifyLocally(const String& userInput, const std::vector<String>& intents,
+                                    String& intent, String& guess) {
+  LocalIntentClassifier::Result local;
+  {
+    TRACE_SPAN("LocalIntentClassifier::classify");
+    local = localClassifier.classify(userInput, intents);
+  }
+  if (!local.intent.isEmpty() && local.confidence >= localThreshold) {
+    ++localHits;
+    Serial.printf("[EngineManager] Local intent: %s (%.2f)\n", local.intent.c_str(), local.confidence);
+    intent = local.intent;
+    return true;
+  }
+
+  Serial.printf("[EngineManager] Local confidence %.2f < %.2f, asking remote classifier.\n",
+                local.confidence, localThreshold);
+  guess = local.confidence > 0.0f ? local.intent : lastIntent;
+  return false;
+}
+
+namespace {
+
+struct SpeculativeClassification {
+  IntentClassifier* classifier;
+  String userInput;
+  std::vector<String> intents;
+  String result;
+  unsigned long elapsedMs;
+#ifdef ESP_PLATFORM
+  SemaphoreHandle_t done;
+#endif
+};
+
+void runClassification(SpeculativeClassification* job) {
+  unsigned long start = millis();
+  job->result = job->classifier->classify(job->userInput, job->intents);
+  job->elapsedMs = millis() - start;
+}
+
+#ifdef ESP_PLATFORM
+void classifyTask(void* arg) {
+  SpeculativeClassification* job = static_cast<SpeculativeClassification*>(arg);
+  runClassification(job);
+  xSemaphoreGive(job->done);
+  vTaskDelete(nullptr);
+}
+#endif
+
+}  // namespace
+
+bool EngineManager::speculate(const String& userInput, const std::vector<String>& intents,
+                              const String& predicted, String& intent, LLMResponse& reply) {
+  auto it = engineMap.find(predicted);
+  if (it == engineMap.end() || !it->second->supportsRollback()) return false;
+
+  SpeculativeClassification job;
+  job.classifier = &classifier;
+  job.userInput = userInput;
+  job.intents = intents;
+  job.elapsedMs = 0;
+#ifdef ESP_PLATFORM
+  job.done = xSemaphoreCreateBinary();
+  if (!job.done) return false;
+
+  // 分類はもう一方のコアへ。生成はこのタスクで進める
+  BaseType_t otherCore = xPortGetCoreID() == 0 ? 1 : 0;
+  if (xTaskCreatePinnedToCore(classifyTask, "classify", 8192, &job, 1, nullptr, otherCore) != pdPASS) {
+    vSemaphoreDelete(job.done);
+    return false;
+  }
+#else
+  std::thread classifyThread(runClassification, &job);
+#endif
+
+  Serial.println("[EngineManager] Speculating with engine: " + predicted);
+  unsigned long start = millis();
+  IEngine* engine = it->second;
+  engine->beginTurn();
+  LLMResponse speculativeReply;
+  {
+    TRACE_SPAN("IEngine::generateReply (speculative)");
+    speculativeReply = engine->generateReply(userInput);
+  }
+  unsigned long generateMs = millis() - start;
+
+#ifdef ESP_PLATFORM
+  xSemaphoreTake(job.done, portMAX_DELAY);
+  vSemaphoreDelete(job.done);
+#else
+  classifyThread.join();
+#endif
+  ++remoteFallbacks;
+  ++specStats.attempts;
+  intent = job.result;
+
+  if (intent == predicted) {
+    engine->commitTurn();
+    reply = speculativeReply;
+    unsigned long elapsed = millis() - start;
+    unsigned long sequential = job.elapsedMs + generateMs;
+    ++specStats.wins;
+    specStats.savedMs += sequential > elapsed ? sequential - elapsed : 0;
+    Serial.printf("[EngineManager] Speculation hit, saved ~%lu ms.\n",
+                  sequential > elapsed ? sequential - elapsed : 0UL);
+    return true;
+  }
+
+  engine->rollbackTurn();
+  ++specStats.misses;
+  specStats.wastedMs += generateMs;
+  Serial.println("[EngineManager] Speculation missed, intent: " + intent);
+
+  if (engineMap.count(intent)) {
+    reply = engineMap[intent]->generateReply(userInput);
+  } else {
+    reply = { "ごめんね、よくわからなかったよ。" };
+  }
+  return true;
 }
 
 LLMResponse EngineManager::handle(const String& userInput) {
+  TRACE_SPAN("EngineManager::handle");
   setState(InteractionState::Listening);
   std::vector<String> availableIntents;
   for (const auto& pair : engineMap) {
     availableIntents.push_back(pair.first);
   }
 
-  String intent = classifier.classify(userInput, availableIntents);
-  Serial.print("[EngineManager] Intent classified as: ");
+  String intent;
+  String guess;
   LLMResponse responses;
 
+  if (!classifyLocally(userInput, availableIntents, intent, guess)) {
+    if (speculative && speculate(userInput, availableIntents, guess, intent, responses)) {
+      lastIntent = intent;
+      setState(InteractionState::Speaking);
+      return responses;
+    }
+    ++remoteFallbacks;
+    intent = classifier.classify(userInput, availableIntents);
+  }
+  Serial.println("[EngineManager] Intent classified as: " + intent);
+
   if (engineMap.count(intent)) {
+    TRACE_SPAN("IEngine::generateReply");
     responses = engineMap[intent]->generateReply(userInput);
   } else {
     responses = { "ごめんね、よくわからなかったよ。" };
   }
 
+  lastIntent = intent;
   setState(InteractionState::Speaking); // 発話をキューに入れる場合に合わせて調整可
   return responses;
 }
@@ -3,6 +3,7 @@
 #include <vector>
 #include "IEngine.h"
 #include "IntentClassifier.h"
+#include "LocalIntentClassifier.h"
 #include "LLMEngine.h"
 
 enum class InteractionState {
@@ -16,9 +17,38 @@ class EngineManager {
 public:
   EngineManager(const String& apiKey);
 
-  void registerEngine(const String& intentName, IEngine* engine);
+  // examples はローカル分類器の学習に使う例文（省略可）
+  void registerEngine(const String& intentName, IEngine* engine,
+                      const std::vector<String>& examples = {});
+  void addIntentExample(const String& intentName, const String& utterance);
   LLMResponse handle(const String& userInput);
 
+  // ローカル分類の confidence がこの値未満ならリモート分類にフォールバックする
+  void setLocalConfidenceThreshold(float threshold) {
+    localThreshold = threshold;
+  }
+
+  uint32_t localHitCount() const { return localHits; }
+  uint32_t remoteFallbackCount() const { return remoteFallbacks; }
+
+  // 投機実行: リモート分類をもう一方のコアで走らせつつ、
+  // 直前のインテント（またはローカル分類の最有力候補）のエンジンで返答を生成しておく
+  struct SpeculationStats {
+    uint32_t attempts;
+    uint32_t wins;      // 分類が一致し、投機結果を採用した
+    uint32_t misses;    // 分類が外れ、投機結果を破棄した
+    uint32_t savedMs;   // 一致時に短縮できた時間の合計
+    uint32_t wastedMs;  // 外れたときに捨てた生成時間の合計
+  };
+
+  void setSpeculativeMode(bool enabled) {
+    speculative = enabled;
+  }
+
+  const SpeculationStats& speculationStats() const {
+    return specStats;
+  }
+
   // 新しく追加するメソッド
   void setState(InteractionState newState) {
     state = newState;
@@ -34,7 +64,20 @@ public:
 
 private:
   IntentClassifier classifier;
+  LocalIntentClassifier localClassifier;
   std::map<String, IEngine*> engineMap;
+  float localThreshold = 0.8f;
+  uint32_t localHits = 0;
+  uint32_t remoteFallbacks = 0;
+
+  bool speculative = false;
+  String lastIntent;
+  SpeculationStats specStats = {};
+
+  bool classifyLocally(const String& userInput, const std::vector<String>& intents,
+                       String& intent, String& guess);
+  bool speculate(const String& userInput, const std::vector<String>& intents,
+                 const String& predicted, String& intent, LLMResponse& reply);
 
   InteractionState state = InteractionState::Idle;
 };
@@ -0,0 +1,75 @@
+#pragma once
+#include <Arduino.h>
+#include <string.h>
+
+/**
+ * ヒープを使わない固定容量の文字列（N は終端を含むバイト数）。
+ *   role のように長さの上限が決まっている短い文字列に使う。
+ *   入りきらない分は UTF-8 の文字の途中で切らないように切り詰め、truncated() を立てる。
+ *   String が必要な API との境目では toString() で 1 回だけ確保する。
+ */
+template <size_t N>
+class FixedString {
+public:
+  static_assert(N > 1, "FixedString needs room for at least one character");
+
+  FixedString() { clear(); }
+  FixedString(const char* text) { assign(text); }
+  FixedString(const String& text) { assign(text.c_str(), text.length()); }
+
+  FixedString& operator=(const char* text) { assign(text); return *this; }
+  FixedString& operator=(const String& text) { assign(text.c_str(), text.length()); return *this; }
+
+  void assign(const char* text) { assign(text, text ? strlen(text) : 0); }
+  void assign(const char* text, size_t length) {
+    clear();
+    append(text, length);
+  }
+
+  void append(const char* text, size_t length) {
+    size_t room = N - 1 - _length;
+    if (length > room) {
+      // 続きのバイト（10xxxxxx）で切らないように戻る
+      while (room > 0 && ((unsigned char)text[room] & 0xC0) == 0x80) --room;
+      length = room;
+      _truncated = true;
+    }
+    memcpy(_buffer + _length, text, length);
+    _length += length;
+    _buffer[_length] = '\0';
+  }
+
+  FixedString& operator+=(const char* text) { append(text, strlen(text)); return *this; }
+  FixedString& operator+=(const String& text) { append(text.c_str(), text.length()); return *this; }
+  FixedString& operator+=(char c) { append(&c, 1); return *this; }
+
+  void clear() {
+    _length = 0;
+    _buffer[0] = '\0';
+    _truncated = false;
+  }
+
+  const char* c_str() const { return _buffer; }
+  size_t length() const { return _length; }
+  bool isEmpty() const { return _length == 0; }
+  bool truncated() const { return _truncated; }
+  static constexpr size_t capacity() { return N - 1; }
+
+  String toString() const { return String(_buffer); }
+
+  bool operator==(const char* text) const { return strcmp(_buffer, text) == 0; }
+  bool operator==(const String& text) const {
+    return _length == text.length() && memcmp(_buffer, text.c_str(), _length) == 0;
+  }
+  template <size_t M>
+  bool operator==(const FixedString<M>& other) const {
+    return _length == other.length() && memcmp(_buffer, other.c_str(), _length) == 0;
+  }
+  template <typename T>
+  bool operator!=(const T& other) const { return !(*this == other); }
+
+private:
+  char _buffer[N];
+  size_t _length;
+  bool _truncated;
+};
@@ -0,0 +1,380 @@
+#include "HistoryJournal.h"
+
+const uint8_t HistoryJournal::kFormatVersion;  // vector::push_back に参照で渡すので定義が要る
+
+static const char kFileMagic[3] = {'S', 'C', 'H'};
+static const size_t kFileHeaderBytes = sizeof(kFileMagic) + 1;  // + 形式バージョン
+static const uint8_t kRecordMagic = 0xA5;
+static const size_t kHeaderBytes = 1 + 1 + 4 + 4;   // magic, op, 長さ, CRC
+static const uint32_t kMaxRecordBytes = 64 * 1024;  // これより長い長さは壊れているとみなす
+
+static uint32_t crc32(const uint8_t* data, size_t len, uint32_t crc = 0) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static void putU32(std::vector<uint8_t>& out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out.push_back((uint8_t)(value >> (8 * i)));
+  }
+}
+
+static uint32_t getU32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void putString(std::vector<uint8_t>& out, const char* text, size_t length) {
+  putU32(out, length);
+  out.insert(out.end(), text, text + length);
+}
+
+static void putString(std::vector<uint8_t>& out, const String& text) {
+  putString(out, text.c_str(), text.length());
+}
+
+static void putString(std::vector<uint8_t>& out, const MessageRole& text) {
+  putString(out, text.c_str(), text.length());
+}
+
+static bool getString(const uint8_t*& p, const uint8_t* end, String& text) {
+  if (end - p < 4) return false;
+  uint32_t len = getU32(p);
+  p += 4;
+  if ((uint32_t)(end - p) < len) return false;
+  text = "";
+  text.reserve(len);
+  text.concat((const char*)p, len);
+  p += len;
+  return true;
+}
+
+static bool getString(const uint8_t*& p, const uint8_t* end, MessageRole& text) {
+  if (end - p < 4) return false;
+  uint32_t len = getU32(p);
+  p += 4;
+  if ((uint32_t)(end - p) < len) return false;
+  text.assign((const char*)p, len);
+  p += len;
+  return true;
+}
+
+// ---- FsJournalStorage ----
+
+bool FsJournalStorage::exists(const String& path) {
+  return _fs.exists(path);
+}
+
+bool FsJournalStorage::read(const String& path, std::vector<uint8_t>& out) {
+  // replace() の途中で落ちて一時ファイルだけが残っていれば、それを使う
+  String tmp = path + ".tmp";
+  if (!_fs.exists(path) && _fs.exists(tmp)) {
+    _fs.rename(tmp, path);
+  }
+
+  File file = _fs.open(path, FILE_READ);
+  if (!file) return false;
+  out.resize(file.size());
+  size_t n = out.empty() ? 0 : file.read(out.data(), out.size());
+  file.close();
+  out.resize(n);
+  return true;
+}
+
+void FsJournalStorage::ensureParentDir(const String& path) {
+  int slash = path.lastIndexOf('/');
+  if (slash <= 0) return;
+  String dir = path.substring(0, slash);
+  if (!_fs.exists(dir)) _fs.mkdir(dir);
+}
+
+bool FsJournalStorage::append(const String& path, const uint8_t* data, size_t len) {
+  ensureParentDir(path);
+  File file = _fs.open(path, FILE_APPEND);
+  if (!file) return false;
+  size_t n = file.write(data, len);
+  file.close();
+  return n == len;
+}
+
+bool FsJournalStorage::replace(const String& path, const uint8_t* data, size_t len) {
+  ensureParentDir(path);
+  String tmp = path + ".tmp";
+  File file = _fs.open(tmp, FILE_WRITE);
+  if (!file) return false;
+  size_t n = file.write(data, len);
+  file.close();
+  if (n != len) {
+    _fs.remove(tmp);
+    return false;
+  }
+  if (_fs.exists(path)) _fs.remove(path);
+  return _fs.rename(tmp, path);
+}
+
+bool FsJournalStorage::remove(const String& path) {
+  return !_fs.exists(path) || _fs.remove(path);
+}
+
+// ---- HistoryJournal ----
+
+HistoryJournal::HistoryJournal(JournalStorage& storage, const String& dir)
+  : _storage(storage), _dir(dir) {}
+
+String HistoryJournal::snapshotPath(const String& topic) const {
+  return _dir + "/history_" + topic + ".snap";
+}
+
+String HistoryJournal::journalPath(const String& topic) const {
+  return _dir + "/history_" + topic + ".jnl";
+}
+
+void HistoryJournal::encodeHeader(std::vector<uint8_t>& out) {
+  out.insert(out.end(), kFileMagic, kFileMagic + sizeof(kFileMagic));
+  out.push_back(kFormatVersion);
+}
+
+bool HistoryJournal::decodeFile(const std::vector<uint8_t>& data, std::vector<Record>& out, size_t& valid) {
+  valid = 0;
+  if (data.empty()) return true;
+
+  // ヘッダのないファイルはバージョン 0（レコードがいきなり始まる）
+  size_t offset = 0;
+  if (data[0] != kRecordMagic) {
+    if (data.size() < kFileHeaderBytes) return true;  // ヘッダを書く途中で切れた
+    if (memcmp(data.data(), kFileMagic, sizeof(kFileMagic)) != 0) return false;
+    uint8_t version = data[sizeof(kFileMagic)];
+    if (version > kFormatVersion) {
+      Serial.printf("[HistoryJournal] Unsupported format version %u.\n", version);
+      return false;
+    }
+    offset = kFileHeaderBytes;
+  }
+
+  valid = offset + decode(data.data() + offset, data.size() - offset, out);
+  return true;
+}
+
+void HistoryJournal::encode(std::vector<uint8_t>& out, const Record& record) {
+  std::vector<uint8_t> body;
+  switch (record.op) {
+    case Op::Generation:
+      putU32(body, record.count);
+      break;
+    case Op::Clear:
+      putString(body, record.content);
+      break;
+    case Op::Append:
+      putString(body, record.role);
+      putString(body, record.content);
+      break;
+    case Op::Summary:
+      putU32(body, record.count);
+      putString(body, record.content);
+      break;
+  }
+
+  uint8_t op = (uint8_t)record.op;
+  uint32_t crc = crc32(&op, 1);
+  crc = crc32(body.data(), body.size(), crc);
+
+  out.push_back(kRecordMagic);
+  out.push_back(op);
+  putU32(out, body.size());
+  putU32(out, crc);
+  out.insert(out.end(), body.begin(), body.end());
+}
+
+size_t HistoryJournal::decode(const uint8_t* data, size_t size, std::vector<Record>& out) {
+  size_t pos = 0;
+  while (size - pos >= kHeaderBytes) {
+    const uint8_t* header = data + pos;
+    if (header[0] != kRecordMagic) break;
+    uint8_t op = header[1];
+    uint32_t len = getU32(header + 2);
+    uint32_t crc = getU32(header + 6);
+    if (len > kMaxRecordBytes || size - pos - kHeaderBytes < len) break;
+
+    const uint8_t* p = header + kHeaderBytes;
+    const uint8_t* end = p + len;
+    if (crc32(p, len, crc32(&op, 1)) != crc) break;
+
+    Record record{(Op)op, "", "", 0};
+    bool ok = true;
+    switch (record.op) {
+      case Op::Generation:
+        ok = len == 4;
+        if (ok) record.count = getU32(p);
+        break;
+      case Op::Clear:
+        ok = getString(p, end, record.content);
+        break;
+      case Op::Append:
+        ok = getString(p, end, record.role) && getString(p, end, record.content);
+        break;
+      case Op::Summary:
+        ok = len >= 4;
+        if (ok) {
+          record.count = getU32(p);
+          p += 4;
+          ok = getString(p, end, record.content);
+        }
+        break;
+      default:
+        ok = false;
+        break;
+    }
+    if (!ok) break;
+
+    out.push_back(record);
+    pos += kHeaderBytes + len;
+  }
+  return pos;
+}
+
+bool HistoryJournal::open(const String& topic, Applier apply) {
+  uint32_t started = micros();
+  bool found;
+  if (!_parked.topic.isEmpty() && _parked.topic == topic) {
+    // 保存済みの状態がメモリにあるので、ファイルは読まない
+    _topic = topic;
+    _generation = _parked.generation;
+    _journalBytes = _parked.journalBytes;
+    _readOnly = false;
+    for (const auto& record : _parked.state) apply(record);
+    ++_stats.parkedHits;
+    found = true;
+    // 開いたトピックはこの後ジャーナルに書き足されるので、覚えていた状態はもう使えない
+    _parked = Parked{"", 0, 0, {}};
+  } else {
+    // 別のトピックを開いても、park した状態は戻ってくるときのために残す
+    found = load(topic, apply);
+  }
+  _stats.openMicros = micros() - started;
+  return found;
+}
+
+void HistoryJournal::park(const std::vector<Record>& state) {
+  _parked = Parked{_topic, _generation, _journalBytes, state};
+}
+
+bool HistoryJournal::load(const String& topic, Applier apply) {
+  _topic = topic;
+  _generation = 0;
+  _journalBytes = 0;
+  _readOnly = false;
+
+  bool found = false;
+  std::vector<uint8_t> data;
+  std::vector<Record> records;
+
+  size_t valid = 0;
+  if (_storage.read(snapshotPath(topic), data)) {
+    if (!decodeFile(data, records, valid)) {
+      _readOnly = true;
+      Serial.printf("[HistoryJournal] Cannot read snapshot for '%s'; leaving it untouched.\n",
+                    topic.c_str());
+      return false;
+    }
+    if (!records.empty() && records.front().op == Op::Generation) {
+      _generation = records.front().count;
+      found = true;
+      for (size_t i = 1; i < records.size(); ++i) apply(records[i]);
+    }
+    if (valid != data.size()) {
+      // スナップショットは差し替えでしか書かないので、ここに来るのは媒体の故障
+      Serial.printf("[HistoryJournal] Snapshot for '%s' is damaged.\n", topic.c_str());
+    }
+  }
+
+  data.clear();
+  records.clear();
+  if (!_storage.read(journalPath(topic), data)) {
+    return found;
+  }
+
+  if (!decodeFile(data, records, valid)) {
+    // 読めないジャーナルの後ろに追記したり、圧縮で消したりしない
+    _readOnly = true;
+    Serial.printf("[HistoryJournal] Cannot read journal for '%s'; leaving it untouched.\n",
+                  topic.c_str());
+    return found;
+  }
+  if (records.empty() || records.front().op != Op::Generation ||
+      records.front().count != _generation) {
+    // 圧縮の途中で落ちた古いジャーナル。中身はスナップショットに入っている
+    _storage.remove(journalPath(topic));
+    return found;
+  }
+
+  for (size_t i = 1; i < records.size(); ++i) apply(records[i]);
+  _journalBytes = valid;
+
+  if (valid != data.size()) {
+    // 書き込み途中で切れた末尾を落とし、次の追記がその後ろに続かないようにする
+    ++_stats.tornTails;
+    Serial.printf("[HistoryJournal] Dropped %u torn bytes from '%s'.\n",
+                  (unsigned)(data.size() - valid), topic.c_str());
+    _storage.replace(journalPath(topic), data.data(), valid);
+  }
+  return true;
+}
+
+bool HistoryJournal::append(const std::vector<Record>& records) {
+  if (_topic.isEmpty() || _readOnly || records.empty()) return false;
+
+  uint32_t started = micros();
+  std::vector<uint8_t> data;
+  if (_journalBytes == 0) {
+    encodeHeader(data);
+    encode(data, Record{Op::Generation, "", "", _generation});
+  }
+  for (const auto& record : records) {
+    encode(data, record);
+  }
+
+  if (!_storage.append(journalPath(_topic), data.data(), data.size())) {
+    Serial.println("[HistoryJournal] Append failed.");
+    return false;
+  }
+  _journalBytes += data.size();
+  ++_stats.appends;
+  _stats.appendBytes += data.size();
+  _stats.appendMicros = micros() - started;
+  return true;
+}
+
+bool HistoryJournal::needsCompaction() const {
+  return _journalBytes > _compactBytes;
+}
+
+bool HistoryJournal::compact(const std::vector<Record>& state) {
+  if (_topic.isEmpty() || _readOnly) return false;
+
+  // 新しい世代のスナップショットを書いてから古いジャーナルを消す。
+  // 間で落ちても、世代の合わないジャーナルは読み込み時に無視される
+  uint32_t started = micros();
+  uint32_t next = _generation + 1;
+  std::vector<uint8_t> data;
+  encodeHeader(data);
+  encode(data, Record{Op::Generation, "", "", next});
+  for (const auto& record : state) {
+    encode(data, record);
+  }
+  if (!_storage.replace(snapshotPath(_topic), data.data(), data.size())) {
+    Serial.println("[HistoryJournal] Snapshot write failed.");
+    return false;
+  }
+
+  _generation = next;
+  _journalBytes = 0;
+  _storage.remove(journalPath(_topic));
+  ++_stats.compactions;
+  _stats.appendMicros = micros() - started;
+  return true;
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <functional>
+#include <vector>
+#include "Message.h"
+
+/**
+ * 履歴ファイルの読み書き先。SD / SPIFFS は FsJournalStorage を使う。
+ * PC（env:native）では test/host の fs::FS がディレクトリに読み書きするので、
+ * FsJournalStorage をそのまま使える（test/test_history_journal）。
+ */
+class JournalStorage {
+public:
+  virtual ~JournalStorage() {}
+  virtual bool exists(const String& path) = 0;
+  virtual bool read(const String& path, std::vector<uint8_t>& out) = 0;
+  virtual bool append(const String& path, const uint8_t* data, size_t len) = 0;
+  // 一時ファイルに書いてから差し替える。途中で電源が落ちても元のファイルか新しいファイルが残る
+  virtual bool replace(const String& path, const uint8_t* data, size_t len) = 0;
+  virtual bool remove(const String& path) = 0;
+};
+
+class FsJournalStorage : public JournalStorage {
+public:
+  explicit FsJournalStorage(fs::FS& fs) : _fs(fs) {}
+  bool exists(const String& path) override;
+  bool read(const String& path, std::vector<uint8_t>& out) override;
+  bool append(const String& path, const uint8_t* data, size_t len) override;
+  bool replace(const String& path, const uint8_t* data, size_t len) override;
+  bool remove(const String& path) override;
+
+private:
+  fs::FS& _fs;
+
+  void ensureParentDir(const String& path);  // SD は親ディレクトリが無いと書けない
+};
+
+/**
+ * トピックごとの追記型の会話履歴。
+ *   <dir>/history_<topic>.jnl  … 発話 1 件ごとに 1 レコードを追記する
+ *   <dir>/history_<topic>.snap … ジャーナルが大きくなったら、現在の状態をまとめて書き直す
+ *
+ *   ファイルは "SCH" + 形式バージョン（1 バイト）で始まり、その後にレコードが並ぶ。
+ *   レコードは [0xA5][op][長さ u32][CRC32 u32][本文]。読み込み時は
+ *   スナップショット → ジャーナルの順に再生し、CRC が合わない・途中で切れている
+ *   レコードに当たったらそこで止める（書き込み中の電源断で残った末尾を捨てる）。
+ *   どちらのファイルも先頭に世代番号を持ち、世代が違うジャーナルは再生しない。
+ *
+ *   park() で直前のトピックの状態をメモリに残しておくと、そのトピックに戻るときは
+ *   ファイルを読まずに済む（雑談 ↔ 別の話題の行き来が速くなる）。
+ */
+class HistoryJournal {
+public:
+  enum class Op : uint8_t {
+    Generation = 'G',  // count = 世代番号（ファイルの先頭にだけ置く）
+    Clear      = 'C',  // 履歴を消す。content = system プロンプト
+    Append     = 'A',  // role / content を末尾に追加
+    Summary    = 'S',  // 先頭から count 件だけ残るように捨て、content を要約にする
+  };
+
+  struct Record {
+    Op op;
+    MessageRole role;
+    String content;
+    uint32_t count;
+  };
+
+  struct Stats {
+    uint32_t appends;       // 追記した回数
+    uint32_t appendBytes;
+    uint32_t compactions;
+    uint32_t tornTails;     // 読み込み時に捨てた壊れた末尾の数
+    uint32_t parkedHits;    // park した状態から読み込んだ回数
+    uint32_t openMicros;    // 直近の open() にかかった時間
+    uint32_t appendMicros;  // 直近の append() / compact() にかかった時間
+  };
+
+  static const uint8_t kFormatVersion = 1;
+
+  using Applier = std::function<void(const Record&)>;
+
+  explicit HistoryJournal(JournalStorage& storage, const String& dir = "/spiffs");
+
+  // topic のスナップショットとジャーナルを apply に流す。どちらもなければ false
+  bool open(const String& topic, Applier apply);
+
+  // 開いているトピックのジャーナルにまとめて 1 回で追記する
+  bool append(const std::vector<Record>& records);
+
+  // 現在の状態でスナップショットを作り直し、ジャーナルを空にする
+  bool compact(const std::vector<Record>& state);
+  bool needsCompaction() const;
+
+  // 開いているトピックの（保存済みの）状態を覚えておき、次にそのトピックを開くときに使う
+  void park(const std::vector<Record>& state);
+  void setCompactionThreshold(size_t bytes) { _compactBytes = bytes; }
+
+  const String& topic() const { return _topic; }
+  // 開いたトピックのファイルが読めない形式（新しいバージョンなど）だった。
+  // 上書きで中身を失わないよう、このトピックには append() も compact() もしない
+  bool readOnly() const { return _readOnly; }
+  const Stats& stats() const { return _stats; }
+
+  static Record appendRecord(const char* role, const String& content) {
+    return Record{Op::Append, role, content, 0};
+  }
+  static Record clearRecord(const String& systemPrompt) {
+    return Record{Op::Clear, "", systemPrompt, 0};
+  }
+  static Record summaryRecord(const String& text, uint32_t keep) {
+    return Record{Op::Summary, "", text, keep};
+  }
+
+private:
+  JournalStorage& _storage;
+  String _dir;
+  String _topic;
+  uint32_t _generation = 0;
+  size_t _journalBytes = 0;
+  size_t _compactBytes = 16 * 1024;
+  bool _readOnly = false;
+  Stats _stats = {};
+
+  struct Parked {
+    String topic;
+    uint32_t generation;
+    size_t journalBytes;
+    std::vector<Record> state;
+  };
+  Parked _parked = {"", 0, 0, {}};
+
+  bool load(const String& topic, Applier apply);
+  String snapshotPath(const String& topic) const;
+  String journalPath(const String& topic) const;
+
+  static void encodeHeader(std::vector<uint8_t>& out);
+  static void encode(std::vector<uint8_t>& out, const Record& record);
+  // ファイル全体を読む。形式が読めないときは false
+  static bool decodeFile(const std::vector<uint8_t>& data, std::vector<Record>& out, size_t& valid);
+  // 正常に読めたところまでのバイト数を返す
+  static size_t decode(const uint8_t* data, size_t size, std::vector<Record>& out);
+};
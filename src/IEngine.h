@@ -6,5 +6,12 @@
 class IEngine {
 public:
   virtual LLMResponse generateReply(const String& userInput) = 0;
+
+  // 投機実行のサポート。beginTurn() 以降の変更（履歴・保存）は保留され、
+  // commitTurn() で確定、rollbackTurn() で破棄される
+  virtual bool supportsRollback() const { return false; }
+  virtual void beginTurn() {}
+  virtual void commitTurn() {}
+  virtual void rollbackTurn() {}
   virtual ~IEngine() {}
 };
@@ -12,6 +12,13 @@ struct PlannedTopic {
   IntentType intent;
 };
 
+// 複数のプランナーが同時に話題を持っているときは、大きいほうを先に話す
+enum PlannerPriority {
+  PriorityIdle   = 0,    // 独り言など、いつ話してもよいもの
+  PriorityNormal = 50,
+  PriorityUrgent = 100   // リマインダーなど、遅れると困るもの
+};
+
 class IPlanner {
 public:
   typedef void (*TopicCallback)(const PlannedTopic&);
@@ -19,4 +26,11 @@ public:
   virtual bool hasTopic() const = 0;
   virtual PlannedTopic getTopic() = 0;
   virtual void resetTiming() = 0;
+
+  // 次に tick() を呼んでほしい時刻（millis()）。話題を持っている・状態を
+  // 見張る必要があるなら now を返す。スケジューラはそれまで眠る
+  virtual unsigned long nextWakeMs(unsigned long now) const { return now; }
+  virtual int priority() const { return PriorityNormal; }
+  // ユーザーが割り込んだとき。問い合わせ中なら打ち切り、用意した話題も捨てる
+  virtual void cancel() {}
 };
@@ -1,26 +1,58 @@
 #include "IntentClassifier.h"
 #include <ArduinoJson.h>
-#include <HTTPClient.h>
-#include <WiFiClientSecure.h>
+#include <algorithm>
+#include "SDUtils.h"
+#include "TextUtils.h"
+#include "JsonArena.h"
+#include "StringBuilder.h"
+#include "Trace.h"
+
+// 永続化は連続した書き込みで flash を傷めないよう、この間隔より頻繁には行わない
+static const unsigned long kCacheSaveIntervalMs = 60000;
 
 IntentClassifier::IntentClassifier(const String& apiKey) : _apiKey(apiKey) {}
 
-String IntentClassifier::classify(const String& userInput, const std::vector<String>& intents) {
-  String intentList = "";
-  for (size_t i = 0; i < intents.size(); ++i) {
-    intentList += "'" + intents[i] + "'";
-    if (i != intents.size() - 1) intentList += "、";
+String IntentClassifier::classify(const String& userInput, const std::vector<String>& intents,
+                                  const CancelToken& cancel) {
+  TRACE_SPAN("IntentClassifier::classify");
+  uint32_t key = makeCacheKey(userInput, intents);
+  String intent;
+  if (lookupCache(key, intent)) {
+    ++_cacheHits;
+    Serial.printf("[IntentClassifier] Cache hit: %s (hit rate %.2f)\n", intent.c_str(), cacheHitRate());
+    return intent;
   }
+  ++_cacheMisses;
+
+  intent = classifyRemote(userInput, intents, cancel);
 
-  String systemPrompt = "次の発言が以下の分類のうちどれに該当するかを判定してください。"
-                        "返答は分類名を1語だけ返してください。候補：" + intentList;
+  // 候補に無い返答（unknown や表記揺れ）はキャッシュしない
+  if (std::find(intents.begin(), intents.end(), intent) != intents.end()) {
+    storeCache(key, intent, millis());
+    if (_cacheDirty && !_cachePath.isEmpty() && millis() - _lastCacheSave > kCacheSaveIntervalMs) {
+      saveCache();
+    }
+  }
+  return intent;
+}
 
-  JsonDocument doc;
+String IntentClassifier::classifyRemote(const String& userInput, const std::vector<String>& intents,
+                                        const CancelToken& cancel) {
+  JsonArena::Turn turn;
+  StringBuilder systemPrompt(256);
+  systemPrompt << "次の発言が以下の分類のうちどれに該当するかを判定してください。"
+                  "返答は分類名を1語だけ返してください。候補：";
+  for (size_t i = 0; i < intents.size(); ++i) {
+    systemPrompt << '\'' << intents[i] << '\'';
+    if (i != intents.size() - 1) systemPrompt << "、";
+  }
+
+  JsonDocument doc(&JsonArena::instance());
   doc["model"] = "gpt-3.5-turbo";
   JsonArray messages = doc.createNestedArray("messages");
   JsonObject sys = messages.createNestedObject();
   sys["role"] = "system";
-  sys["content"] = systemPrompt;
+  sys["content"] = systemPrompt.c_str();
   JsonObject usr = messages.createNestedObject();
   usr["role"] = "user";
   usr["content"] = userInput;
@@ -28,26 +60,136 @@ String IntentClassifier::classify(const String& userInput, const std::vector<Str
   String payload;
   serializeJson(doc, payload);
 
-  WiFiClientSecure client;
-  client.setInsecure();
-  HTTPClient https;
-  https.begin(client, "https://api.openai.com/v1/chat/completions");
-  https.addHeader("Authorization", "Bearer " + _apiKey);
-  https.addHeader("Content-Type", "application/json");
+  // 分類は投機実行で別タスクからも呼ばれるので、初期化は static の初期化に任せる
+  static const JsonDocument filter = [] {
+    JsonDocument doc;
+    doc["choices"][0]["message"]["content"] = true;
+    return doc;
+  }();
 
-  int httpCode = https.POST(payload);
-  if (httpCode != 200) {
-    https.end();
+  JsonDocument respDoc(&JsonArena::instance());
+  DeserializationError error = DeserializationError::EmptyInput;
+  int httpCode = _transport->post(_apiKey, payload, [&](HttpBodyStream& body) {
+    error = deserializeJson(respDoc, body, DeserializationOption::Filter(filter));
+    return !error && body.discardRest(1000);
+  }, "application/json", cancel);
+  if (httpCode != 200 || error) {
     return "unknown";
   }
 
-  String response = https.getString();
-  https.end();
-
-  JsonDocument respDoc;
-  if (deserializeJson(respDoc, response)) return "unknown";
-
   String content = respDoc["choices"][0]["message"]["content"];
   content.trim(); content.toLowerCase();
   return content;
 }
+
+uint32_t IntentClassifier::makeCacheKey(const String& userInput, const std::vector<String>& intents) {
+  String normalized = normalizeUtterance(userInput);
+  uint32_t h = fnv1a32(normalized.c_str(), normalized.length());
+  for (const auto& intent : intents) {
+    h = fnv1a32("|", 1, h);
+    h = fnv1a32(intent.c_str(), intent.length(), h);
+  }
+  return h;
+}
+
+bool IntentClassifier::lookupCache(uint32_t key, String& intent) {
+  auto it = _cacheIndex.find(key);
+  if (it == _cacheIndex.end()) return false;
+
+  if (millis() - it->second->storedAt > _cacheTtlMs) {
+    _cache.erase(it->second);
+    _cacheIndex.erase(it);
+    _cacheDirty = true;
+    return false;
+  }
+
+  _cache.splice(_cache.begin(), _cache, it->second);  // 最近使ったものを先頭へ
+  intent = it->second->intent;
+  return true;
+}
+
+void IntentClassifier::storeCache(uint32_t key, const String& intent, unsigned long storedAt) {
+  if (_cacheCapacity == 0) return;
+
+  auto it = _cacheIndex.find(key);
+  if (it != _cacheIndex.end()) {
+    _cache.erase(it->second);
+    _cacheIndex.erase(it);
+  }
+
+  _cache.push_front({ key, intent, storedAt });
+  _cacheIndex[key] = _cache.begin();
+  while (_cache.size() > _cacheCapacity) {
+    _cacheIndex.erase(_cache.back().key);
+    _cache.pop_back();
+  }
+  _cacheDirty = true;
+}
+
+void IntentClassifier::setCacheCapacity(size_t entries) {
+  _cacheCapacity = entries;
+  while (_cache.size() > _cacheCapacity) {
+    _cacheIndex.erase(_cache.back().key);
+    _cache.pop_back();
+  }
+}
+
+void IntentClassifier::clearCache() {
+  if (_cache.empty()) return;
+  _cache.clear();
+  _cacheIndex.clear();
+  _cacheDirty = true;
+  if (!_cachePath.isEmpty()) saveCache();
+}
+
+float IntentClassifier::cacheHitRate() const {
+  uint32_t total = _cacheHits + _cacheMisses;
+  return total ? (float)_cacheHits / total : 0.0f;
+}
+
+void IntentClassifier::enableCachePersistence(const String& path) {
+  _cachePath = path;
+  if (!_cachePath.isEmpty()) loadCache();
+}
+
+bool IntentClassifier::saveCache() {
+  if (_cachePath.isEmpty()) return false;
+
+  // millis() は再起動でリセットされるので、残り TTL で保存する
+  unsigned long now = millis();
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
+  JsonArray entries = doc.to<JsonArray>();
+  for (const auto& entry : _cache) {
+    unsigned long age = now - entry.storedAt;
+    if (age > _cacheTtlMs) continue;
+    JsonObject obj = entries.add<JsonObject>();
+    obj["key"] = entry.key;
+    obj["intent"] = entry.intent;
+    obj["ttl"] = _cacheTtlMs - age;
+  }
+
+  _lastCacheSave = now;
+  if (!writeJsonToSD(_cachePath.c_str(), doc)) return false;
+  _cacheDirty = false;
+  return true;
+}
+
+bool IntentClassifier::loadCache() {
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
+  if (!readJsonFromSD(_cachePath.c_str(), doc)) return false;
+
+  // ファイルは新しい順に並んでいるので、古いものから積んで順序を保つ
+  unsigned long now = millis();
+  JsonArray entries = doc.as<JsonArray>();
+  for (int i = entries.size() - 1; i >= 0; --i) {
+    JsonObject obj = entries[i];
+    unsigned long ttl = obj["ttl"] | 0UL;
+    if (ttl == 0 || ttl > _cacheTtlMs) continue;
+    storeCache(obj["key"].as<uint32_t>(), obj["intent"].as<String>(), now - (_cacheTtlMs - ttl));
+  }
+  _cacheDirty = false;
+  Serial.printf("[IntentClassifier] Loaded %u cached intents.\n", (unsigned)_cache.size());
+  return true;
+}
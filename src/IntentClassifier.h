@@ -1,12 +1,56 @@
 #pragma once
 #include <Arduino.h>
+#include <list>
+#include <map>
 #include <vector>
+#include "OpenAITransport.h"
 
 class IntentClassifier {
 public:
   IntentClassifier(const String& apiKey);
-  String classify(const String& userInput, const std::vector<String>& intents);
-  
+  // cancel された場合は "unknown" を返す（キャッシュもしない）
+  String classify(const String& userInput, const std::vector<String>& intents,
+                  const CancelToken& cancel = CancelToken::none());
+  void setTransport(OpenAITransport* transport) { _transport = transport; }
+
+  // 分類結果の LRU キャッシュ。キーは正規化した発話と候補インテントの組
+  void setCacheCapacity(size_t entries);
+  void setCacheTtl(unsigned long ttlMs) { _cacheTtlMs = ttlMs; }
+  void clearCache();
+
+  // path を指定すると SPIFFS に保存し、再起動後も読み込む（空文字で無効）
+  void enableCachePersistence(const String& path);
+  bool saveCache();
+
+  uint32_t cacheHits() const { return _cacheHits; }
+  uint32_t cacheMisses() const { return _cacheMisses; }
+  float cacheHitRate() const;
+
 private:
+  struct CacheEntry {
+    uint32_t key;
+    String intent;
+    unsigned long storedAt;
+  };
+
   String _apiKey;
+  OpenAITransport* _transport = &OpenAITransport::shared();
+
+  std::list<CacheEntry> _cache;  // 先頭が最近使ったもの
+  std::map<uint32_t, std::list<CacheEntry>::iterator> _cacheIndex;
+  size_t _cacheCapacity = 32;
+  unsigned long _cacheTtlMs = 24UL * 60 * 60 * 1000;
+  uint32_t _cacheHits = 0;
+  uint32_t _cacheMisses = 0;
+
+  String _cachePath;
+  bool _cacheDirty = false;
+  unsigned long _lastCacheSave = 0;
+
+  String classifyRemote(const String& userInput, const std::vector<String>& intents,
+                        const CancelToken& cancel);
+  static uint32_t makeCacheKey(const String& userInput, const std::vector<String>& intents);
+  bool lookupCache(uint32_t key, String& intent);
+  void storeCache(uint32_t key, const String& intent, unsigned long storedAt);
+  bool loadCache();
 };
@@ -0,0 +1,197 @@
+#include "JsonArena.h"
+#include "MemoryAccounting.h"
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+// 各ブロックの前に置くヘッダ。realloc でのコピー量を知るため
+struct ArenaBlock {
+  uint32_t size;
+  uint32_t reserved;  // 8 バイト境界を保つ
+};
+
+static size_t alignBlock(size_t size) {
+  return (size + 7) & ~(size_t)7;
+}
+
+// PC（ESP_PLATFORM 以外）には PSRAM が無いので、どちらもふつうのヒープから取る
+static uint8_t* allocateBuffer(size_t capacity, JsonArena::Memory memory) {
+#ifdef ESP_PLATFORM
+  uint32_t caps = memory == JsonArena::Memory::Psram ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL;
+  return (uint8_t*)heap_caps_malloc(capacity, caps | MALLOC_CAP_8BIT);
+#else
+  (void)memory;
+  return (uint8_t*)malloc(capacity);
+#endif
+}
+
+static void freeBuffer(uint8_t* buffer) {
+#ifdef ESP_PLATFORM
+  heap_caps_free(buffer);
+#else
+  free(buffer);
+#endif
+}
+
+// ヒープに回したブロックの実際の大きさ（MemoryAccounting に計上する分）
+static size_t heapBlockSize(void* ptr) {
+#ifdef ESP_PLATFORM
+  return heap_caps_get_allocated_size(ptr);
+#elif defined(__APPLE__)
+  return malloc_size(ptr);
+#else
+  return malloc_usable_size(ptr);
+#endif
+}
+
+JsonArena& JsonArena::instance() {
+  static JsonArena arena;
+  return arena;
+}
+
+bool JsonArena::configure(size_t capacity, Memory memory) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_activeTurns > 0) return false;  // 使用中は差し替えない
+
+  if (_buffer) {
+    freeBuffer(_buffer);
+    _buffer = nullptr;
+  }
+  _capacity = 0;
+  _used = 0;
+  _last = SIZE_MAX;
+  _memory = memory;
+  if (capacity == 0) return true;
+
+  if (memory == Memory::Psram) {
+    _buffer = allocateBuffer(capacity, Memory::Psram);
+    if (!_buffer) {
+      Serial.println("[JsonArena] PSRAM not available, using internal RAM.");
+      _memory = Memory::Internal;
+    }
+  }
+  if (!_buffer) {
+    _buffer = allocateBuffer(capacity, Memory::Internal);
+  }
+  if (!_buffer) return false;
+
+  MemoryAccounting::instance().setHeap(MemoryAccounting::Arena, _memory == Memory::Psram
+                                       ? MemoryAccounting::Heap::Psram
+                                       : MemoryAccounting::Heap::Internal);
+  _capacity = capacity;
+  _stats.capacity = capacity;
+  return true;
+}
+
+void JsonArena::beginTurn() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  ++_activeTurns;
+}
+
+void JsonArena::endTurn() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_activeTurns > 0 && --_activeTurns == 0) {
+    MemoryAccounting::instance().freed(MemoryAccounting::Arena, _used);
+    _used = 0;
+    _last = SIZE_MAX;
+    ++_stats.resets;
+  }
+}
+
+bool JsonArena::owns(const void* ptr) const {
+  return _buffer && ptr >= _buffer && ptr < _buffer + _capacity;
+}
+
+void* JsonArena::allocateLocked(size_t size) {
+  ++_stats.allocations;
+
+  size_t need = sizeof(ArenaBlock) + alignBlock(size);
+  if (_activeTurns > 0 && _buffer && _used + need <= _capacity) {
+    ArenaBlock* block = (ArenaBlock*)(_buffer + _used);
+    block->size = size;
+    _last = _used;
+    _used += need;
+    if (_used > _stats.highWater) _stats.highWater = _used;
+    MemoryAccounting::instance().allocated(MemoryAccounting::Arena, need);
+    return block + 1;
+  }
+
+  ++_stats.fallbacks;
+  void* ptr = malloc(size);
+  if (ptr) MemoryAccounting::instance().allocated(MemoryAccounting::Arena, heapBlockSize(ptr));
+  return ptr;
+}
+
+void* JsonArena::allocate(size_t size) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return allocateLocked(size);
+}
+
+void JsonArena::deallocate(void* ptr) {
+  if (!ptr) return;
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (!owns(ptr)) {
+    MemoryAccounting::instance().freed(MemoryAccounting::Arena, heapBlockSize(ptr));
+    free(ptr);
+    return;
+  }
+
+  // 最後のブロックだけはすぐに戻せる。それ以外はリセットまで置いておく
+  ArenaBlock* block = (ArenaBlock*)ptr - 1;
+  if ((uint8_t*)block - _buffer == (ptrdiff_t)_last) {
+    MemoryAccounting::instance().freed(MemoryAccounting::Arena, _used - _last);
+    _used = _last;
+    _last = SIZE_MAX;
+  }
+}
+
+void* JsonArena::reallocate(void* ptr, size_t newSize) {
+  if (!ptr) return allocate(newSize);
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (!owns(ptr)) {
+    size_t oldSize = heapBlockSize(ptr);
+    void* moved = realloc(ptr, newSize);
+    if (moved) {
+      MemoryAccounting::instance().resized(MemoryAccounting::Arena, oldSize,
+                                           heapBlockSize(moved));
+    }
+    return moved;
+  }
+
+  ArenaBlock* block = (ArenaBlock*)ptr - 1;
+  size_t offset = (uint8_t*)block - _buffer;
+
+  // 最後のブロックなら、その場で伸縮する
+  if (offset == _last && offset + sizeof(ArenaBlock) + alignBlock(newSize) <= _capacity) {
+    block->size = newSize;
+    size_t used = offset + sizeof(ArenaBlock) + alignBlock(newSize);
+    MemoryAccounting::instance().resized(MemoryAccounting::Arena, _used, used);
+    _used = used;
+    if (_used > _stats.highWater) _stats.highWater = _used;
+    return ptr;
+  }
+
+  // 途中のブロックの縮小はそのまま返す（余った分は Turn の終わりにまとめて戻る）
+  size_t oldSize = block->size;
+  if (newSize <= oldSize) return ptr;
+
+  void* moved = allocateLocked(newSize);
+  if (moved) {
+    memcpy(moved, ptr, min(oldSize, newSize));
+  }
+  return moved;
+}
+
+JsonArena::Stats JsonArena::stats() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stats;
+}
+
+size_t JsonArena::largestFreeInternalBlock() {
+  return MemoryAccounting::largestFreeBlock(MemoryAccounting::Heap::Internal);
+}
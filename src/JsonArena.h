@@ -0,0 +1,68 @@
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <mutex>
+
+/**
+ * 1 ターンの間だけ使う JsonDocument 用のバンプアロケータ。
+ *   起動時に PSRAM（または内部 RAM）から 1 ブロックだけ確保し、
+ *   ターン中の確保はその中から切り出す。最後の Turn が終わった時点で
+ *   まとめて解放（リセット）するので、内部ヒープが細切れにならない。
+ *
+ *   使い方:
+ *     JsonArena::Turn turn;                      // 関数の先頭で
+ *     JsonDocument doc(&JsonArena::instance());  // ターン内で捨てるドキュメントだけ
+ *
+ *   Turn の外での確保や、容量を使い切った後の確保は通常のヒープに回る。
+ *   ターンをまたいで保持するドキュメント（メンバー変数など）には使わないこと。
+ */
+class JsonArena : public ArduinoJson::Allocator {
+public:
+  enum class Memory { Internal, Psram };
+
+  struct Stats {
+    uint32_t allocations;  // 確保要求の回数
+    uint32_t fallbacks;    // アリーナに収まらずヒープに回した回数
+    uint32_t resets;
+    size_t highWater;      // アリーナの最大使用量
+    size_t capacity;
+  };
+
+  class Turn {
+  public:
+    Turn() { JsonArena::instance().beginTurn(); }
+    ~Turn() { JsonArena::instance().endTurn(); }
+    Turn(const Turn&) = delete;
+    Turn& operator=(const Turn&) = delete;
+  };
+
+  static JsonArena& instance();
+
+  // capacity = 0 でアリーナを無効にする（すべて通常のヒープ）
+  bool configure(size_t capacity, Memory memory = Memory::Psram);
+
+  void* allocate(size_t size) override;
+  void deallocate(void* ptr) override;
+  void* reallocate(void* ptr, size_t newSize) override;
+
+  Stats stats() const;
+  Memory memory() const { return _memory; }
+  static size_t largestFreeInternalBlock();
+
+private:
+  JsonArena() {}
+
+  uint8_t* _buffer = nullptr;
+  size_t _capacity = 0;
+  size_t _used = 0;
+  size_t _last = SIZE_MAX;  // 最後に切り出したブロックの位置（その場で伸縮できる）
+  int _activeTurns = 0;
+  Memory _memory = Memory::Psram;
+  Stats _stats = {};
+  mutable std::mutex _mutex;
+
+  void beginTurn();
+  void endTurn();
+  bool owns(const void* ptr) const;
+  void* allocateLocked(size_t size);
+};
@@ -1,42 +1,103 @@
 // LLMDecisionEngine.cpp
 #include "LLMDecisionEngine.h"
+#include "LogConfig.h"
+#include "JsonArena.h"
+#include "TextUtils.h"
+#include "Trace.h"
+#include <memory>
+#ifndef ESP_PLATFORM
+#include <thread>
+#endif
 
 LLMDecisionEngine::LLMDecisionEngine(const String& apiKey)
   : _apiKey(apiKey), _functionCallPending(false) {
   _chatHistory["messages"].to<JsonArray>();
 }
 
+LLMDecisionEngine::~LLMDecisionEngine() {
+  MemoryAccounting::instance().freed(MemoryAccounting::DecisionEngine, _stats.toolsBytes);
+}
+
 void LLMDecisionEngine::registerFunction(const String& name, const String& description, const JsonDocument & parameterSchema, FunctionHandler handler) {
-    FunctionSpec spec(description, parameterSchema, handler);
-    _functionRegistry.insert({name, spec});
+    addFunctionSpec(name, FunctionSpec(description, parameterSchema, handler));
+}
+
+void LLMDecisionEngine::registerTool(const String& name, const String& description,
+                                     const JsonDocument& parameterSchema, ToolHandler handler,
+                                     bool concurrent) {
+  addFunctionSpec(name, FunctionSpec(description, parameterSchema, handler, concurrent));
+}
+
+void LLMDecisionEngine::addFunctionSpec(const String& name, const FunctionSpec& spec) {
+  if (_buildingSchema) {
+    _providerFunctions.insert({name, spec});
+  } else {
+    _directFunctions.insert({name, spec});
+    _schemaDirty = true;
+  }
+}
+
+LLMDecisionEngine::FunctionSpec* LLMDecisionEngine::findFunction(const String& name) {
+  auto direct = _directFunctions.find(name);
+  if (direct != _directFunctions.end()) return &direct->second;
+  auto provided = _providerFunctions.find(name);
+  return provided != _providerFunctions.end() ? &provided->second : nullptr;
 }
 
 void LLMDecisionEngine::buildFunctionSchema() {
-  // まず registry をクリア
-  _functionRegistry.clear();
+  if (!_schemaDirty) return;  // 登録が変わっていなければ前回の tools をそのまま使う
+
+  // provider の登録だけを作り直す（直接登録したものは残す）
+  _providerFunctions.clear();
 
   // activeProviders から登録
+  _buildingSchema = true;
   for (auto* provider : _activeProviders) {
     provider->registerFunctions(*this);
   }
+  _buildingSchema = false;
+
+  // tools JSONをbuildして、リクエストに差し込む断片として持っておく
+  JsonArena::Turn turn;
+  JsonDocument toolDefinition(&JsonArena::instance());
+  JsonArray tools = toolDefinition["tools"].to<JsonArray>();
 
-  // tools JSONをbuild
-  JsonArray tools = _toolDefinition["tools"].to<JsonArray>();
-  _toolDefinition["tool_choice"] = "auto";
-  tools.clear();
-  
-  for (const auto& entry : _functionRegistry) {
+  auto addTool = [&tools](const String& name, const FunctionSpec& spec) {
     JsonObject tool = tools.add<JsonObject>();
     tool["type"] = "function";
     JsonObject fn = tool["function"].to<JsonObject>();
-    fn["name"] = entry.first;
-    fn["description"] = entry.second.description;
-    fn["parameters"].set(entry.second.parameterSchema);
+    fn["name"] = name;
+    fn["description"] = spec.description;
+    if (spec.schemaWriter) {
+      spec.schemaWriter(fn["parameters"].to<JsonObject>());
+    } else {
+      fn["parameters"].set(spec.parameterSchema);
+    }
+  };
+  for (const auto& entry : _directFunctions) {
+    addTool(entry.first, entry.second);
+  }
+  for (const auto& entry : _providerFunctions) {
+    if (!_directFunctions.count(entry.first)) addTool(entry.first, entry.second);
+  }
+
+  _toolsJson = "";
+  if (tools.size() > 0) {
+    toolDefinition["tool_choice"] = "auto";
+    serializeJson(toolDefinition, _toolsJson);
+    // 外側の {} を外して "tools":[...],"tool_choice":"auto" にする
+    _toolsJson = _toolsJson.substring(1, _toolsJson.length() - 1);
   }
+  _schemaDirty = false;
+  ++_stats.schemaBuilds;
+  MemoryAccounting::instance().resized(MemoryAccounting::DecisionEngine, _stats.toolsBytes,
+                                       _toolsJson.length());
+  _stats.toolsBytes = _toolsJson.length();
 }
 
 void LLMDecisionEngine::setActiveProviders(const std::vector<IFunctionProvider*>& providers) {
   _activeProviders = providers;
+  _schemaDirty = true;
 }
 
 void LLMDecisionEngine::setSystemPrompt(const String& prompt) {
@@ -86,12 +147,17 @@ void LLMDecisionEngine::rebuildChatHistory() {
   }
 }
 
-bool LLMDecisionEngine::evaluate(String& rawContentOut) {
+bool LLMDecisionEngine::evaluate(String& rawContentOut, const CancelToken& cancel) {
+  TRACE_SPAN("LLMDecisionEngine::evaluate");
+  JsonArena::Turn turn;  // _responseJson はターン後も読むので通常のヒープのまま
+  uint32_t started = micros();
   buildFunctionSchema();
-  injectDynamicSystemRoles();
-  String payload = buildRequestJson();
-  String response = sendRequest(payload);
-  if (!parseResponse(response)) return false;
+  String payload = buildRequestJson(buildDynamicSystemRoles());
+  ++_stats.evaluations;
+  _stats.lastPrepareMicros = micros() - started;
+  THINK_LOG_DEBUG("⏱ Request prepared in %u us (%u bytes)\n",
+                  (unsigned)_stats.lastPrepareMicros, (unsigned)payload.length());
+  if (!sendRequest(payload, cancel)) return false;
 
   JsonObject msg = _responseJson["choices"][0]["message"];
   if (!msg["tool_calls"].isNull()) {
@@ -115,97 +181,265 @@ String LLMDecisionEngine::getFunctionName() {
 
 JsonObject LLMDecisionEngine::getFunctionArguments() {
   const char* rawArgs = _responseJson["choices"][0]["message"]["tool_calls"][0]["function"]["arguments"];
-  static JsonDocument argsDoc;
-  DeserializationError err = deserializeJson(argsDoc, rawArgs);
+  DeserializationError err = deserializeJson(_functionArgs, rawArgs);
 
   if (err) {
       Serial.printf("❌ Failed to parse function arguments: %s\n", err.c_str());
   } else {
       String debug;
-      serializeJson(argsDoc, debug);
+      serializeJson(_functionArgs, debug);
       Serial.printf("🔍 Function arguments: %s\n", debug.c_str());
   }
 
 
-  return argsDoc.as<JsonObject>();
+  return _functionArgs.as<JsonObject>();
 }
 
 bool LLMDecisionEngine::executeFunction() {
   String name = getFunctionName();
-  if (_functionRegistry.count(name) == 0) return false;
+  FunctionSpec* spec = findFunction(name);
+  if (!spec) return false;
   JsonObject args = getFunctionArguments();
-  _functionRegistry[name].handler(args);
+  if (spec->handler) {
+    spec->handler(args);
+  } else {
+    spec->toolHandler(args);  // 型付きの登録はここで引数を検証する
+  }
   _functionCallPending = false;
   return true;
 }
 
-String LLMDecisionEngine::buildRequestJson() {
-  JsonDocument doc;
-  doc["model"] = "gpt-4o-mini";
-  doc["messages"] = _chatHistory["messages"];
-  doc["tool_choice"] = _toolDefinition["tool_choice"];
-  doc["tools"] = _toolDefinition["tools"];
+namespace {
+
+struct ToolCall {
+  String id;
+  String name;
+  JsonDocument args;
+  String result;
+};
+
+#ifdef ESP_PLATFORM
+struct ToolTask {
+  std::function<void()> run;
+  SemaphoreHandle_t done;
+};
+
+void toolTask(void* arg) {
+  ToolTask* task = static_cast<ToolTask*>(arg);
+  task->run();
+  xSemaphoreGive(task->done);
+  vTaskDelete(nullptr);
+}
+#endif
+
+// 最初の 1 つは呼び出し元で、残りは別タスクで同時に動かし、すべて終わるまで待つ
+void runConcurrently(const std::vector<std::function<void()>>& jobs) {
+  if (jobs.empty()) return;
+#ifdef ESP_PLATFORM
+  std::vector<std::unique_ptr<ToolTask>> started;
+  for (size_t i = 1; i < jobs.size(); ++i) {
+    std::unique_ptr<ToolTask> task(new ToolTask{jobs[i], xSemaphoreCreateBinary()});
+    if (task->done && xTaskCreate(toolTask, "tool", 6144, task.get(), 1, nullptr) == pdPASS) {
+      started.push_back(std::move(task));
+      continue;
+    }
+    if (task->done) vSemaphoreDelete(task->done);
+    jobs[i]();  // タスクを作れなければここで動かす
+  }
+  jobs[0]();
+  for (auto& task : started) {
+    xSemaphoreTake(task->done, portMAX_DELAY);
+    vSemaphoreDelete(task->done);
+  }
+#else
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < jobs.size(); ++i) {
+    threads.emplace_back(jobs[i]);
+  }
+  jobs[0]();
+  for (auto& t : threads) t.join();
+#endif
+}
 
-  String out;
-  serializeJson(doc, out);
-  Serial.printf("🛫 Sending request to LLM: %s\n", out.c_str());
-  return out;
+}  // namespace
+
+size_t LLMDecisionEngine::executeToolCalls() {
+  JsonArrayConst calls = _responseJson["choices"][0]["message"]["tool_calls"].as<JsonArrayConst>();
+  _functionCallPending = false;
+  if (calls.isNull() || calls.size() == 0) return 0;
+
+  // API は tool メッセージの前に、tool_calls を含む assistant メッセージを要求する
+  JsonArray messages = _chatHistory["messages"].as<JsonArray>();
+  JsonObject assistant = messages.add<JsonObject>();
+  assistant["role"] = "assistant";
+  assistant["content"] = nullptr;
+  assistant["tool_calls"] = calls;
+
+  std::vector<std::unique_ptr<ToolCall>> pending;
+  for (JsonObjectConst call : calls) {
+    std::unique_ptr<ToolCall> tc(new ToolCall());
+    tc->id = call["id"].as<String>();
+    tc->name = call["function"]["name"].as<String>();
+    const char* rawArgs = call["function"]["arguments"] | "{}";
+    DeserializationError err = deserializeJson(tc->args, rawArgs);
+    if (err) {
+      tc->result = String("error: invalid arguments (") + err.c_str() + ")";
+    } else if (!findFunction(tc->name)) {
+      tc->result = "error: unknown function " + tc->name;
+    }
+    pending.push_back(std::move(tc));
+  }
+
+  // モデルが並べた順に動かす。並列に動かしてよいものが続く間はまとめて同時に動かし、
+  // それ以外のツールに当たったら、先にそこまでのまとまりを終わらせる
+  std::vector<std::function<void()>> parallel;
+  for (auto& tc : pending) {
+    if (!tc->result.isEmpty()) continue;
+    FunctionSpec& spec = *findFunction(tc->name);
+    ToolCall* call = tc.get();
+    std::function<void()> run = [&spec, call]() {
+      JsonObject args = call->args.as<JsonObject>();
+      if (spec.toolHandler) {
+        call->result = spec.toolHandler(args);
+      } else {
+        spec.handler(args);
+        call->result = "ok";
+      }
+    };
+    if (spec.concurrent) {
+      parallel.push_back(run);
+    } else {
+      runConcurrently(parallel);
+      parallel.clear();
+      run();
+    }
+  }
+  runConcurrently(parallel);
+
+  for (auto& tc : pending) {
+    JsonObject msg = messages.add<JsonObject>();
+    msg["role"] = "tool";
+    msg["tool_call_id"] = tc->id;
+    msg["content"] = tc->result;
+    Serial.printf("🔧 Tool %s -> %s\n", tc->name.c_str(), tc->result.c_str());
+  }
+  _stats.toolCalls += pending.size();
+  return pending.size();
 }
 
-String LLMDecisionEngine::sendRequest(const String& jsonPayload) {
-  HTTPClient https;
-  WiFiClientSecure client;
-  client.setInsecure();
+bool LLMDecisionEngine::runToolLoop(String& rawContentOut, const CancelToken& cancel) {
+  unsigned long started = millis();
+  _stats.toolLoopSteps = 0;
+  for (int step = 0; step < _maxToolSteps; ++step) {
+    _functionCallPending = false;
+    ++_stats.toolLoopSteps;
+    if (!evaluate(rawContentOut, cancel)) return false;
+    if (!_functionCallPending) return true;
+
+    // 結果をモデルに返せないなら、ツールは動かさない（副作用だけが残る）。
+    // 動かした後は、予算を過ぎていても結果を送る
+    if (step + 1 >= _maxToolSteps) break;
+    if (millis() - started > _toolLoopBudgetMs) {
+      Serial.println("⏰ Tool loop time budget exhausted.");
+      return false;
+    }
+
+    executeToolCalls();
+    if (cancel.cancelled()) return false;
+  }
+  Serial.println("⏰ Tool loop step budget exhausted.");
+  return false;
+}
 
-  https.begin(client, "https://api.openai.com/v1/chat/completions");
-  https.addHeader("Content-Type", "application/json");
-  https.addHeader("Authorization", "Bearer " + _apiKey);
+String LLMDecisionEngine::buildRequestJson(const String& overlay) {
+  // 履歴は別のドキュメントに写さずにそのまま書き出し、tools は作り置きの断片をつなぐ。
+  // 動的な system メッセージ（overlay）は履歴の末尾に、このリクエストにだけ足す
+  JsonArrayConst messages = _chatHistory["messages"].as<JsonArrayConst>();
+  String messagesJson;
+  serializeJson(messages, messagesJson);
 
-  int httpCode = https.POST(jsonPayload);
-  String response = https.getString();
-  Serial.printf("🛬 Received response from LLM: %s\n", response.c_str());
+  String out;
+  out.reserve(messagesJson.length() + overlay.length() + _toolsJson.length() + 48);
+  out += "{\"model\":\"gpt-4o-mini\",\"messages\":";
+  if (overlay.isEmpty()) {
+    out += messagesJson;
+  } else {
+    out.concat(messagesJson.c_str(), messagesJson.length() - 1);  // 閉じ ] の手前に差し込む
+    if (messagesJson.length() > 2) out += ',';
+    out += overlay;
+    out += ']';
+  }
+  if (!_toolsJson.isEmpty()) {
+    out += ',';
+    out += _toolsJson;
+  }
+  out += '}';
+  THINK_LOG_DEBUG("🛫 Sending request to LLM: %s\n", out.c_str());
+  return out;
+}
 
-  https.end();
-  return response;
+bool LLMDecisionEngine::sendRequest(const String& jsonPayload, const CancelToken& cancel) {
+  bool parsed = false;
+  int httpCode = _transport->post(_apiKey, jsonPayload, [&](HttpBodyStream& body) {
+    parsed = parseResponse(body);
+    return parsed && body.discardRest(1000);
+  }, "application/json", cancel);
+  if (httpCode == OpenAITransport::kCancelled) {
+    Serial.println("🛑 LLM request cancelled.");
+    return false;
+  }
+  if (httpCode != 200) {
+    Serial.printf("❌ LLM request failed: HTTP %d\n", httpCode);
+    return false;
+  }
+  return parsed;
 }
 
-bool LLMDecisionEngine::parseResponse(const String& jsonResponse) {
-  DeserializationError err = deserializeJson(_responseJson, jsonResponse);
+bool LLMDecisionEngine::parseResponse(Stream& body) {
+  // 使うのは choices[0].message の content と tool_calls だけ
+  static const JsonDocument filter = [] {
+    JsonDocument doc;
+    doc["choices"][0]["message"]["content"] = true;
+    doc["choices"][0]["message"]["tool_calls"] = true;
+    return doc;
+  }();
+
+  DeserializationError err = deserializeJson(_responseJson, body, DeserializationOption::Filter(filter));
   if (err) {
       Serial.printf("❌ Failed to parse response: %s\n", err.c_str());
   } else {
       Serial.printf("✅ Response parsed successfully.\n");
-}
-  return !err;
-}
-
-void LLMDecisionEngine::injectDynamicSystemRoles() {
-  _temporarySystemMessages.clear();
-  for (auto& provider : _dynamicSystemRoles) {
-    String ctx = provider();
-    if (!ctx.isEmpty()) {
-      addMessage("system", "", ctx);
-      _temporarySystemMessages.push_back(ctx);
-    }
+#if STACKCHAN_THINK_LOG_LEVEL >= 3
+      String debug;
+      serializeJson(_responseJson, debug);
+      THINK_LOG_DEBUG("🛬 Received response from LLM: %s\n", debug.c_str());
+#endif
   }
+  return !err;
 }
 
-void LLMDecisionEngine::removeTemporarySystemRoles() {
-  if (_temporarySystemMessages.empty()) return;
-
-  JsonArray messages = _chatHistory["messages"].as<JsonArray>();
-  for (int i = messages.size() - 1; i >= 0; --i) {
-    JsonObject msg = messages[i];
-    if (msg["role"] == "system") {
-      String content = msg["content"].as<String>();
-      if (std::find(_temporarySystemMessages.begin(), _temporarySystemMessages.end(), content) != _temporarySystemMessages.end()) {
-        messages.remove(i);
+String LLMDecisionEngine::buildDynamicSystemRoles() {
+  unsigned long now = millis();
+  String overlay;
+  for (auto& role : _dynamicSystemRoles) {
+    if (!role.cached || role.ttlMs == 0 || now - role.cachedAt > role.ttlMs) {
+      String ctx = role.provider();
+      role.json = "";
+      if (!ctx.isEmpty()) {
+        role.json = "{\"role\":\"system\",\"content\":";
+        appendJsonString(role.json, ctx);
+        role.json += '}';
       }
+      role.cachedAt = now;
+      role.cached = true;
     }
+    if (role.json.isEmpty()) continue;
+    if (!overlay.isEmpty()) overlay += ',';
+    overlay += role.json;
   }
-  _temporarySystemMessages.clear();
+  return overlay;
 }
 
-void LLMDecisionEngine::addDynamicSystemRole(DynamicSystemRoleProvider provider) {
-  _dynamicSystemRoles.push_back(provider);
+void LLMDecisionEngine::addDynamicSystemRole(DynamicSystemRoleProvider provider, unsigned long ttlMs) {
+  _dynamicSystemRoles.push_back(DynamicSystemRole{provider, ttlMs, 0, false, ""});
 }
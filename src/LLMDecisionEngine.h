@@ -2,21 +2,27 @@
 #pragma once
 
 #include <ArduinoJson.h>
-#include <WiFiClientSecure.h>
-#include <HTTPClient.h>
+#include "OpenAITransport.h"
 #include <map>
 #include <functional>
 #include "IFunctionProvider.h"
+#include "ToolArgs.h"
+#include "MemoryAccounting.h"
 
 class LLMDecisionEngine {
 public:
   using FunctionHandler = std::function<void(JsonObject)>;
+  // Returns the content of the "tool" message sent back to the model
+  using ToolHandler = std::function<String(JsonObject)>;
   using DynamicSystemRoleProvider = std::function<String(void)>;
 
   struct FunctionSpec {
     String description;
     JsonDocument parameterSchema; // Store full document to retain scope
     FunctionHandler handler;
+    ToolHandler toolHandler;
+    std::function<void(JsonObject)> schemaWriter;  // 型付き登録ではスキーマを持たずに書き出す
+    bool concurrent = false;  // 他のツールと同時に別タスクで動かしてよい
 
     FunctionSpec() : handler(nullptr) {}
 
@@ -24,19 +30,27 @@ public:
       : description(desc), handler(h) {
       parameterSchema.set(schema);  // コピーする
     }
+
+    FunctionSpec(const String& desc, const JsonDocument& schema, ToolHandler h, bool parallel)
+      : description(desc), handler(nullptr), toolHandler(h), concurrent(parallel) {
+      parameterSchema.set(schema);
+    }
   };
 
   LLMDecisionEngine(const String& apiKey);
+  ~LLMDecisionEngine();
 
   void setSystemPrompt(const String& prompt);
   void addMessage(const String& role, const String& user, const String& content);
   void clearHistory(bool keepSystemPrompt = true);
 
-  // Automatically build tool schema from registered functions
+  // Automatically build tool schema from registered functions.
+  // Cached: only rebuilt after setActiveProviders() / registerFunction() / invalidateFunctionSchema()
   void buildFunctionSchema();
+  void invalidateFunctionSchema() { _schemaDirty = true; }
 
-  // Evaluate and extract structured response
-  bool evaluate(String& rawContentOut);
+  // Evaluate and extract structured response (returns false when cancelled)
+  bool evaluate(String& rawContentOut, const CancelToken& cancel = CancelToken::none());
 
   // For function_call-based flows
   bool isFunctionCall();
@@ -47,30 +61,101 @@ public:
   void registerFunction(const String& name, const String& description, const JsonDocument& parameterSchema, FunctionHandler handler);
   bool executeFunction();
 
+  // Tool whose result is returned to the model. concurrent = true lets it run on its own
+  // task alongside the other calls of the same response (must not touch shared state).
+  void registerTool(const String& name, const String& description, const JsonDocument& parameterSchema,
+                    ToolHandler handler, bool concurrent = false);
+
+  // Runs every tool_call of the last response and appends the assistant message plus one
+  // "tool" message per call (matched by tool_call_id). Returns the number of calls handled.
+  size_t executeToolCalls();
+
+  // evaluate → executeToolCalls → evaluate ... until the model answers without tool calls.
+  // Gives up (false) after maxSteps requests or maxMs, whichever comes first; tools are only
+  // run when their results can still be sent back within the budget.
+  bool runToolLoop(String& rawContentOut, const CancelToken& cancel = CancelToken::none());
+
+  // Typed registration: the schema and the argument decoder both come from Args::visit()
+  // (see ToolArgs.h). Arguments that don't match are reported to the model as an error
+  // and the handler is not called.
+  template <typename Args>
+  void registerTool(const String& name, const String& description,
+                    std::function<String(const Args&)> handler, bool concurrent = false) {
+    FunctionSpec spec;
+    spec.description = description;
+    spec.concurrent = concurrent;
+    spec.schemaWriter = &toolargs::writeSchema<Args>;
+    spec.toolHandler = [handler](JsonObject raw) -> String {
+      Args args = Args();
+      String error;
+      if (!toolargs::decode(JsonObjectConst(raw), args, error)) return "error: " + error;
+      return handler(args);
+    };
+    addFunctionSpec(name, spec);
+  }
+
+  void setToolLoopBudget(int maxSteps, unsigned long maxMs) {
+    _maxToolSteps = maxSteps;
+    _toolLoopBudgetMs = maxMs;
+  }
+
   void setActiveProviders(const std::vector<IFunctionProvider*>& providers);
 
   void addFunctionMessage(const String& name, const String& content);
 
-  void addDynamicSystemRole(DynamicSystemRoleProvider provider);
+  // 時刻やセンサー値などを、履歴には残さずリクエストごとに system メッセージとして付ける。
+  // ttlMs を指定すると、その間は provider を呼ばずに前回の内容を使う
+  void addDynamicSystemRole(DynamicSystemRoleProvider provider, unsigned long ttlMs = 0);
+
+  void setTransport(OpenAITransport* transport) { _transport = transport; }
+
+  struct Stats {
+    uint32_t evaluations;
+    uint32_t schemaBuilds;       // tools を作り直した回数
+    uint32_t lastPrepareMicros;  // 直近の evaluate でリクエストを組み立てるのにかかった時間
+    size_t toolsBytes;           // シリアライズ済み tools 断片の大きさ
+    uint32_t toolCalls;          // executeToolCalls で実行したツールの数
+    uint32_t toolLoopSteps;      // 直近の runToolLoop で送ったリクエスト数
+  };
+  const Stats& stats() const { return _stats; }
 
 private:
   String _apiKey;
-  JsonDocument _chatHistory;
-  JsonDocument _responseJson;
-  JsonDocument _toolDefinition;
+  OpenAITransport* _transport = &OpenAITransport::shared();
+  // 長く持つドキュメントは MemoryAccounting の DecisionEngine に計上する
+  JsonDocument _chatHistory{&TaggedAllocator::of(MemoryAccounting::DecisionEngine)};
+  JsonDocument _responseJson{&TaggedAllocator::of(MemoryAccounting::DecisionEngine)};
+  String _toolsJson;  // "tools":[...],"tool_choice":"auto"（関数がなければ空）
+  bool _schemaDirty = true;
+  bool _buildingSchema = false;
+  Stats _stats = {};
+  int _maxToolSteps = 4;
+  unsigned long _toolLoopBudgetMs = 20000;
   bool _functionCallPending;
-  std::vector<DynamicSystemRoleProvider> _dynamicSystemRoles;
-  std::vector<String> _temporarySystemMessages;
+  struct DynamicSystemRole {
+    DynamicSystemRoleProvider provider;
+    unsigned long ttlMs;
+    unsigned long cachedAt;
+    bool cached;
+    String json;  // シリアライズ済みの {"role":"system","content":...}（空なら送らない）
+  };
+  std::vector<DynamicSystemRole> _dynamicSystemRoles;
   
-  std::map<String, FunctionSpec> _functionRegistry;
+  // registerFunction() / registerTool() で直接登録したものと、provider が登録したもの。
+  // buildFunctionSchema() で作り直すのは provider の分だけ
+  std::map<String, FunctionSpec> _directFunctions;
+  std::map<String, FunctionSpec> _providerFunctions;
   String _systemPrompt;
   std::vector<IFunctionProvider*> _activeProviders;
 
-  String buildRequestJson();
-  String sendRequest(const String& jsonPayload);
-  bool parseResponse(const String& jsonResponse);
+  JsonDocument _functionArgs{&TaggedAllocator::of(MemoryAccounting::DecisionEngine)};  // getFunctionArguments() が返すオブジェクトの持ち主
+
+  void addFunctionSpec(const String& name, const FunctionSpec& spec);
+  FunctionSpec* findFunction(const String& name);  // 直接登録したものを優先する
+  String buildRequestJson(const String& overlay);
+  bool sendRequest(const String& jsonPayload, const CancelToken& cancel);
+  bool parseResponse(Stream& body);
 
   void rebuildChatHistory();
-  void injectDynamicSystemRoles();
-  void removeTemporarySystemRoles();
+  String buildDynamicSystemRoles();
 };
@@ -1,9 +1,12 @@
 #include "LLMEngine.h"
-#include <HTTPClient.h>
-#include <WiFiClientSecure.h>
 #include "SDUtils.h"
-
-const size_t maxMessages = 10;
+#include "StreamingReply.h"
+#include "LogConfig.h"
+#include "JsonArena.h"
+#include "LLMWorker.h"
+#include "TextUtils.h"
+#include "StringBuilder.h"
+#include "Trace.h"
 
 static EmotionType labelToEnum(const String& lbl) {
   if      (lbl == "happy")   return EmotionType::Happy;
@@ -15,106 +18,344 @@ static EmotionType labelToEnum(const String& lbl) {
   return EmotionType::Undefined;
 }
 
+// レスポンスのうち、使うのは choices[0].message.content だけ。
+// 複数のタスクから同時に呼ばれるので、関数内 static の初期化（1 回だけ・排他される）で作る
+static const JsonDocument& replyFilter() {
+  static const JsonDocument filter = [] {
+    JsonDocument doc;
+    doc["choices"][0]["message"]["content"] = true;
+    return doc;
+  }();
+  return filter;
+}
+
+// ストリーミング時は choices[0].delta.content だけ
+static const JsonDocument& deltaFilter() {
+  static const JsonDocument filter = [] {
+    JsonDocument doc;
+    doc["choices"][0]["delta"]["content"] = true;
+    return doc;
+  }();
+  return filter;
+}
+
+// モデルの返答本文（JSON 形式を期待）を message / emotion に分解する
+static void parseReplyContent(String content, LLMResponse& response) {
+  // JSON コードブロックを除去
+  if (content.startsWith("```json") || content.startsWith("```")) {
+    int start = content.indexOf('\n');
+    int end   = content.lastIndexOf("```");
+    if (start != -1 && end != -1 && end > start) {
+      content = content.substring(start + 1, end);
+      content.trim();  // 念のため空白削除
+    }
+  }
+  JsonDocument inner(&JsonArena::instance());
+  if (deserializeJson(inner, content)) {
+    response.message = content;
+    response.emotion = EmotionType::Neutral;
+  } else {
+    response.message = inner["message"].as<String>();
+    response.emotion = labelToEnum(inner["emotion"].as<String>());
+  }
+}
+
 LLMEngine::LLMEngine(const String& apiKey, const String& systemPrompt)
   : _apiKey(apiKey) {
   // 改行ルールを無条件で追加
   _systemPrompt = systemPrompt;
-
-  if (!_systemPrompt.isEmpty()) {
-    _history.emplace_back("system", _systemPrompt);
-  }
+  _history.setSystemPrompt(_systemPrompt);
 }
 
 void LLMEngine::addUserMessage(const String& content) {
-  _history.emplace_back("user", content);
-  trimHistory();
+  appendMessage("user", content);
 }
 
 void LLMEngine::addAssistantMessage(const String& content) {
-  _history.emplace_back("assistant", content);
+  appendMessage("assistant", content);
+}
+
+void LLMEngine::appendMessage(const char* role, const String& content) {
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  if (_history.full()) evictOldest();
+  _history.push(role, content);
+  trimHistory();  // 押し出しは記録しない。再生時も同じ予算で押し出される
+  journal(HistoryJournal::appendRecord(role, content));
+  if (_inTurn && _journal) ++_turnJournaled;
+}
+
+void LLMEngine::journal(const HistoryJournal::Record& record) {
+  if (!_journal) return;
+  _journalPending.push_back(record);
+}
+
+void LLMEngine::evictOldest() {
+  Message evicted = _history.popFront();
+  ++_historyEpoch;
+  // ターン開始前からの発話だけを取っておく。このターンで足した発話が押し出されたなら、
+  // 取り消しで外すものが 1 つ減るだけ
+  if (_inTurn && _turnKept > 0) {
+    _turnEvicted.push_back(evicted);
+    --_turnKept;
+  }
+}
+
+void LLMEngine::setHistoryBudget(size_t bytes) {
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  _history.setByteBudget(bytes);
   trimHistory();
 }
 
+void LLMEngine::beginTurn() {
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  _inTurn = true;
+  _turnKept = _history.size();
+  _turnJournaled = 0;
+  _turnEvicted.clear();
+}
+
+void LLMEngine::commitTurn() {
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  _inTurn = false;
+  _turnKept = 0;
+  _turnJournaled = 0;
+  _turnEvicted.clear();
+}
+
+void LLMEngine::rollbackTurn() {
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  if (!_inTurn) return;
+
+  // このターンで追加したもの（残っている分）を外し、押し出された古い履歴を元の位置に戻す。
+  // 戻した後の件数はターン開始時と同じなので、pushFront で一杯になることはない
+  while (_history.size() > _turnKept) {
+    _history.popBack();
+  }
+  for (auto it = _turnEvicted.rbegin(); it != _turnEvicted.rend(); ++it) {
+    _history.pushFront(*it);
+  }
+
+  // まだ書いていない追記なら取り消すだけでよい。書いた後ならスナップショットを作り直す
+  while (_turnJournaled > 0 && !_journalPending.empty() &&
+         _journalPending.back().op == HistoryJournal::Op::Append) {
+    _journalPending.pop_back();
+    --_turnJournaled;
+  }
+  if (_turnJournaled > 0) _journalStale = true;
+  ++_historyEpoch;
+  commitTurn();
+}
+
 void LLMEngine::resetConversation() {
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  ++_historyEpoch;
   _history.clear();
-  if (!_systemPrompt.isEmpty()) {
-    _history.emplace_back("system", _systemPrompt);
-  }
+  _history.setSystemPrompt(_systemPrompt);
+  _journalPending.clear();  // 消す前の追記は書く必要がない
+  journal(HistoryJournal::clearRecord(_systemPrompt));
 }
 
 void LLMEngine::trimHistory() {
-  while (_history.size() > maxMessages) {
-    _history.erase(_history.begin() + 1); // systemを除いて削除
+  // 直近の 1 件は予算を超えていても残す
+  while (_history.size() > 1 && _history.overBudget()) {
+    evictOldest();
   }
 }
 
-String LLMEngine::buildPayload() const {
-  JsonDocument doc;
-  doc["model"] = "gpt-4o-mini";
-  JsonArray messages = doc["messages"].to<JsonArray>();
+String LLMEngine::buildPayload(bool stream) const {
+  TRACE_SPAN("LLMEngine::buildPayload");
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  // 各発話は履歴に積んだ時点で JSON 断片になっているので、つなぐだけでよい
+  static const char kPrefix[] = "{\"model\":\"gpt-4o-mini\",";
+  static const char kStream[] = "\"stream\":true,";
+  static const char kMessages[] = "\"messages\":[";
+  static const char kSuffix[] = "]}";
 
-  for (const auto& entry : _history) {
-    JsonObject msg = messages.add<JsonObject>();
-    msg["role"] = entry.first;
-    msg["content"] = entry.second;
+  String payload;
+  payload.reserve(sizeof(kPrefix) + sizeof(kStream) + sizeof(kMessages) + sizeof(kSuffix)
+                  + _history.serializedBytes());
+  payload += kPrefix;
+  if (stream) {
+    payload += kStream;
   }
+  payload += kMessages;
+  _history.appendMessagesJson(payload);
+  payload += kSuffix;
 
-  String payload;
-  serializeJson(doc, payload);
-  Serial.println("Payload: " + payload); // デバッグ用
+  _lastPayloadBytes = payload.length();
+  THINK_LOG_DEBUG("Payload: %s\n", payload.c_str());
   return payload;
 }
 
 bool LLMEngine::saveHistoryToFile(const String& filename) {
-  JsonDocument doc;
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
   JsonArray messages = doc.to<JsonArray>();
+  if (!_history.systemPrompt().isEmpty()) {
+    JsonObject sys = messages.add<JsonObject>();
+    sys["role"] = "system";
+    sys["content"] = _history.systemPrompt();
+  }
+  if (!_history.summary().isEmpty()) {
+    JsonObject sum = messages.add<JsonObject>();
+    sum["role"] = "summary";
+    sum["content"] = _history.summary();
+  }
   for (const auto& entry : _history) {
     JsonObject obj = messages.add<JsonObject>();
-    obj["role"] = entry.first;
-    obj["content"] = entry.second;
+    obj["role"] = entry.role.c_str();
+    obj["content"] = entry.content;
   }
 
   return writeJsonToSD(filename.c_str(), doc);
 }
 
 bool LLMEngine::loadHistoryFromFile(const String& filename) {
-  JsonDocument doc;
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
   if (!readJsonFromSD(filename.c_str(), doc)) {
     return false;
   }
 
+  // 先頭の system はファイルに保存されていたものを使う
+  ++_historyEpoch;
   _history.clear();
+  _history.setSystemPrompt("");
   for (JsonObject obj : doc.as<JsonArray>()) {
-    _history.emplace_back(obj["role"].as<String>(), obj["content"].as<String>());
+    String role = obj["role"].as<String>();
+    if (role == "system") {
+      _history.setSystemPrompt(obj["content"].as<String>());
+      continue;
+    }
+    if (role == "summary") {
+      _history.setSummary(obj["content"].as<String>());
+      continue;
+    }
+    if (_history.full()) _history.popFront();
+    _history.push(role.c_str(), obj["content"].as<String>());
   }
+  trimHistory();
 
   return true;
 }
 
-std::vector<std::pair<String, String>> LLMEngine::getHistory() const {
-  return _history;
-}
-
 static String makeTopicFilename(const String& topic) {
   return "/spiffs/history_" + topic + ".json";
 }
 
 bool LLMEngine::switchTopic(const String& newTopic) {
-  // 現在のトピックを保存
+  // 現在のトピックを保存。保存できた状態は戻ってきたときのためにメモリに残す
   if (!_currentTopic.isEmpty()) {
-    saveHistoryToFile(makeTopicFilename(_currentTopic));
+    std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+    if (persistHistory() && _journal && newTopic != _currentTopic) {
+      _journal->park(snapshotRecords());
+    }
   }
 
   // 新しいトピックに切り替え
   _currentTopic = newTopic;
+  loadTopic();
+  return true;
+}
+
+void LLMEngine::setJournal(HistoryJournal* journal) {
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  _journal = journal;
+  _journalPending.clear();
+  _journalStale = false;
+  if (!_currentTopic.isEmpty()) loadTopic();
+}
 
-  // 読み込み。ファイルがなければ初期化
-  if (!loadHistoryFromFile(makeTopicFilename(_currentTopic))) {
-    Serial.println("New topic started: " + _currentTopic);
+void LLMEngine::loadTopic() {
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  if (!_journal) {
+    // 読み込み。ファイルがなければ初期化
+    if (!loadHistoryFromFile(makeTopicFilename(_currentTopic))) {
+      Serial.println("New topic started: " + _currentTopic);
+      resetConversation();
+    }
+    return;
+  }
+
+  ++_historyEpoch;
+  _history.clear();
+  _history.setSystemPrompt(_systemPrompt);
+  bool found = _journal->open(_currentTopic, [this](const HistoryJournal::Record& record) {
+    applyRecord(record);
+  });
+  _journalPending.clear();
+  _journalStale = false;
+  if (found) return;
+  if (_journal->readOnly()) {
+    // 新しい形式で書かれた履歴は読めないが、上書きもしない。この起動中は空の履歴で話す
     resetConversation();
+    return;
   }
 
-  return true;
+  // 以前の JSON 形式で保存されていれば、スナップショットに移す
+  if (loadHistoryFromFile(makeTopicFilename(_currentTopic))) {
+    _journalPending.clear();
+    _journalStale = true;
+    persistHistory();
+    return;
+  }
+  Serial.println("New topic started: " + _currentTopic);
+  resetConversation();
+}
+
+void LLMEngine::applyRecord(const HistoryJournal::Record& record) {
+  switch (record.op) {
+    case HistoryJournal::Op::Clear:
+      _history.clear();
+      _history.setSystemPrompt(record.content);
+      break;
+    case HistoryJournal::Op::Append:
+      if (_history.full()) _history.popFront();
+      _history.push(record.role.c_str(), record.content);
+      trimHistory();
+      break;
+    case HistoryJournal::Op::Summary:
+      while (_history.size() > record.count) _history.popFront();
+      _history.setSummary(record.content);
+      break;
+    default:
+      break;
+  }
+}
+
+std::vector<HistoryJournal::Record> LLMEngine::snapshotRecords() const {
+  std::vector<HistoryJournal::Record> records;
+  records.push_back(HistoryJournal::clearRecord(_history.systemPrompt()));
+  for (const auto& entry : _history) {
+    records.push_back(HistoryJournal::appendRecord(entry.role.c_str(), entry.content));
+  }
+  if (!_history.summary().isEmpty()) {
+    records.push_back(HistoryJournal::summaryRecord(_history.summary(), _history.size()));
+  }
+  return records;
+}
+
+bool LLMEngine::persistHistory() {
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  if (_currentTopic.isEmpty()) return false;
+  if (!_journal) {
+    return saveHistoryToFile(makeTopicFilename(_currentTopic));
+  }
+
+  bool ok = true;
+  if (!_journalStale && !_journalPending.empty()) {
+    ok = _journal->append(_journalPending);
+  }
+  if (_journalStale || !ok || _journal->needsCompaction()) {
+    ok = _journal->compact(snapshotRecords());
+  }
+  if (ok) {
+    _journalPending.clear();
+    _journalStale = false;
+  }
+  return ok;
 }
 
 String LLMEngine::currentTopic() const {
@@ -127,66 +368,273 @@ void LLMEngine::setSystemPrompt(const String& prompt) {
 }
 
 
-bool LLMEngine::sendAndReceive(LLMResponse& response) {
-  HTTPClient https;
-  WiFiClientSecure client;
-  client.setInsecure(); // または適切なルート証明書を使う
-
-  https.begin(client, "https://api.openai.com/v1/chat/completions");
-  https.addHeader("Content-Type", "application/json");
-  https.addHeader("Authorization", "Bearer " + _apiKey);
-
-  int httpCode = https.POST(buildPayload());
+bool LLMEngine::sendAndReceive(LLMResponse& response, const CancelToken& cancel) {
+  TRACE_SPAN("LLMEngine::sendAndReceive");
+  // 本文を String に溜めず、ソケットから直接フィルタ付きでパースする
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
+  DeserializationError error = DeserializationError::EmptyInput;
+  int httpCode = _transport->post(_apiKey, buildPayload(), [&](HttpBodyStream& body) {
+    error = deserializeJson(doc, body, DeserializationOption::Filter(replyFilter()));
+    return !error && body.discardRest(1000);
+  }, "application/json", cancel);
+  if (httpCode == OpenAITransport::kCancelled) {
+    response.message = "";
+    response.emotion = EmotionType::Neutral;
+    return false;
+  }
   if (httpCode != 200) {
     response.message = "Error: HTTP " + String(httpCode);
     response.emotion = EmotionType::Sad;
-    https.end();
     return false;
   }
 
-  String responseBody = https.getString();
-  Serial.println("Response: " + responseBody); // デバッグ用
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, responseBody);
   if (error) {
+    Serial.printf("[LLMEngine] Failed to parse response: %s\n", error.c_str());
     response.message = "考えてたけどよくわかんなくなっちゃった。";
     response.emotion = EmotionType::Sad;
-    https.end();
     return false;
   }
 
   String content = doc["choices"][0]["message"]["content"].as<String>();
-  Serial.println("Content: " + content); // デバッグ用
+  THINK_LOG_DEBUG("Content: %s\n", content.c_str());
+  parseReplyContent(content, response);
 
-  // JSON コードブロックを除去
-  if (content.startsWith("```json") || content.startsWith("```")) {
-    int start = content.indexOf('\n');
-    int end   = content.lastIndexOf("```");
-    if (start != -1 && end != -1 && end > start) {
-      content = content.substring(start + 1, end);
-      content.trim();  // 念のため空白削除
-    }
-  }
-  JsonDocument inner;
-  if (deserializeJson(inner, content)) {
-    response.message = content;
+  addAssistantMessage(response.message);
+  return true;
+}
+
+bool LLMEngine::sendAndReceiveStreaming(LLMResponse& response, SentenceCallback onSentence,
+                                        const CancelToken& cancel) {
+  TRACE_SPAN("LLMEngine::sendAndReceiveStreaming");
+  JsonArena::Turn turn;
+  StreamingReplyParser parser(onSentence);
+  bool completed = false;
+
+  int httpCode = _transport->post(_apiKey, buildPayload(true), [&](HttpBodyStream& body) {
+    completed = readSseEvents(body,
+      [&body]() { return body.isOpen(); },
+      [&parser, &cancel](const String& data) {
+        if (cancel.cancelled()) return false;  // 取り消し後の文は読み上げに回さない
+        JsonDocument chunk(&JsonArena::instance());
+        if (deserializeJson(chunk, data, DeserializationOption::Filter(deltaFilter()))) {
+          return true;  // 壊れたイベントは読み飛ばす
+        }
+        const char* delta = chunk["choices"][0]["delta"]["content"];
+        parser.feed(delta);
+        return true;
+      });
+    // [DONE] の後ろに残っている終端を読み切り、接続を再利用できるようにする
+    String rest;
+    return completed && body.readAll(rest, 1000);
+  }, "text/event-stream", cancel);
+  if (httpCode == OpenAITransport::kCancelled) {
+    response.message = "";
     response.emotion = EmotionType::Neutral;
-  } else {
-    response.message = inner["message"].as<String>();
-    response.emotion = labelToEnum(inner["emotion"].as<String>());
+    return false;
   }
+  parser.finish();
 
+  if (httpCode != 200) {
+    response.message = "Error: HTTP " + String(httpCode);
+    response.emotion = EmotionType::Sad;
+    return false;
+  }
+
+  String content = parser.content();
+  THINK_LOG_DEBUG("Content: %s\n", content.c_str());
+  if (content.isEmpty()) {
+    response.message = "考えてたけどよくわかんなくなっちゃった。";
+    response.emotion = EmotionType::Sad;
+    return false;
+  }
+  if (!completed) {
+    Serial.println("[LLMEngine] Stream ended without [DONE].");
+  }
+
+  parseReplyContent(content, response);
   addAssistantMessage(response.message);
-  https.end();
   return true;
 }
 
-void LLMEngine::generate(const String& prompt, Callback callback) {
-  // ユーザーの発話として追加
-  addUserMessage(prompt);
+// 要約しても直近の発話はそのまま残す
+static const size_t kKeepRecentMessages = 4;
+
+bool LLMEngine::needsSummary() const {
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  return _summaryThreshold > 0 && !_inTurn &&
+         _history.bytes() > _summaryThreshold &&
+         _history.size() > kKeepRecentMessages;
+}
+
+bool LLMEngine::summarizeIfNeeded() {
+  // 対象の発話を写し取る。通信中はロックを持たない
+  std::vector<Message> oldest;
+  String previous;
+  uint32_t epoch;
+  {
+    std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+    if (!needsSummary()) return false;
+    size_t count = _history.size() - kKeepRecentMessages;
+    for (size_t i = 0; i < count; ++i) {
+      oldest.push_back(_history.at(i));
+    }
+    previous = _history.summary();
+    epoch = _historyEpoch;
+  }
+
+  CancelToken cancel;
+  {
+    std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+    _summaryCancel = cancel;
+  }
+  String summary;
+  if (!requestSummary(previous, oldest, summary, cancel)) return false;
+
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  // 要約している間に先頭が押し出された・リセットされた場合は使えない
+  if (epoch != _historyEpoch) {
+    ++_summaryStats.discarded;
+    Serial.println("[LLMEngine] History changed during summarization, discarded.");
+    return false;
+  }
+
+  size_t folded = 0;
+  for (size_t i = 0; i < oldest.size(); ++i) {
+    folded += _history.entryBytes(0);
+    _history.popFront();
+  }
+  _history.setSummary(summary);
+  ++_historyEpoch;
+  journal(HistoryJournal::summaryRecord(summary, _history.size()));
+
+  ++_summaryStats.runs;
+  _summaryStats.foldedMessages += oldest.size();
+  _summaryStats.bytesFolded += folded;
+  _summaryStats.summaryBytes = summary.length();
+  Serial.printf("[LLMEngine] Folded %u messages (%u bytes) into a %u-byte summary.\n",
+                (unsigned)oldest.size(), (unsigned)folded, (unsigned)summary.length());
+  return true;
+}
+
+void LLMEngine::cancelSummary() {
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  _summaryCancel.cancel();
+}
+
+bool LLMEngine::requestSummary(const String& previous, const std::vector<Message>& messages, String& summary,
+                               const CancelToken& cancel) {
+  JsonArena::Turn turn;
+
+  StringBuilder transcript(1024);
+  if (!previous.isEmpty()) {
+    transcript << "これまでの要約: " << previous << '\n';
+  }
+  for (const auto& m : messages) {
+    transcript << (m.role == "user" ? "ユーザー: " : "スタックチャン: ") << m.content << '\n';
+  }
+
+  JsonDocument doc(&JsonArena::instance());
+  doc["model"] = "gpt-4o-mini";
+  JsonArray msgs = doc["messages"].to<JsonArray>();
+  JsonObject sys = msgs.add<JsonObject>();
+  sys["role"] = "system";
+  sys["content"] = "次の会話を、後で話の続きができるように日本語で200文字以内に要約してください。"
+                   "ユーザーの名前・好み・約束などの事実を優先し、要約文だけを返してください。";
+  JsonObject usr = msgs.add<JsonObject>();
+  usr["role"] = "user";
+  usr["content"] = transcript.c_str();
+
+  String payload;
+  serializeJson(doc, payload);
+
+  JsonDocument resp(&JsonArena::instance());
+  DeserializationError error = DeserializationError::EmptyInput;
+  int httpCode = _transport->post(_apiKey, payload, [&](HttpBodyStream& body) {
+    error = deserializeJson(resp, body, DeserializationOption::Filter(replyFilter()));
+    return !error && body.discardRest(1000);
+  }, "application/json", cancel);
+  if (httpCode == OpenAITransport::kCancelled) {
+    Serial.println("[LLMEngine] Summarization cancelled.");
+    return false;
+  }
+  if (httpCode != 200 || error) {
+    Serial.printf("[LLMEngine] Summarization failed: HTTP %d\n", httpCode);
+    return false;
+  }
+
+  summary = resp["choices"][0]["message"]["content"].as<String>();
+  summary.trim();
+  return !summary.isEmpty();
+}
+
+LLMHandle LLMEngine::generate(const String& prompt, Callback callback, CancelToken cancel) {
+  LLMWorker& worker = _worker ? *_worker : LLMWorker::shared();
+  return worker.submit([this, prompt, cancel](LLMResponse& response) {
+    if (cancel.cancelled()) return false;  // キューで待っている間に取り消された
 
-  // 非同期風にするが、現状は同期的に送受信して即 callback を呼ぶ
-  LLMResponse response;
-  bool success = sendAndReceive(response);
-  callback(response);
+    // ユーザーの発話として追加（順番を保つため、積むのもワーカー側で行う）
+    addUserMessage(prompt);
+    if (sendAndReceive(response, cancel)) return true;
+    if (cancel.cancelled()) discardLastMessage("user", prompt);
+    return false;
+  }, callback);
+}
+
+LLMResponse LLMEngine::generate(const std::vector<Message>& messages, bool withEmotion,
+                                const CancelToken& cancel) {
+  size_t estimate = 48;
+  for (const auto& m : messages) estimate += m.role.length() + m.content.length() + 32;
+  String payload;
+  payload.reserve(estimate);
+  payload += "{\"model\":\"gpt-4o-mini\",\"messages\":[";
+  for (size_t i = 0; i < messages.size(); ++i) {
+    if (i > 0) payload += ',';
+    payload += "{\"role\":";
+    appendJsonString(payload, messages[i].role.c_str(), messages[i].role.length());
+    payload += ",\"content\":";
+    appendJsonString(payload, messages[i].content);
+    payload += '}';
+  }
+  payload += "]}";
+
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
+  DeserializationError error = DeserializationError::EmptyInput;
+  int httpCode = _transport->post(_apiKey, payload, [&](HttpBodyStream& body) {
+    error = deserializeJson(doc, body, DeserializationOption::Filter(replyFilter()));
+    return !error && body.discardRest(1000);
+  }, "application/json", cancel);
+
+  LLMResponse response = {"", EmotionType::Undefined};
+  if (httpCode != 200 || error) {
+    if (httpCode != OpenAITransport::kCancelled) {
+      Serial.printf("[LLMEngine] One-shot request failed: HTTP %d\n", httpCode);
+    }
+    return response;
+  }
+
+  String content = doc["choices"][0]["message"]["content"].as<String>();
+  if (withEmotion) {
+    parseReplyContent(content, response);
+  } else {
+    response.message = content;
+    response.emotion = EmotionType::Neutral;
+  }
+  return response;
+}
+
+void LLMEngine::discardLastMessage(const char* role, const String& content) {
+  std::lock_guard<std::recursive_mutex> lock(_historyMutex);
+  if (_history.empty() || _history.back().role != role || _history.back().content != content) return;
+  _history.popBack();
+  ++_historyEpoch;
+
+  // まだ書いていない追記なら取り消す。書いた後ならスナップショットを作り直す
+  if (!_journalPending.empty() && _journalPending.back().op == HistoryJournal::Op::Append &&
+      _journalPending.back().content == content) {
+    _journalPending.pop_back();
+  } else if (_journal) {
+    _journalStale = true;
+  }
 }
\ No newline at end of file
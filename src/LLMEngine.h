@@ -1,9 +1,18 @@
 #pragma once
-#include <vector>
 #include <ArduinoJson.h>
 #include <Arduino.h>
 #include <vector>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include "Message.h"
+#include "ConversationHistory.h"
+#include "OpenAITransport.h"
+#include "HistoryJournal.h"
+
+class LLMWorker;
+class LLMRequest;
+using LLMHandle = std::shared_ptr<LLMRequest>;
 
 // ① New enum
 enum class EmotionType { Happy, Neutral, Sad, Angry, Sleepy, Doubt, Undefined };
@@ -12,6 +21,10 @@ enum class EmotionType { Happy, Neutral, Sad, Angry, Sleepy, Doubt, Undefined };
 struct LLMResponse {
     String message;    // reply for TTS
     EmotionType         emotion;     // casual engines use it; others can ignore
+    bool alreadySpoken; // 文ごとのコールバックで発話済み。呼び出し側は message を読み上げない
+
+    LLMResponse(const String& m = "", EmotionType e = EmotionType::Undefined)
+      : message(m), emotion(e), alreadySpoken(false) {}
 };
 
 class LLMEngine {
@@ -19,30 +32,112 @@ public:
   LLMEngine(const String& apiKey, const String& systemPrompt = "あなたはスーパーかわいいAIアシスタントロボット、スタックチャンです。かわいいく話、元気づけてください。返信はPlanなJSON形式で、messageと emotion で返却してください。emotionは happy, sad, angry, sleepy, doubt, neutral のいずれかを返してください。");
   void addUserMessage(const String& content);
   void addAssistantMessage(const String& content);
-  String buildPayload() const;
-  bool sendAndReceive(LLMResponse& response);
+  String buildPayload(bool stream = false) const;
+  // cancel されると途中で接続を閉じて false を返す（履歴には何も足さない）
+  bool sendAndReceive(LLMResponse& response, const CancelToken& cancel = CancelToken::none());
+
+  // SSE で返答を受け取りながら、文ができるたびに onSentence を呼ぶ。
+  // 戻り値・response は sendAndReceive と同じ（message は全文）。
+  using SentenceCallback = std::function<void(const String&)>;
+  bool sendAndReceiveStreaming(LLMResponse& response, SentenceCallback onSentence,
+                               const CancelToken& cancel = CancelToken::none());
+  void setTransport(OpenAITransport* transport) { _transport = transport; }
   void resetConversation();
+
+  // beginTurn() 以降に追加・削除された履歴を rollbackTurn() で元に戻せるようにする
+  void beginTurn();
+  void commitTurn();
+  void rollbackTurn();
   bool saveHistoryToFile(const String& filename);
   bool loadHistoryFromFile(const String& filename);
   bool switchTopic(const String& newTopic);
+
+  // 設定するとトピックの履歴をジャーナルに追記で保存する（nullptr なら JSON を丸ごと書き直す）。
+  // 設定時に現在のトピックを読み直す
+  void setJournal(HistoryJournal* journal);
+  bool persistHistory();  // 前回から増えた分だけを保存する
   String currentTopic() const;
   void setSystemPrompt(const String& prompt);
   using Callback = std::function<void(LLMResponse)>;
-  void generate(const String& prompt, Callback callback);
-  std::vector<std::pair<String, String>> getHistory() const;
+  // prompt をユーザー発話として積み、ワーカーで問い合わせる。すぐに戻り、
+  // 完了時に callback（ワーカーのタスクから）を呼ぶ。キューが一杯なら nullptr。
+  // cancel されたら prompt は履歴から取り除き、callback は失敗として呼ぶ
+  LLMHandle generate(const String& prompt, Callback callback, CancelToken cancel = CancelToken());
+  void setWorker(LLMWorker* worker) { _worker = worker; }  // nullptr で共有ワーカー
+  // 履歴を読むためのビュー。生きている間は履歴のロックを持つので、他のタスクからの
+  // 追加・要約と重ならない（コピーはしない）。ビューは読み終えたらすぐ手放すこと
+  class HistoryView {
+  public:
+    HistoryView(const ConversationHistory& history, std::recursive_mutex& mutex)
+      : _lock(mutex), _history(history) {}
+    const ConversationHistory& operator*() const { return _history; }
+    const ConversationHistory* operator->() const { return &_history; }
+
+  private:
+    std::unique_lock<std::recursive_mutex> _lock;
+    const ConversationHistory& _history;
+  };
+  HistoryView getHistory() const { return HistoryView(_history, _historyMutex); }
+
+  // 履歴の予算（system プロンプトを除くバイト数）。超えた分は古い発話から捨てる
+  void setHistoryBudget(size_t bytes);
+
+  // 履歴がこのバイト数を超えたら、古い発話を要約にまとめる（0 で無効）。
+  // 要約はアイドル時に summarizeIfNeeded() を呼んだときだけ行う
+  void setSummaryThreshold(size_t bytes) { _summaryThreshold = bytes; }
+  bool needsSummary() const;
+  bool summarizeIfNeeded();
+  void cancelSummary();  // 要約の問い合わせ中なら打ち切る（ユーザーの割り込み用）
+
+  struct SummaryStats {
+    uint32_t runs;
+    uint32_t discarded;     // 要約中に履歴が変わって捨てた回数
+    uint32_t foldedMessages;
+    uint32_t bytesFolded;   // 要約で置き換えた発話のバイト数
+    uint32_t summaryBytes;  // 現在の要約のバイト数
+  };
+  const SummaryStats& summaryStats() const { return _summaryStats; }
+  size_t lastPayloadBytes() const { return _lastPayloadBytes; }
   /**
+   * Stateless one-shot request: the history is neither read nor modified.
    * @param withEmotion  true  – ask the model to return emotion label
    *                     false – legacy, just reply text
+   * @return message is empty on failure or cancellation
    */
   LLMResponse generate(const std::vector<Message>& messages,
-                        bool withEmotion = false);
+                        bool withEmotion = false,
+                        const CancelToken& cancel = CancelToken::none());
 
   private:
   String _apiKey;
+  OpenAITransport* _transport = &OpenAITransport::shared();
+  LLMWorker* _worker = nullptr;
   String _systemPrompt;
-  std::vector<std::pair<String, String>> _history; // role, content
+  ConversationHistory _history;
   String _currentTopic;
+  bool _inTurn = false;
+  size_t _turnKept = 0;                // ターン開始前からの発話のうち、まだリングに残っている数
+  std::vector<Message> _turnEvicted;  // ターン中に押し出された、ターン開始前からの発話（古い順）
+  uint32_t _historyEpoch = 0;  // 履歴の先頭が変わるたびに増える
+  size_t _summaryThreshold = 2048;
+  SummaryStats _summaryStats = {};
+  CancelToken _summaryCancel;
+  mutable size_t _lastPayloadBytes = 0;
+  mutable std::recursive_mutex _historyMutex;  // 要約ジョブは別タスクから動く
+  HistoryJournal* _journal = nullptr;
+  std::vector<HistoryJournal::Record> _journalPending;  // 次の persistHistory() で追記する分
+  size_t _turnJournaled = 0;
+  bool _journalStale = false;  // 追記では表せない変更があった。次はスナップショットを書き直す
   std::vector<String> splitByNewline(const String& text);
 
+  void appendMessage(const char* role, const String& content);
+  void journal(const HistoryJournal::Record& record);
+  void loadTopic();
+  void applyRecord(const HistoryJournal::Record& record);
+  std::vector<HistoryJournal::Record> snapshotRecords() const;
+  void evictOldest();
   void trimHistory(); // 履歴が長くなりすぎないように調整
+  bool requestSummary(const String& previous, const std::vector<Message>& messages, String& summary,
+                      const CancelToken& cancel);
+  void discardLastMessage(const char* role, const String& content);
 };
@@ -0,0 +1,133 @@
+#include "LLMWorker.h"
+
+// ---- LLMRequest ----
+
+bool LLMRequest::done() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _done;
+}
+
+bool LLMRequest::succeeded() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _done && _ok;
+}
+
+LLMResponse LLMRequest::result() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _response;
+}
+
+bool LLMRequest::wait(unsigned long timeoutMs) const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  return _cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() { return _done; });
+}
+
+void LLMRequest::complete(bool ok, const LLMResponse& response) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _response = response;
+    _ok = ok;
+    _done = true;
+  }
+  _cv.notify_all();
+}
+
+// ---- LLMWorker ----
+
+LLMWorker& LLMWorker::shared() {
+  static LLMWorker instance;
+  return instance;
+}
+
+LLMWorker::LLMWorker(size_t queueDepth, uint32_t stackBytes, int core)
+  : _queueDepth(queueDepth) {
+  _running = true;
+#ifdef ESP_PLATFORM
+  // TLS のハンドシェイクがあるので、スタックは多めに取る
+  if (xTaskCreatePinnedToCore(taskEntry, "llmWorker", stackBytes, this, 1, nullptr, core) != pdPASS) {
+    Serial.println("[LLMWorker] Failed to start worker task.");
+    _running = false;
+  }
+#else
+  (void)stackBytes;
+  (void)core;
+  _thread = std::thread(taskEntry, this);
+#endif
+}
+
+LLMWorker::~LLMWorker() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _cv.notify_all();
+#ifdef ESP_PLATFORM
+  // タスクが抜けるのを待つ（処理中の問い合わせは最後まで行う）
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (!_running) break;
+    }
+    delay(5);
+  }
+#else
+  if (_thread.joinable()) _thread.join();
+#endif
+}
+
+LLMHandle LLMWorker::submit(Work work, Callback onDone) {
+  LLMHandle handle = std::make_shared<LLMRequest>();
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_running || _stopping || _queue.size() >= _queueDepth) {
+      ++_stats.rejected;
+      return nullptr;
+    }
+    _queue.push_back(Job{handle, work, onDone});
+    ++_stats.submitted;
+    if (_queue.size() > _stats.maxQueued) _stats.maxQueued = _queue.size();
+  }
+  _cv.notify_one();
+  return handle;
+}
+
+size_t LLMWorker::pending() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _queue.size();
+}
+
+LLMWorker::Stats LLMWorker::stats() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stats;
+}
+
+void LLMWorker::taskEntry(void* arg) {
+  static_cast<LLMWorker*>(arg)->run();
+#ifdef ESP_PLATFORM
+  vTaskDelete(nullptr);
+#endif
+}
+
+void LLMWorker::run() {
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+      if (_queue.empty()) break;  // 停止要求。残りがなくなってから抜ける
+      job = _queue.front();
+      _queue.pop_front();
+    }
+
+    LLMResponse response = {"", EmotionType::Undefined};
+    bool ok = job.work(response);
+    if (job.onDone) job.onDone(response);
+    job.handle->complete(ok, response);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++_stats.completed;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _running = false;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <Arduino.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#ifndef ESP_PLATFORM
+#include <thread>
+#endif
+#include "LLMEngine.h"
+
+/**
+ * LLMWorker::submit() が返すハンドル。どのタスクからでも done() で確認・wait() で待てる。
+ */
+class LLMRequest {
+public:
+  bool done() const;
+  bool succeeded() const;
+  LLMResponse result() const;  // done() になるまでは空
+  bool wait(unsigned long timeoutMs) const;
+
+private:
+  friend class LLMWorker;
+  mutable std::mutex _mutex;
+  mutable std::condition_variable _cv;
+  bool _done = false;
+  bool _ok = false;
+  LLMResponse _response = {"", EmotionType::Undefined};
+
+  void complete(bool ok, const LLMResponse& response);
+};
+
+using LLMHandle = std::shared_ptr<LLMRequest>;
+
+/**
+ * LLM への問い合わせを順番に処理する専用ワーカー。
+ *   ESP32 では FreeRTOS のタスク、PC では std::thread で動く。
+ *   キューは上限付きで、一杯のときは submit() が nullptr を返す（呼び出し側は待たない）。
+ *   完了時のコールバックはワーカー側のタスクから呼ばれる。
+ */
+class LLMWorker {
+public:
+  using Work = std::function<bool(LLMResponse&)>;
+  using Callback = std::function<void(const LLMResponse&)>;
+
+  struct Stats {
+    uint32_t submitted;
+    uint32_t completed;
+    uint32_t rejected;   // キューが一杯で受け付けなかった数
+    uint32_t maxQueued;
+  };
+
+  static LLMWorker& shared();
+
+  explicit LLMWorker(size_t queueDepth = 4, uint32_t stackBytes = 8192, int core = 0);
+  ~LLMWorker();
+  LLMWorker(const LLMWorker&) = delete;
+  LLMWorker& operator=(const LLMWorker&) = delete;
+
+  LLMHandle submit(Work work, Callback onDone = nullptr);
+  size_t pending() const;
+  Stats stats() const;
+
+private:
+  struct Job {
+    LLMHandle handle;
+    Work work;
+    Callback onDone;
+  };
+
+  size_t _queueDepth;
+  std::deque<Job> _queue;
+  mutable std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _stopping = false;
+  bool _running = false;
+  Stats _stats = {};
+#ifndef ESP_PLATFORM
+  std::thread _thread;
+#endif
+
+  static void taskEntry(void* arg);
+  void run();
+};
@@ -0,0 +1,125 @@
+#include "LocalIntentClassifier.h"
+#include <math.h>
+#include "TextUtils.h"
+
+// 特徴を均したスコアを何個ぶんの独立な証拠とみなすか（大きいほど事後確率が尖る）
+static const float kEvidence = 6.0f;
+// 最有力のインテントの例文に出てきた特徴がこの割合に満たなければ、confidence を割り引く
+static const float kMinCoverage = 0.6f;
+
+static uint32_t hashPair(uint32_t a, uint32_t b) {
+  uint32_t pair[2] = { a, b };
+  return fnv1a32(pair, sizeof(pair));
+}
+
+std::vector<uint32_t> LocalIntentClassifier::extractFeatures(const String& utterance) {
+  std::vector<uint32_t> codepoints;
+  const char* p = utterance.c_str();
+  uint32_t cp;
+  size_t n;
+  while ((n = decodeUtf8(p, cp)) > 0) {
+    p += n;
+    if (cp < 0x80) cp = tolower((int)cp);
+    if (!isIgnorableCodepoint(cp)) codepoints.push_back(cp);
+  }
+
+  // unigram + 先頭/末尾マーカー付き bigram
+  std::vector<uint32_t> features;
+  features.reserve(codepoints.size() * 2 + 1);
+  uint32_t prev = 0x02;  // 文頭
+  for (uint32_t c : codepoints) {
+    features.push_back(hashPair(c, 0));
+    features.push_back(hashPair(prev, c));
+    prev = c;
+  }
+  if (!codepoints.empty()) {
+    features.push_back(hashPair(prev, 0x03));  // 文末
+  }
+  return features;
+}
+
+void LocalIntentClassifier::addExample(const String& intent, const String& utterance) {
+  IntentModel& model = _models[intent];
+  for (uint32_t f : extractFeatures(utterance)) {
+    uint16_t& count = model.counts[f];
+    if (count == 0) ++_vocabulary[f];
+    if (count < UINT16_MAX) ++count;
+    ++model.total;
+  }
+  ++model.examples;
+}
+
+void LocalIntentClassifier::removeIntent(const String& intent) {
+  auto it = _models.find(intent);
+  if (it == _models.end()) return;
+
+  for (const auto& entry : it->second.counts) {
+    auto v = _vocabulary.find(entry.first);
+    if (v != _vocabulary.end() && --v->second == 0) {
+      _vocabulary.erase(v);
+    }
+  }
+  _models.erase(it);
+}
+
+void LocalIntentClassifier::clear() {
+  _models.clear();
+  _vocabulary.clear();
+}
+
+LocalIntentClassifier::Result LocalIntentClassifier::classify(
+    const String& utterance, const std::vector<String>& candidates) const {
+  Result result = { "", 0.0f };
+  if (_models.empty() || candidates.empty()) return result;
+
+  std::vector<uint32_t> features = extractFeatures(utterance);
+  if (features.empty()) return result;
+
+  // ラプラススムージング付きの対数尤度を特徴 1 つあたりに均す。
+  // 素の和は文が長いほど差が開き、知らない文でも事後確率が 1 に張り付く
+  const float vocab = (float)_vocabulary.size() + 1.0f;
+  const float unseen = logf(1.0f / vocab);
+  const float n = (float)features.size();
+  std::vector<float> scores;
+  std::vector<size_t> matched;
+  scores.reserve(candidates.size());
+  matched.reserve(candidates.size());
+
+  for (const auto& intent : candidates) {
+    auto it = _models.find(intent);
+    float logLikelihood = 0.0f;
+    size_t hits = 0;
+    if (it == _models.end()) {
+      logLikelihood = n * unseen;
+    } else {
+      const IntentModel& model = it->second;
+      const float denom = logf((float)model.total + vocab);
+      for (uint32_t f : features) {
+        auto c = model.counts.find(f);
+        float count = (c == model.counts.end()) ? 0.0f : (float)c->second;
+        if (count > 0.0f) ++hits;
+        logLikelihood += logf(count + 1.0f) - denom;
+      }
+    }
+    // 事前分布は候補間で一様なので、softmax では打ち消し合う
+    scores.push_back(kEvidence * logLikelihood / n);
+    matched.push_back(hits);
+  }
+
+  // softmax で事後確率に直す
+  size_t best = 0;
+  for (size_t i = 1; i < scores.size(); ++i) {
+    if (scores[i] > scores[best]) best = i;
+  }
+  float sum = 0.0f;
+  for (float s : scores) sum += expf(s - scores[best]);
+
+  result.intent = candidates[best];
+  if (_models.find(result.intent) == _models.end()) {
+    return result;  // 例文の無いインテントはローカルでは確定させない
+  }
+  // 例文で見たことのある特徴が少ない文は、どのインテントにも当てはまらない（ドメイン外）
+  float coverage = (float)matched[best] / n;
+  result.confidence = (1.0f / sum) * min(1.0f, coverage / kMinCoverage);
+  return result;
+}
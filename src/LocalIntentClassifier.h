@@ -0,0 +1,39 @@
+#pragma once
+#include <Arduino.h>
+#include <map>
+#include <vector>
+
+/**
+ * 端末内で動く小さなインテント分類器。
+ *   各インテントに登録した例文から、文字 bigram（UTF-8 のコードポイント単位）の
+ *   ナイーブベイズモデルを作る。分類はマイクロ秒オーダーで終わり、
+ *   confidence が閾値未満なら呼び出し側がリモート分類にフォールバックする。
+ *   confidence は特徴 1 つあたりに均した尤度の事後確率に、例文で見たことのある
+ *   特徴の割合を掛けたもの。例文と重ならない（ドメイン外の）文は長くても低くなる。
+ */
+class LocalIntentClassifier {
+public:
+  struct Result {
+    String intent;      // 最有力のインテント（例文が無ければ空）
+    float confidence;   // 0.0〜1.0
+  };
+
+  void addExample(const String& intent, const String& utterance);
+  void removeIntent(const String& intent);
+  void clear();
+  bool empty() const { return _models.empty(); }
+
+  Result classify(const String& utterance, const std::vector<String>& candidates) const;
+
+  static std::vector<uint32_t> extractFeatures(const String& utterance);
+
+private:
+  struct IntentModel {
+    std::map<uint32_t, uint16_t> counts;  // 特徴ハッシュ -> 出現回数
+    uint32_t total = 0;
+    uint16_t examples = 0;
+  };
+
+  std::map<String, IntentModel> _models;
+  std::map<uint32_t, uint16_t> _vocabulary;  // スムージング用の語彙（特徴 -> 持っているインテント数）
+};
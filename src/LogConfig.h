@@ -0,0 +1,14 @@
+#pragma once
+#include <Arduino.h>
+
+// ログレベル（build_flags で -DSTACKCHAN_THINK_LOG_LEVEL=3 のように指定）
+//   0: なし  1: エラー  2: 情報  3: デバッグ（リクエスト/レスポンス本文を出力）
+#ifndef STACKCHAN_THINK_LOG_LEVEL
+#define STACKCHAN_THINK_LOG_LEVEL 2
+#endif
+
+#if STACKCHAN_THINK_LOG_LEVEL >= 3
+#define THINK_LOG_DEBUG(...) Serial.printf(__VA_ARGS__)
+#else
+#define THINK_LOG_DEBUG(...) do {} while (0)
+#endif
@@ -0,0 +1,188 @@
+#include "MemoryAccounting.h"
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+MemoryAccounting& MemoryAccounting::instance() {
+  static MemoryAccounting accounting;
+  return accounting;
+}
+
+MemoryAccounting::MemoryAccounting() {
+  for (int i = 0; i < SubsystemCount; ++i) {
+    _budgets[i] = 0;
+    _heaps[i] = Heap::Internal;
+  }
+}
+
+const char* MemoryAccounting::name(Subsystem subsystem) {
+  switch (subsystem) {
+    case History: return "history";
+    case DecisionEngine: return "decision";
+    case Planner: return "planner";
+    case Arena: return "arena";
+    default: return "?";
+  }
+}
+
+void MemoryAccounting::allocated(Subsystem subsystem, size_t bytes) {
+  Counter& c = _counters[subsystem];
+  c.allocations.fetch_add(1, std::memory_order_relaxed);
+  size_t now = c.current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  size_t peak = c.peak.load(std::memory_order_relaxed);
+  while (now > peak && !c.peak.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {
+  }
+}
+
+void MemoryAccounting::freed(Subsystem subsystem, size_t bytes) {
+  Counter& c = _counters[subsystem];
+  c.frees.fetch_add(1, std::memory_order_relaxed);
+  // 数え漏れがあっても 0 を下回らないようにする
+  size_t current = c.current.load(std::memory_order_relaxed);
+  size_t next;
+  do {
+    next = current > bytes ? current - bytes : 0;
+  } while (!c.current.compare_exchange_weak(current, next, std::memory_order_relaxed));
+}
+
+void MemoryAccounting::resized(Subsystem subsystem, size_t oldBytes, size_t newBytes) {
+  if (newBytes > oldBytes) {
+    allocated(subsystem, newBytes - oldBytes);
+  } else if (newBytes < oldBytes) {
+    freed(subsystem, oldBytes - newBytes);
+  }
+}
+
+bool MemoryAccounting::overBudget(Subsystem subsystem) const {
+  return _budgets[subsystem] > 0 &&
+         _counters[subsystem].current.load(std::memory_order_relaxed) > _budgets[subsystem];
+}
+
+void MemoryAccounting::resetPeaks() {
+  for (auto& c : _counters) {
+    c.peak.store(c.current.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+}
+
+MemoryAccounting::Usage MemoryAccounting::usage(Subsystem subsystem) const {
+  const Counter& c = _counters[subsystem];
+  Usage u;
+  u.current = c.current.load(std::memory_order_relaxed);
+  u.peak = c.peak.load(std::memory_order_relaxed);
+  u.allocations = c.allocations.load(std::memory_order_relaxed);
+  u.frees = c.frees.load(std::memory_order_relaxed);
+  u.budget = _budgets[subsystem];
+  u.largestFreeBlock = largestFreeBlock(_heaps[subsystem]);
+  return u;
+}
+
+size_t MemoryAccounting::largestFreeBlock(Heap heap) {
+#ifdef ESP_PLATFORM
+  return heap_caps_get_largest_free_block(
+      (heap == Heap::Psram ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL) | MALLOC_CAP_8BIT);
+#else
+  (void)heap;
+  return 0;
+#endif
+}
+
+size_t MemoryAccounting::freeBytes(Heap heap) {
+#ifdef ESP_PLATFORM
+  return heap_caps_get_free_size(
+      (heap == Heap::Psram ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL) | MALLOC_CAP_8BIT);
+#else
+  (void)heap;
+  return 0;
+#endif
+}
+
+void MemoryAccounting::report(Print& out) const {
+  out.printf("[Memory] internal free %u (largest %u), psram free %u (largest %u)\n",
+             (unsigned)freeBytes(Heap::Internal), (unsigned)largestFreeBlock(Heap::Internal),
+             (unsigned)freeBytes(Heap::Psram), (unsigned)largestFreeBlock(Heap::Psram));
+  for (int i = 0; i < SubsystemCount; ++i) {
+    Usage u = usage((Subsystem)i);
+    out.printf("[Memory] %-8s %7u bytes (peak %7u) allocs %6u frees %6u largest free %7u%s\n",
+               name((Subsystem)i), (unsigned)u.current, (unsigned)u.peak,
+               (unsigned)u.allocations, (unsigned)u.frees, (unsigned)u.largestFreeBlock,
+               overBudget((Subsystem)i) ? " OVER BUDGET" : "");
+  }
+}
+
+bool MemoryAccounting::reportIfDue(Print& out, unsigned long intervalMs) {
+  unsigned long now = millis();
+  if (_reported && now - _lastReport < intervalMs) return false;
+  _reported = true;
+  _lastReport = now;
+  report(out);
+  return true;
+}
+
+bool MemoryAccounting::appendCsv(fs::FS& fs, const char* path) const {
+  bool header = !fs.exists(path);
+  File file = fs.open(path, FILE_APPEND);
+  if (!file) return false;
+  if (header) {
+    file.print("millis,internal_largest,psram_largest");
+    for (int i = 0; i < SubsystemCount; ++i) {
+      file.printf(",%s,%s_peak", name((Subsystem)i), name((Subsystem)i));
+    }
+    file.print("\n");
+  }
+  file.printf("%lu,%u,%u", millis(), (unsigned)largestFreeBlock(Heap::Internal),
+              (unsigned)largestFreeBlock(Heap::Psram));
+  for (int i = 0; i < SubsystemCount; ++i) {
+    Usage u = usage((Subsystem)i);
+    file.printf(",%u,%u", (unsigned)u.current, (unsigned)u.peak);
+  }
+  file.print("\n");
+  file.close();
+  return true;
+}
+
+// ---- TaggedAllocator ----
+
+// 解放時に大きさがわかるよう、各ブロックの前に置く（8 バイト境界を保つ）
+struct TaggedBlock {
+  uint32_t size;
+  uint32_t reserved;
+};
+
+TaggedAllocator& TaggedAllocator::of(MemoryAccounting::Subsystem subsystem) {
+  static TaggedAllocator history(MemoryAccounting::History);
+  static TaggedAllocator decision(MemoryAccounting::DecisionEngine);
+  static TaggedAllocator planner(MemoryAccounting::Planner);
+  static TaggedAllocator arena(MemoryAccounting::Arena);
+  switch (subsystem) {
+    case MemoryAccounting::History: return history;
+    case MemoryAccounting::DecisionEngine: return decision;
+    case MemoryAccounting::Planner: return planner;
+    default: return arena;
+  }
+}
+
+void* TaggedAllocator::allocate(size_t size) {
+  TaggedBlock* block = (TaggedBlock*)malloc(sizeof(TaggedBlock) + size);
+  if (!block) return nullptr;
+  block->size = size;
+  MemoryAccounting::instance().allocated(_subsystem, size);
+  return block + 1;
+}
+
+void TaggedAllocator::deallocate(void* ptr) {
+  if (!ptr) return;
+  TaggedBlock* block = (TaggedBlock*)ptr - 1;
+  MemoryAccounting::instance().freed(_subsystem, block->size);
+  free(block);
+}
+
+void* TaggedAllocator::reallocate(void* ptr, size_t newSize) {
+  if (!ptr) return allocate(newSize);
+  TaggedBlock* block = (TaggedBlock*)ptr - 1;
+  size_t oldSize = block->size;
+  TaggedBlock* moved = (TaggedBlock*)realloc(block, sizeof(TaggedBlock) + newSize);
+  if (!moved) return nullptr;
+  moved->size = newSize;
+  MemoryAccounting::instance().resized(_subsystem, oldSize, newSize);
+  return moved + 1;
+}
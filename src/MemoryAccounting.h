@@ -0,0 +1,96 @@
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+#include <atomic>
+
+/**
+ * サブシステムごとのメモリ使用量の集計。
+ *   各サブシステムは確保・解放したバイト数を allocated() / freed() で知らせる。
+ *   現在値・ピーク・確保回数を持ち、そのサブシステムが使うヒープ（内部 RAM か
+ *   PSRAM）の最大連続空き領域と合わせて report() で出力する。
+ *   予算を設定すると、超えたサブシステムに印を付ける（長時間運転での漏れ探し用）。
+ *
+ *   数えているのは各サブシステムが自分で把握できる分（JsonDocument の確保、
+ *   履歴の文字列の長さなど）で、String の確保の端数は含まない。
+ *   どのタスクから呼んでもよい。ESP_PLATFORM 以外では空き領域は 0 になる。
+ */
+class MemoryAccounting {
+public:
+  enum Subsystem {
+    History,         // LLMEngine の会話履歴
+    DecisionEngine,  // LLMDecisionEngine の JsonDocument と tools 断片
+    Planner,         // プランナーの状態（独り言の候補プールなど）
+    Arena,           // JsonArena（ターン内の使用量と、ヒープに回した分）
+    SubsystemCount
+  };
+
+  enum class Heap { Internal, Psram };
+
+  struct Usage {
+    size_t current;
+    size_t peak;
+    uint32_t allocations;
+    uint32_t frees;
+    size_t budget;            // 0 なら予算なし
+    size_t largestFreeBlock;  // このサブシステムが使うヒープの最大連続空き領域
+  };
+
+  static MemoryAccounting& instance();
+  static const char* name(Subsystem subsystem);
+
+  void allocated(Subsystem subsystem, size_t bytes);
+  void freed(Subsystem subsystem, size_t bytes);
+  void resized(Subsystem subsystem, size_t oldBytes, size_t newBytes);
+
+  void setHeap(Subsystem subsystem, Heap heap) { _heaps[subsystem] = heap; }
+  void setBudget(Subsystem subsystem, size_t bytes) { _budgets[subsystem] = bytes; }
+  bool overBudget(Subsystem subsystem) const;
+  void resetPeaks();
+
+  Usage usage(Subsystem subsystem) const;
+  static size_t largestFreeBlock(Heap heap);
+  static size_t freeBytes(Heap heap);
+
+  // 1 サブシステム 1 行で出力する
+  void report(Print& out) const;
+  // 前回から intervalMs 以上たっていれば report() する（アイドルジョブ用）
+  bool reportIfDue(Print& out, unsigned long intervalMs);
+  // 時刻と各サブシステムの現在値・ピークを CSV の 1 行として追記する（長時間運転の記録用）
+  bool appendCsv(fs::FS& fs, const char* path) const;
+
+private:
+  MemoryAccounting();
+
+  struct Counter {
+    std::atomic<size_t> current{0};
+    std::atomic<size_t> peak{0};
+    std::atomic<uint32_t> allocations{0};
+    std::atomic<uint32_t> frees{0};
+  };
+
+  Counter _counters[SubsystemCount];
+  size_t _budgets[SubsystemCount];
+  Heap _heaps[SubsystemCount];
+  unsigned long _lastReport = 0;
+  bool _reported = false;
+};
+
+/**
+ * 確保したバイト数をサブシステムに付けて数える JsonDocument 用のアロケータ。
+ *   長く持つドキュメント（メンバー変数）に使う。ターン内で捨てるものは JsonArena へ。
+ *     JsonDocument _doc{&TaggedAllocator::of(MemoryAccounting::DecisionEngine)};
+ */
+class TaggedAllocator : public ArduinoJson::Allocator {
+public:
+  static TaggedAllocator& of(MemoryAccounting::Subsystem subsystem);
+
+  void* allocate(size_t size) override;
+  void deallocate(void* ptr) override;
+  void* reallocate(void* ptr, size_t newSize) override;
+
+private:
+  explicit TaggedAllocator(MemoryAccounting::Subsystem subsystem) : _subsystem(subsystem) {}
+
+  MemoryAccounting::Subsystem _subsystem;
+};
@@ -1,15 +1,19 @@
 #pragma once
 #include <Arduino.h>
+#include "FixedString.h"
 
 /**
  * A single chat turn sent to the LLM.
  *   role    – "system", "user", or "assistant"
  *   content – plain-text payload
  */
+// role は決まった短い名前だけなので、ヒープを使わずに持つ
+using MessageRole = FixedString<16>;
+
 struct Message {
-  String role;
+  MessageRole role;
   String content;
 
-  Message(const String& r = "", const String& c = "")
+  Message(const char* r = "", const String& c = "")
       : role(r), content(c) {}
 };
@@ -0,0 +1,354 @@
+#include "OpenAITransport.h"
+#include "Trace.h"
+
+HttpBodyStream::HttpBodyStream(Client& client, int contentLength, bool chunked,
+                               const CancelToken& cancel)
+  : _client(client),
+    _cancel(cancel),
+    _mode(chunked ? Mode::Chunked : (contentLength >= 0 ? Mode::Length : Mode::UntilClose)),
+    _remaining(contentLength) {}
+
+void HttpBodyStream::advanceChunk() {
+  // chunk のヘッダ・区切りを、届いている分だけ読み進める
+  while (_chunkState != ChunkState::Done && _client.available() > 0) {
+    if (_chunkState == ChunkState::Data) {
+      if (_remaining > 0) return;
+      _chunkState = ChunkState::DataEnd;
+    }
+
+    char c = (char)_client.read();
+    if (c == '\r') continue;
+    if (c != '\n') {
+      if (_chunkState != ChunkState::DataEnd) _line += c;
+      continue;
+    }
+
+    switch (_chunkState) {
+      case ChunkState::Size: {
+        long size = strtol(_line.c_str(), nullptr, 16);  // ";ext" は無視される
+        _line = "";
+        if (size <= 0) {
+          _chunkState = ChunkState::Trailer;
+        } else {
+          _remaining = size;
+          _chunkState = ChunkState::Data;
+        }
+        break;
+      }
+      case ChunkState::DataEnd:
+        _chunkState = ChunkState::Size;
+        break;
+      case ChunkState::Trailer:
+        if (_line.isEmpty()) _chunkState = ChunkState::Done;
+        _line = "";
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+int HttpBodyStream::available() {
+  if (_cancel.cancelled()) return 0;
+  switch (_mode) {
+    case Mode::Length:
+      if (_remaining <= 0) return 0;
+      return (int)min((long)_client.available(), _remaining);
+
+    case Mode::Chunked:
+      advanceChunk();
+      if (_chunkState != ChunkState::Data || _remaining <= 0) return 0;
+      return (int)min((long)_client.available(), _remaining);
+
+    case Mode::UntilClose:
+    default:
+      return _client.available();
+  }
+}
+
+int HttpBodyStream::read() {
+  if (available() <= 0) return -1;
+  int c = _client.read();
+  if (c >= 0 && _mode != Mode::UntilClose) {
+    --_remaining;
+  }
+  return c;
+}
+
+int HttpBodyStream::peek() {
+  if (available() <= 0) return -1;
+  return _client.peek();
+}
+
+size_t HttpBodyStream::readBytes(char* buffer, size_t length) {
+  size_t count = 0;
+  unsigned long lastData = millis();
+  while (count < length) {
+    int c = read();
+    if (c >= 0) {
+      buffer[count++] = (char)c;
+      lastData = millis();
+      continue;
+    }
+    if (!isOpen()) break;  // 取り消された・本文が終わった・切断された
+    if (millis() - lastData >= _timeout) break;
+    delay(1);
+  }
+  return count;
+}
+
+bool HttpBodyStream::finished() {
+  switch (_mode) {
+    case Mode::Length:
+      return _remaining <= 0;
+    case Mode::Chunked:
+      advanceChunk();
+      return _chunkState == ChunkState::Done;
+    case Mode::UntilClose:
+    default:
+      return !_client.connected() && _client.available() <= 0;
+  }
+}
+
+bool HttpBodyStream::isOpen() {
+  if (_cancel.cancelled() || finished()) return false;
+  return _client.connected() || _client.available() > 0;
+}
+
+bool HttpBodyStream::readAll(String& out, unsigned long timeoutMs) {
+  if (_mode == Mode::Length && _remaining > 0) {
+    out.reserve(out.length() + _remaining);
+  }
+
+  char buf[256];
+  unsigned long lastData = millis();
+  for (;;) {
+    int avail = available();
+    if (avail > 0) {
+      size_t n = readBytes(buf, min((size_t)avail, sizeof(buf)));
+      out.concat(buf, n);
+      lastData = millis();
+      continue;
+    }
+    if (!isOpen()) break;
+    if (millis() - lastData > timeoutMs) return false;
+    delay(1);
+  }
+  return finished() || _mode == Mode::UntilClose;
+}
+
+bool HttpBodyStream::discardRest(unsigned long timeoutMs) {
+  unsigned long lastData = millis();
+  for (;;) {
+    if (available() > 0) {
+      read();
+      lastData = millis();
+      continue;
+    }
+    if (!isOpen()) break;
+    if (millis() - lastData > timeoutMs) return false;
+    delay(1);
+  }
+  return finished() || _mode == Mode::UntilClose;
+}
+
+void OpenAITransport::Connection::stop() {
+  http.end();
+  secure.stop();
+  plain.stop();
+}
+
+OpenAITransport& OpenAITransport::shared() {
+  static OpenAITransport instance;
+  return instance;
+}
+
+OpenAITransport::OpenAITransport(const String& endpoint) {
+  setEndpoint(endpoint);
+  for (auto& conn : _pool) {
+    conn.secure.setInsecure(); // または適切なルート証明書を使う
+  }
+}
+
+void OpenAITransport::setEndpoint(const String& url) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (url == _endpoint) return;
+  _endpoint = url;
+  _secure = url.startsWith("https://");
+  int hostStart = url.indexOf("://");
+  hostStart = hostStart < 0 ? 0 : hostStart + 3;
+  int hostEnd = url.indexOf('/', hostStart);
+  String hostPort = url.substring(hostStart, hostEnd < 0 ? url.length() : hostEnd);
+  int colon = hostPort.indexOf(':');
+  _host = colon < 0 ? hostPort : hostPort.substring(0, colon);
+  _port = colon < 0 ? (_secure ? 443 : 80) : hostPort.substring(colon + 1).toInt();
+  // ホストが変わるので、アイドル中の接続は捨てる
+  for (auto& conn : _pool) {
+    if (!conn.busy) conn.stop();
+  }
+}
+
+String OpenAITransport::endpoint() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _endpoint;
+}
+
+// 取り消しはトークンから通知されないので、空きを待つ間もこの間隔で確かめる
+static const unsigned long kAcquireCancelPollMs = 50;
+
+OpenAITransport::Connection* OpenAITransport::acquire(bool secure, const CancelToken& cancel) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (;;) {
+    if (cancel.cancelled()) return nullptr;
+    // 接続済みのものを優先して使う
+    Connection* idle = nullptr;
+    for (auto& conn : _pool) {
+      if (conn.busy) continue;
+      if (conn.secureMode == secure && conn.isConnected()) {
+        conn.busy = true;
+        return &conn;
+      }
+      if (!idle) idle = &conn;
+    }
+    if (idle) {
+      idle->busy = true;
+      return idle;
+    }
+    // 全部使用中なら、どれかが release() されるまで眠る
+    _released.wait_for(lock, std::chrono::milliseconds(kAcquireCancelPollMs));
+  }
+}
+
+void OpenAITransport::release(Connection* conn) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    conn->lastUsed = millis();
+    conn->busy = false;
+  }
+  _released.notify_one();
+}
+
+void OpenAITransport::closeAll() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (auto& conn : _pool) {
+    if (!conn.busy) conn.stop();
+  }
+}
+
+int OpenAITransport::post(const String& apiKey, const String& payload, String& responseBody,
+                          const CancelToken& cancel) {
+  responseBody = "";
+  return post(apiKey, payload, [this, &responseBody](HttpBodyStream& body) {
+    return body.readAll(responseBody, _responseTimeoutMs);
+  }, "application/json", cancel);
+}
+
+int OpenAITransport::post(const String& apiKey, const String& payload, BodyReader reader,
+                          const char* accept, const CancelToken& cancel) {
+  TRACE_SPAN("http_post");
+  static const char* headerKeys[] = { "Transfer-Encoding" };
+  // setEndpoint() が別のタスクから書き換えても、このリクエストの間は同じ値を使う
+  String url;
+  String host;
+  uint16_t port;
+  bool secure;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    url = _endpoint;
+    host = _host;
+    port = _port;
+    secure = _secure;
+  }
+
+  int httpCode = HTTPC_ERROR_CONNECTION_REFUSED;
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    Connection* conn = acquire(secure, cancel);
+    if (!conn) return kCancelled;
+
+    if (conn->secureMode != secure) {
+      conn->stop();
+      conn->secureMode = secure;
+    }
+
+    // 長くアイドルだった接続はサーバー側で閉じられている可能性が高い
+    bool reused = conn->isConnected();
+    if (reused && millis() - conn->lastUsed > _idleTimeoutMs) {
+      Serial.println("[OpenAITransport] Dropping stale connection.");
+      conn->stop();
+      reused = false;
+    }
+    if (reused) {
+      ++_reuseCount;
+    } else {
+      ++_connectCount;
+      // HTTPClient は接続済みのクライアントをそのまま使うので、ここで張っておく
+      bool connected;
+      {
+        TRACE_SPAN(secure ? "tls_handshake" : "tcp_connect");
+        connected = conn->client().connect(host.c_str(), port);
+      }
+      if (!connected) {
+        Serial.printf("[OpenAITransport] Failed to connect to %s:%u\n", host.c_str(), (unsigned)port);
+        conn->stop();
+        release(conn);
+        return cancel.cancelled() ? kCancelled : HTTPC_ERROR_CONNECTION_REFUSED;
+      }
+    }
+
+    conn->http.setReuse(true);
+    conn->http.setTimeout(_responseTimeoutMs);
+    conn->http.begin(conn->client(), url);
+    if (!conn->headersCollected) {
+      conn->http.collectHeaders(headerKeys, 1);
+      conn->headersCollected = true;
+    }
+    conn->http.addHeader("Content-Type", "application/json");
+    conn->http.addHeader("Accept", accept);
+    String authorization;
+    authorization.reserve(7 + apiKey.length());
+    authorization += "Bearer ";
+    authorization += apiKey;
+    conn->http.addHeader("Authorization", authorization);
+
+    {
+      TRACE_SPAN("http_ttfb");  // 送信からレスポンスヘッダーまで
+      httpCode = conn->http.POST(payload);
+    }
+    if (httpCode < 0) {
+      Serial.printf("[OpenAITransport] Request failed: %s\n", HTTPClient::errorToString(httpCode).c_str());
+      conn->stop();
+      release(conn);
+      if (cancel.cancelled()) return kCancelled;
+      if (reused) continue;  // 再利用した接続が切れていた。張り直して再送
+      return httpCode;
+    }
+
+    bool chunked = conn->http.header("Transfer-Encoding").indexOf("chunked") >= 0;
+    HttpBodyStream body(conn->client(), conn->http.getSize(), chunked, cancel);
+    body.setTimeout(_responseTimeoutMs);  // deserializeJson(Stream) の読み出し待ち
+
+    bool consumed;
+    if (httpCode == HTTP_CODE_OK) {
+      TRACE_SPAN("http_body");  // reader の JSON 解析を含む
+      consumed = reader(body) && body.finished();
+    } else {
+      String errorBody;
+      consumed = body.readAll(errorBody, _responseTimeoutMs);
+      Serial.printf("[OpenAITransport] HTTP %d: %s\n", httpCode, errorBody.c_str());
+    }
+
+    if (consumed) {
+      conn->http.end();  // keep-alive なら接続は開いたまま
+    } else {
+      conn->stop();      // 本文が残っている接続は再利用できない
+    }
+    release(conn);
+    if (cancel.cancelled()) {
+      Serial.println("[OpenAITransport] Request cancelled.");
+      return kCancelled;
+    }
+    return httpCode;
+  }
+
+  return httpCode;
+}
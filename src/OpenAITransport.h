@@ -0,0 +1,122 @@
+#pragma once
+#include <Arduino.h>
+#include <Client.h>
+#include <WiFiClient.h>
+#include <WiFiClientSecure.h>
+#include <HTTPClient.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include "CancelToken.h"
+
+/**
+ * HTTP レスポンス本文を読むための Stream。
+ *   Content-Length / chunked / 切断まで、のいずれの形式でも本文だけを返す。
+ *   最後まで読み切れば、接続はそのまま次のリクエストに再利用できる。
+ */
+class HttpBodyStream : public Stream {
+public:
+  HttpBodyStream(Client& client, int contentLength, bool chunked,
+                 const CancelToken& cancel = CancelToken::none());
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t) override { return 0; }
+  // deserializeJson(Stream) は 1 バイトずつここで待つ。取り消し・本文の終わりで
+  // setTimeout() の時間を待たずに戻る
+  size_t readBytes(char* buffer, size_t length) override;
+  using Stream::readBytes;
+
+  bool finished();  // 本文を最後まで読み切った
+  bool isOpen();    // まだ本文の続きが届く可能性がある（取り消されたら false）
+  bool cancelled() const { return _cancel.cancelled(); }
+  bool readAll(String& out, unsigned long timeoutMs);
+  bool discardRest(unsigned long timeoutMs);  // JSON の後ろの改行などを読み捨てる
+
+private:
+  enum class Mode { Length, Chunked, UntilClose };
+  enum class ChunkState { Size, Data, DataEnd, Trailer, Done };
+
+  Client& _client;
+  CancelToken _cancel;
+  Mode _mode;
+  long _remaining;
+  ChunkState _chunkState = ChunkState::Size;
+  String _line;
+
+  void advanceChunk();
+};
+
+/**
+ * OpenAI 互換エンドポイントへの共有トランスポート。
+ *   HTTP/1.1 keep-alive の接続を小さなプールで保持して使い回し、
+ *   TLS ハンドシェイクを毎ターン繰り返さないようにする。
+ *   古くなった接続は捨てて張り直し、再利用した接続で失敗した場合は
+ *   新しい接続で 1 回だけ再送する。
+ */
+class OpenAITransport {
+public:
+  using BodyReader = std::function<bool(HttpBodyStream& body)>;
+
+  // cancel で取り消されたときの戻り値（HTTPClient のエラーコードとは重ならない）
+  static const int kCancelled = -100;
+
+  static OpenAITransport& shared();
+
+  explicit OpenAITransport(const String& endpoint = "https://api.openai.com/v1/chat/completions");
+
+  void setEndpoint(const String& url);  // ローカルのスタンドインサーバー向け（http:// も可）
+  String endpoint() const;
+  void setIdleTimeout(unsigned long ms) { _idleTimeoutMs = ms; }
+  void setResponseTimeout(unsigned long ms) { _responseTimeoutMs = ms; }
+
+  // JSON を POST して本文を丸ごと受け取る。戻り値は HTTP ステータス（負値は通信エラー）
+  int post(const String& apiKey, const String& payload, String& responseBody,
+           const CancelToken& cancel = CancelToken::none());
+
+  // JSON を POST し、200 のときだけ reader に本文のストリームを渡す。
+  // reader が本文を読み切らずに戻った場合、その接続は閉じる。
+  // 本文の受信中に cancel されると、本文はそこで途切れ、接続を閉じて kCancelled を返す。
+  int post(const String& apiKey, const String& payload, BodyReader reader,
+           const char* accept = "application/json",
+           const CancelToken& cancel = CancelToken::none());
+
+  void closeAll();
+
+  uint32_t connectCount() const { return _connectCount.load(); }
+  uint32_t reuseCount() const { return _reuseCount.load(); }
+
+private:
+  static const int kPoolSize = 2;
+
+  struct Connection {
+    WiFiClientSecure secure;
+    WiFiClient plain;
+    HTTPClient http;
+    bool busy = false;
+    bool secureMode = true;
+    bool headersCollected = false;
+    unsigned long lastUsed = 0;
+
+    WiFiClient& client() { return secureMode ? (WiFiClient&)secure : plain; }
+    bool isConnected() { return client().connected(); }
+    void stop();
+  };
+
+  Connection _pool[kPoolSize];
+  mutable std::mutex _mutex;             // プールの busy とエンドポイントを守る
+  std::condition_variable _released;     // release() で空きを待つタスクを起こす
+  String _endpoint;
+  String _host;  // 接続を先に張る（ハンドシェイクを別に測る）ためにエンドポイントから取り出す
+  uint16_t _port = 443;
+  bool _secure = true;
+  unsigned long _idleTimeoutMs = 50000;
+  unsigned long _responseTimeoutMs = 30000;
+  std::atomic<uint32_t> _connectCount{0};  // どのタスクの post() からも増やす
+  std::atomic<uint32_t> _reuseCount{0};
+
+  Connection* acquire(bool secure, const CancelToken& cancel);
+  void release(Connection* conn);
+};
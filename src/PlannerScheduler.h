@@ -1,42 +1,148 @@
 // PlannerScheduler.h
 #pragma once
 #include <vector>
+#include <functional>
+#include <algorithm>
+#include <atomic>
 #include "IPlanner.h"
 #include "EngineManager.h"
 #include "SpeechEngine.h"
+#include "Trace.h"
 
+/**
+ * プランナーを起床時刻のヒープで管理し、期限が来たものだけ tick() する。
+ *   tick() は次に起きるまでの ms を返すので、呼び出し側はその分だけ眠ればよい。
+ *   同時に話題が揃ったら priority() の高いプランナーから話す。
+ */
 class PlannerScheduler {
 public:
+  static const unsigned long kPollMs = 100;       // 話せない間・話した直後の見直し間隔
+  static const unsigned long kMaxSleepMs = 1000;  // アイドルジョブもこの間隔では回す
+
   PlannerScheduler(EngineManager* engineMgr)
     : engineManager(engineMgr) {}
 
   void addPlanner(IPlanner* planner) {
     planners.push_back(planner);
+    schedule(planner, millis());
+  }
+
+  // 話すことが無いアイドル時に 1 つずつ実行するジョブ（履歴の要約など）。
+  // 仕事をしたら true を返す
+  using IdleJob = std::function<bool()>;
+  void addIdleJob(IdleJob job, std::function<void()> onInterrupt = nullptr) {
+    idleJobs.push_back(job);
+    if (onInterrupt) interruptHandlers.push_back(onInterrupt);
+  }
+
+  // interrupt() で読み上げ待ちの発話を捨てる処理。SpeechEngine（StackChan-Speech）には
+  // キューを消す API がまだ無いので既定では何もしない。ライブラリ側に用意できたら渡す
+  void setSpeechFlush(std::function<void()> flush) {
+    speechFlush = flush;
+  }
+
+  // ユーザーが話しかけた（顔をタップした）ときに、どのタスクからでも呼ぶ。
+  // 問い合わせ中のプランナーやアイドルジョブを打ち切り、用意していた話題を捨てる。
+  // 既に SpeechEngine に渡した発話は、setSpeechFlush() の処理があればそれで捨てる
+  void interrupt() {
+    for (auto planner : planners) {
+      planner->cancel();
+    }
+    for (auto& handler : interruptHandlers) {
+      handler();
+    }
+    if (speechFlush) speechFlush();
+    rescheduleAll = true;  // 起床時刻が変わったので、次の tick で並べ直す
   }
 
-  void tick() {
-    if (!engineManager->canTalk() || SpeechEngine::isSpeaking()) return;
+  // 戻り値は次に呼ぶまで眠ってよい ms
+  unsigned long tick() {
+    if (!engineManager->canTalk() || SpeechEngine::isSpeaking()) return kPollMs;
 
     if (engineManager->getState() == InteractionState::Speaking) {
       engineManager->setState(InteractionState::Idle);
     }
 
-    for (auto planner : planners) {
-      planner->tick();
-      if (planner->hasTopic()) {
-        PlannedTopic topic = planner->getTopic();
-        SpeechEngine::enqueueText(topic.text);
-        engineManager->setState(InteractionState::Speaking);
+    TRACE_SPAN("PlannerScheduler::tick");
+    unsigned long now = millis();
+    if (rescheduleAll.exchange(false)) {
+      wakeHeap.clear();
+      for (auto planner : planners) schedule(planner, now);
+    }
 
-        // ThoughtPlannerのタイミングを初期化する
-        planner->resetTiming();
+    // 期限が来たものだけ tick し、話題を持っているうちで最も優先度の高いものを選ぶ
+    std::vector<IPlanner*> due;
+    while (!wakeHeap.empty() && !isLater(wakeHeap.front().wakeAt, now)) {
+      std::pop_heap(wakeHeap.begin(), wakeHeap.end(), LaterWake());
+      due.push_back(wakeHeap.back().planner);
+      wakeHeap.pop_back();
+    }
 
-        break;
+    IPlanner* speaker = nullptr;
+    for (auto planner : due) {
+      planner->tick();
+      if (planner->hasTopic() && (!speaker || planner->priority() > speaker->priority())) {
+        speaker = planner;
       }
     }
+
+    if (speaker) {
+      PlannedTopic topic = speaker->getTopic();
+      SpeechEngine::enqueueText(topic.text);
+      engineManager->setState(InteractionState::Speaking);
+
+      // ThoughtPlannerのタイミングを初期化する
+      speaker->resetTiming();
+    }
+    for (auto planner : due) {
+      schedule(planner, now);  // 選ばれなかった話題は nextWakeMs が now なのですぐまた来る
+    }
+    if (speaker) return kPollMs;
+
+    runIdleJob();
+    return sleepTime(millis());
   }
 
 private:
+  struct Wake {
+    unsigned long wakeAt;
+    IPlanner* planner;
+  };
+  // millis() の桁あふれを考えて差で比べる
+  static bool isLater(unsigned long a, unsigned long b) { return (long)(a - b) > 0; }
+  struct LaterWake {
+    bool operator()(const Wake& a, const Wake& b) const { return isLater(a.wakeAt, b.wakeAt); }
+  };
+
   std::vector<IPlanner*> planners;
+  std::vector<Wake> wakeHeap;  // 起床時刻が最も早いものが先頭
+  std::atomic<bool> rescheduleAll{false};
   EngineManager* engineManager;
+  std::vector<IdleJob> idleJobs;
+  std::vector<std::function<void()>> interruptHandlers;
+  std::function<void()> speechFlush;
+  size_t nextIdleJob = 0;
+
+  void schedule(IPlanner* planner, unsigned long now) {
+    wakeHeap.push_back(Wake{planner->nextWakeMs(now), planner});
+    std::push_heap(wakeHeap.begin(), wakeHeap.end(), LaterWake());
+  }
+
+  unsigned long sleepTime(unsigned long now) const {
+    if (wakeHeap.empty()) return kMaxSleepMs;
+    unsigned long wakeAt = wakeHeap.front().wakeAt;
+    if (!isLater(wakeAt, now)) return kPollMs;  // 期限切れは次の見直しで拾う
+    unsigned long wait = wakeAt - now;
+    return wait < kMaxSleepMs ? wait : kMaxSleepMs;
+  }
+
+  void runIdleJob() {
+    // 1 tick で 1 つだけ、順番に回す
+    for (size_t i = 0; i < idleJobs.size(); ++i) {
+      IdleJob& job = idleJobs[nextIdleJob];
+      nextIdleJob = (nextIdleJob + 1) % idleJobs.size();
+      if (!engineManager->canTalk()) return;
+      if (job()) return;
+    }
+  }
 };
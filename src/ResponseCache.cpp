@@ -0,0 +1,201 @@
+#include "ResponseCache.h"
+#include "JsonArena.h"
+#include "TextUtils.h"
+
+ResponseCache::ResponseCache(fs::FS& fs, const String& dir)
+  : _fs(fs), _dir(dir) {}
+
+String ResponseCache::entryPath(uint32_t key) const {
+  char name[24];
+  snprintf(name, sizeof(name), "/reply_%08lx.json", (unsigned long)key);
+  return _dir + name;
+}
+
+String ResponseCache::indexPath() const {
+  return _dir + "/reply_index.json";
+}
+
+void ResponseCache::setLimits(size_t maxEntries, size_t maxBytes) {
+  _maxEntries = maxEntries;
+  _maxBytes = maxBytes;
+  if (enforceLimits()) saveIndex();
+}
+
+unsigned long ResponseCache::ttlFor(const String& topic) const {
+  auto it = _topicTtlMs.find(topic);
+  return it == _topicTtlMs.end() ? _defaultTtlMs : it->second;
+}
+
+bool ResponseCache::bypasses(const String& topic) {
+  if (_maxEntries > 0 && ttlFor(topic) > 0) return false;
+  ++_stats.bypassed;
+  return true;
+}
+
+uint32_t ResponseCache::makeKey(const String& input, const String& topic,
+                                const ConversationHistory& history) const {
+  String normalized = normalizeUtterance(input);
+  uint32_t h = fnv1a32(normalized.c_str(), normalized.length());
+  h = fnv1a32("|", 1, h);
+  h = fnv1a32(topic.c_str(), topic.length(), h);
+  // 同じ質問でも直前のやりとりが違えば別の返答になりうる
+  size_t depth = _contextDepth < history.size() ? _contextDepth : history.size();
+  for (size_t i = history.size() - depth; i < history.size(); ++i) {
+    const Message& m = history.at(i);
+    h = fnv1a32("|", 1, h);
+    h = fnv1a32(m.role.c_str(), m.role.length(), h);
+    h = fnv1a32(m.content.c_str(), m.content.length(), h);
+  }
+  return h;
+}
+
+bool ResponseCache::lookup(uint32_t key, LLMResponse& response) {
+  auto it = _index.find(key);
+  if (it == _index.end()) {
+    ++_stats.misses;
+    return false;
+  }
+
+  if (millis() - it->second->storedAt > it->second->ttlMs) {
+    ++_stats.expired;
+    ++_stats.misses;
+    erase(it);
+    saveIndex();
+    return false;
+  }
+
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
+  File file = _fs.open(entryPath(key), FILE_READ);
+  DeserializationError error = DeserializationError::EmptyInput;
+  if (file) {
+    error = deserializeJson(doc, file);
+    file.close();
+  }
+  if (error || !doc["message"].is<const char*>()) {
+    // 本文が消えている・壊れている。索引からも外す
+    Serial.printf("[ResponseCache] Dropping unreadable entry %08lx\n", (unsigned long)key);
+    ++_stats.misses;
+    erase(it);
+    saveIndex();
+    return false;
+  }
+
+  _entries.splice(_entries.begin(), _entries, it->second);  // 最近使ったものを先頭へ
+  response.message = doc["message"].as<String>();
+  response.emotion = (EmotionType)(doc["emotion"] | (int)EmotionType::Neutral);
+  ++_stats.hits;
+  return true;
+}
+
+void ResponseCache::store(uint32_t key, const String& topic, const LLMResponse& response) {
+  unsigned long ttlMs = ttlFor(topic);
+  if (_maxEntries == 0 || ttlMs == 0 || response.message.isEmpty()) return;
+
+  auto it = _index.find(key);
+  if (it != _index.end()) erase(it);
+
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
+  doc["message"] = response.message;
+  doc["emotion"] = (int)response.emotion;
+  size_t bytes = measureJson(doc);
+  if (bytes > _maxBytes) return;
+
+  File file = _fs.open(entryPath(key), FILE_WRITE);
+  if (!file) {
+    Serial.printf("[ResponseCache] Failed to write %s\n", entryPath(key).c_str());
+    return;
+  }
+  size_t written = serializeJson(doc, file);
+  file.close();
+  if (written != bytes) {
+    _fs.remove(entryPath(key));
+    return;
+  }
+
+  _entries.push_front({ key, millis(), ttlMs, bytes });
+  _index[key] = _entries.begin();
+  _bytes += bytes;
+  ++_stats.stores;
+  enforceLimits();
+  saveIndex();
+}
+
+void ResponseCache::erase(std::map<uint32_t, std::list<Entry>::iterator>::iterator it) {
+  _bytes -= it->second->bytes;
+  _fs.remove(entryPath(it->first));
+  _entries.erase(it->second);
+  _index.erase(it);
+}
+
+bool ResponseCache::enforceLimits() {
+  bool evicted = false;
+  while (!_entries.empty() && (_entries.size() > _maxEntries || _bytes > _maxBytes)) {
+    erase(_index.find(_entries.back().key));
+    ++_stats.evictions;
+    evicted = true;
+  }
+  return evicted;
+}
+
+void ResponseCache::clear() {
+  while (!_index.empty()) erase(_index.begin());
+  saveIndex();
+}
+
+float ResponseCache::hitRate() const {
+  uint32_t total = _stats.hits + _stats.misses;
+  return total ? (float)_stats.hits / total : 0.0f;
+}
+
+bool ResponseCache::saveIndex() {
+  // millis() は再起動でリセットされるので、残り TTL で保存する
+  unsigned long now = millis();
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
+  JsonArray entries = doc.to<JsonArray>();
+  for (const auto& entry : _entries) {
+    unsigned long age = now - entry.storedAt;
+    if (age > entry.ttlMs) continue;
+    JsonObject obj = entries.add<JsonObject>();
+    obj["key"] = entry.key;
+    obj["ttl"] = entry.ttlMs;
+    obj["left"] = entry.ttlMs - age;
+    obj["bytes"] = entry.bytes;
+  }
+
+  File file = _fs.open(indexPath(), FILE_WRITE);
+  if (!file) return false;
+  serializeJson(doc, file);
+  file.close();
+  return true;
+}
+
+bool ResponseCache::begin() {
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
+  File file = _fs.open(indexPath(), FILE_READ);
+  if (!file) return false;
+  DeserializationError error = deserializeJson(doc, file);
+  file.close();
+  if (error) return false;
+
+  // ファイルは新しい順に並んでいるので、古いものから積んで順序を保つ
+  unsigned long now = millis();
+  JsonArray entries = doc.as<JsonArray>();
+  for (int i = entries.size() - 1; i >= 0; --i) {
+    JsonObject obj = entries[i];
+    uint32_t key = obj["key"].as<uint32_t>();
+    unsigned long ttl = obj["ttl"] | 0UL;
+    unsigned long left = obj["left"] | 0UL;
+    if (left == 0 || left > ttl || !_fs.exists(entryPath(key))) continue;
+    _entries.push_front({ key, now - (ttl - left), ttl, obj["bytes"] | (size_t)0 });
+    _index[key] = _entries.begin();
+    _bytes += _entries.front().bytes;
+  }
+  enforceLimits();
+  Serial.printf("[ResponseCache] Loaded %u cached replies (%u bytes).\n",
+                (unsigned)_entries.size(), (unsigned)_bytes);
+  return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <list>
+#include <map>
+#include "LLMEngine.h"
+
+/**
+ * よくある発話（あいさつ・定番の質問）への返答のキャッシュ。
+ *   キーは正規化した発話・トピック・直近の履歴のダイジェストの組。
+ *   返答の本文は 1 件 1 ファイルで fs に置き、RAM には索引（キー・保存時刻・
+ *   TTL・大きさ）だけを持つ。件数とバイト数の上限を超えたら古いものから捨てる。
+ *
+ *   TTL はトピックごとに変えられ、0 にしたトピックはキャッシュを通さない
+ *   （天気や予定など、同じ質問でも答えが変わるもの向け）。
+ */
+class ResponseCache {
+public:
+  struct Stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t bypassed;   // トピックの設定でキャッシュを通さなかった回数
+    uint32_t stores;
+    uint32_t evictions;  // 上限を超えて捨てた件数
+    uint32_t expired;    // TTL 切れで捨てた件数
+  };
+
+  explicit ResponseCache(fs::FS& fs, const String& dir = "/spiffs");
+
+  // 保存済みの索引を読み込む（起動時に 1 回）
+  bool begin();
+
+  void setLimits(size_t maxEntries, size_t maxBytes);
+  void setDefaultTtl(unsigned long ttlMs) { _defaultTtlMs = ttlMs; }
+  void setTopicTtl(const String& topic, unsigned long ttlMs) { _topicTtlMs[topic] = ttlMs; }
+  // キーに含める直近の発話の数（0 なら文脈を見ない）
+  void setContextDepth(size_t messages) { _contextDepth = messages; }
+
+  bool bypasses(const String& topic);  // true ならこのトピックではキャッシュを使わない
+  uint32_t makeKey(const String& input, const String& topic, const ConversationHistory& history) const;
+  bool lookup(uint32_t key, LLMResponse& response);
+  void store(uint32_t key, const String& topic, const LLMResponse& response);
+  void clear();
+
+  const Stats& stats() const { return _stats; }
+  float hitRate() const;
+  size_t size() const { return _entries.size(); }
+  size_t bytes() const { return _bytes; }
+
+private:
+  struct Entry {
+    uint32_t key;
+    unsigned long storedAt;
+    unsigned long ttlMs;
+    size_t bytes;
+  };
+
+  fs::FS& _fs;
+  String _dir;
+  std::list<Entry> _entries;  // 先頭が最近使ったもの
+  std::map<uint32_t, std::list<Entry>::iterator> _index;
+  std::map<String, unsigned long> _topicTtlMs;
+  size_t _maxEntries = 64;
+  size_t _maxBytes = 32 * 1024;
+  size_t _bytes = 0;
+  size_t _contextDepth = 1;
+  unsigned long _defaultTtlMs = 7UL * 24 * 60 * 60 * 1000;
+  Stats _stats = {};
+
+  unsigned long ttlFor(const String& topic) const;
+  String entryPath(uint32_t key) const;
+  String indexPath() const;
+  void erase(std::map<uint32_t, std::list<Entry>::iterator>::iterator it);
+  bool enforceLimits();  // 捨てたものがあれば true
+  bool saveIndex();
+};
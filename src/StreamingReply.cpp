@@ -0,0 +1,219 @@
+#include "StreamingReply.h"
+
+bool readSseEvents(Stream& in,
+                   std::function<bool()> isOpen,
+                   SseDataHandler onData,
+                   unsigned long idleTimeoutMs) {
+  String line;
+  char buf[128];
+  unsigned long lastData = millis();
+
+  for (;;) {
+    int avail = in.available();
+    if (avail <= 0) {
+      if (!isOpen()) break;  // 接続が閉じられた
+      if (millis() - lastData > idleTimeoutMs) {
+        Serial.println("[SSE] Idle timeout.");
+        return false;
+      }
+      delay(1);
+      continue;
+    }
+
+    size_t n = in.readBytes(buf, min((size_t)avail, sizeof(buf)));
+    lastData = millis();
+
+    for (size_t i = 0; i < n; ++i) {
+      char c = buf[i];
+      if (c == '\r') continue;
+      if (c != '\n') {
+        line += c;
+        continue;
+      }
+
+      // 空行はイベントの区切り。data: 以外のフィールドは無視する
+      if (line.startsWith("data:")) {
+        String data = line.substring(5);
+        data.trim();
+        if (data == "[DONE]") return true;
+        if (!onData(data)) return false;
+      }
+      line = "";
+    }
+  }
+
+  // [DONE] なしで閉じられた場合も、最後の行は処理しておく
+  if (line.startsWith("data:")) {
+    String data = line.substring(5);
+    data.trim();
+    if (data == "[DONE]") return true;
+    onData(data);
+  }
+  return false;
+}
+
+StreamingReplyParser::StreamingReplyParser(SentenceCallback onSentence)
+  : _onSentence(onSentence) {}
+
+void StreamingReplyParser::feed(const char* delta) {
+  if (!delta) return;
+  _content += delta;
+  for (const char* p = delta; *p; ++p) {
+    feedChar(*p);
+  }
+}
+
+void StreamingReplyParser::finish() {
+  flushSentence();
+  _mode = Mode::Done;
+}
+
+void StreamingReplyParser::feedChar(char c) {
+  switch (_mode) {
+    case Mode::Detect:
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n') return;
+      if (c == '{') {
+        _mode = Mode::Json;
+        feedJson(c);
+      } else if (c == '`') {
+        _mode = Mode::Fence;  // ```json ... の行末までスキップ
+      } else {
+        _mode = Mode::Plain;
+        appendText(c);
+      }
+      break;
+
+    case Mode::Fence:
+      if (c == '\n') _mode = Mode::Detect;
+      break;
+
+    case Mode::Json:
+      feedJson(c);
+      break;
+
+    case Mode::Plain:
+      appendText(c);
+      break;
+
+    case Mode::Done:
+      break;
+  }
+}
+
+void StreamingReplyParser::feedJson(char c) {
+  switch (_jsonState) {
+    case JsonState::SeekKey:
+      if (c == '"') {
+        _key = "";
+        _jsonState = JsonState::InKey;
+      }
+      break;
+
+    case JsonState::InKey:
+      if (c == '"') {
+        _jsonState = (_key == "message") ? JsonState::SeekColon : JsonState::SeekKey;
+      } else {
+        _key += c;
+      }
+      break;
+
+    case JsonState::SeekColon:
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n') break;
+      _jsonState = (c == ':') ? JsonState::SeekValue : JsonState::SeekKey;
+      break;
+
+    case JsonState::SeekValue:
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n') break;
+      _jsonState = (c == '"') ? JsonState::InValue : JsonState::SeekKey;
+      break;
+
+    case JsonState::InValue:
+      if (c == '\\') {
+        _jsonState = JsonState::Escape;
+      } else if (c == '"') {
+        // message の値が閉じた。emotion などは最後にまとめて解析する
+        flushSentence();
+        _mode = Mode::Done;
+      } else {
+        appendText(c);
+      }
+      break;
+
+    case JsonState::Escape:
+      _jsonState = JsonState::InValue;
+      switch (c) {
+        case 'n': appendText('\n'); break;
+        case 't': appendText(' '); break;
+        case 'r': break;
+        case 'b': case 'f': break;
+        case 'u':
+          _unicode = "";
+          _jsonState = JsonState::Unicode;
+          break;
+        default: appendText(c); break;  // \" \\ \/
+      }
+      break;
+
+    case JsonState::Unicode: {
+      _unicode += c;
+      if (_unicode.length() < 4) break;
+      _jsonState = JsonState::InValue;
+      uint32_t cp = strtoul(_unicode.c_str(), nullptr, 16);
+      if (cp >= 0xD800 && cp <= 0xDBFF) {
+        _highSurrogate = cp;
+      } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+        if (_highSurrogate) {
+          appendCodepoint(0x10000 + ((_highSurrogate - 0xD800) << 10) + (cp - 0xDC00));
+        }
+        _highSurrogate = 0;
+      } else {
+        appendCodepoint(cp);
+      }
+      break;
+    }
+  }
+}
+
+void StreamingReplyParser::appendCodepoint(uint32_t cp) {
+  if (cp < 0x80) {
+    appendText((char)cp);
+  } else if (cp < 0x800) {
+    appendText((char)(0xC0 | (cp >> 6)));
+    appendText((char)(0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    appendText((char)(0xE0 | (cp >> 12)));
+    appendText((char)(0x80 | ((cp >> 6) & 0x3F)));
+    appendText((char)(0x80 | (cp & 0x3F)));
+  } else {
+    appendText((char)(0xF0 | (cp >> 18)));
+    appendText((char)(0x80 | ((cp >> 12) & 0x3F)));
+    appendText((char)(0x80 | ((cp >> 6) & 0x3F)));
+    appendText((char)(0x80 | (cp & 0x3F)));
+  }
+}
+
+void StreamingReplyParser::appendText(char c) {
+  if (c == '\n') {
+    flushSentence();
+    return;
+  }
+
+  _sentence += c;
+
+  // 文末記号: ! ? 。(E3 80 82) ！(EF BC 81) ？(EF BC 9F)
+  if (c == '!' || c == '?') {
+    flushSentence();
+  } else if (_sentence.endsWith("。") || _sentence.endsWith("！") || _sentence.endsWith("？")) {
+    flushSentence();
+  }
+}
+
+void StreamingReplyParser::flushSentence() {
+  String sentence = _sentence;
+  _sentence = "";
+  sentence.trim();
+  if (sentence.isEmpty()) return;
+
+  ++_sentenceCount;
+  if (_onSentence) _onSentence(sentence);
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <Arduino.h>
+#include <functional>
+
+/**
+ * Server-Sent Events (SSE) reader.
+ *   "data: ..." 行を取り出して onData に渡す。"data: [DONE]" で終了。
+ *   isOpen が false を返し、かつ読み出すデータが無くなった時点でも終了する。
+ *   onData が false を返すと読み出しを中断する。
+ */
+using SseDataHandler = std::function<bool(const String& data)>;
+bool readSseEvents(Stream& in,
+                   std::function<bool()> isOpen,
+                   SseDataHandler onData,
+                   unsigned long idleTimeoutMs = 15000);
+
+/**
+ * ストリーミングで届く LLM の返答から、文単位でテキストを取り出す。
+ *   返答が {"message": "...", "emotion": "..."} 形式（```json フェンス付きも可）
+ *   なら message の値だけを、そうでなければ本文全体を対象にする。
+ *   「。」「！」「？」や改行で文が終わるたびに onSentence を呼ぶ。
+ */
+class StreamingReplyParser {
+public:
+  using SentenceCallback = std::function<void(const String&)>;
+
+  explicit StreamingReplyParser(SentenceCallback onSentence);
+
+  void feed(const char* delta);
+  void finish();  // 残りのテキストを最後の文として渡す
+
+  const String& content() const { return _content; }  // 受信した本文全体
+  size_t sentenceCount() const { return _sentenceCount; }
+
+private:
+  enum class Mode { Detect, Fence, Json, Plain, Done };
+  enum class JsonState { SeekKey, InKey, SeekColon, SeekValue, InValue, Escape, Unicode };
+
+  SentenceCallback _onSentence;
+  String _content;
+  String _sentence;
+  String _key;
+  String _unicode;
+  uint32_t _highSurrogate = 0;
+  Mode _mode = Mode::Detect;
+  JsonState _jsonState = JsonState::SeekKey;
+  size_t _sentenceCount = 0;
+
+  void feedChar(char c);
+  void feedJson(char c);
+  void appendText(char c);
+  void appendCodepoint(uint32_t cp);
+  void flushSentence();
+};
@@ -0,0 +1,82 @@
+#include "StringBuilder.h"
+
+StringBuilder::StringBuilder(size_t capacity, ArduinoJson::Allocator* allocator)
+  : _allocator(allocator) {
+  reserve(capacity);
+}
+
+StringBuilder::~StringBuilder() {
+  if (_buffer) _allocator->deallocate(_buffer);
+}
+
+bool StringBuilder::reserve(size_t length) {
+  if (length + 1 <= _capacity) return true;
+  size_t capacity = _capacity ? _capacity : 32;
+  while (capacity < length + 1) capacity *= 2;
+
+  // アリーナでは最後に切り出したブロックならその場で伸びる
+  char* grown = (char*)(_buffer ? _allocator->reallocate(_buffer, capacity)
+                                : _allocator->allocate(capacity));
+  if (!grown) {
+    _failed = true;
+    return false;
+  }
+  if (!_buffer) grown[0] = '\0';
+  _buffer = grown;
+  _capacity = capacity;
+  return true;
+}
+
+StringBuilder& StringBuilder::append(const char* text, size_t length) {
+  if (length == 0) return *this;
+  if (!reserve(_length + length)) {
+    // 入るところまでで止める
+    if (_capacity <= _length + 1) return *this;
+    length = _capacity - 1 - _length;
+  }
+  memcpy(_buffer + _length, text, length);
+  _length += length;
+  _buffer[_length] = '\0';
+  return *this;
+}
+
+StringBuilder& StringBuilder::operator<<(int value) {
+  char digits[12];
+  int n = snprintf(digits, sizeof(digits), "%d", value);
+  return append(digits, n);
+}
+
+StringBuilder& StringBuilder::operator<<(unsigned value) {
+  char digits[12];
+  int n = snprintf(digits, sizeof(digits), "%u", value);
+  return append(digits, n);
+}
+
+StringBuilder& StringBuilder::operator<<(long value) {
+  char digits[21];
+  int n = snprintf(digits, sizeof(digits), "%ld", value);
+  return append(digits, n);
+}
+
+StringBuilder& StringBuilder::operator<<(unsigned long value) {
+  char digits[21];
+  int n = snprintf(digits, sizeof(digits), "%lu", value);
+  return append(digits, n);
+}
+
+String StringBuilder::toString() const {
+  String out;
+  appendTo(out);
+  return out;
+}
+
+void StringBuilder::appendTo(String& out) const {
+  if (_length == 0) return;
+  out.reserve(out.length() + _length);
+  out.concat(_buffer, _length);
+}
+
+void StringBuilder::clear() {
+  _length = 0;
+  if (_buffer) _buffer[0] = '\0';
+}
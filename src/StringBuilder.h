@@ -0,0 +1,57 @@
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "FixedString.h"
+#include "JsonArena.h"
+
+/**
+ * プロンプトやヘッダーを組み立てるための文字列ビルダー。
+ *   String の + を重ねると、そのたびに一時オブジェクトと再確保が起きる。
+ *   こちらは 1 つのバッファに追記していき、足りなくなったら倍に伸ばす。
+ *   既定ではバッファを JsonArena から取るので、JsonArena::Turn の中で使えば
+ *   ヒープには触らない（Turn の外ではふつうのヒープになる）。
+ *
+ *     JsonArena::Turn turn;
+ *     StringBuilder prompt;
+ *     prompt << "候補：" << intents[0] << "、" << intents[1];
+ *     doc["content"] = prompt.c_str();
+ *
+ *   ビルダーはその Turn より長く生かさないこと。
+ */
+class StringBuilder {
+public:
+  explicit StringBuilder(size_t capacity = 128,
+                         ArduinoJson::Allocator* allocator = &JsonArena::instance());
+  ~StringBuilder();
+  StringBuilder(const StringBuilder&) = delete;
+  StringBuilder& operator=(const StringBuilder&) = delete;
+
+  StringBuilder& append(const char* text, size_t length);
+  StringBuilder& operator<<(const char* text) { return append(text, text ? strlen(text) : 0); }
+  StringBuilder& operator<<(const String& text) { return append(text.c_str(), text.length()); }
+  template <size_t N>
+  StringBuilder& operator<<(const FixedString<N>& text) { return append(text.c_str(), text.length()); }
+  StringBuilder& operator<<(char c) { return append(&c, 1); }
+  StringBuilder& operator<<(int value);
+  StringBuilder& operator<<(unsigned value);
+  StringBuilder& operator<<(long value);
+  StringBuilder& operator<<(unsigned long value);
+
+  const char* c_str() const { return _buffer ? _buffer : ""; }
+  size_t length() const { return _length; }
+  bool isEmpty() const { return _length == 0; }
+  bool ok() const { return !_failed; }  // 確保に失敗して途中で切れていない
+
+  String toString() const;        // String の API に渡すとき（1 回だけ確保する）
+  void appendTo(String& out) const;
+  void clear();
+
+private:
+  ArduinoJson::Allocator* _allocator;
+  char* _buffer = nullptr;
+  size_t _capacity = 0;
+  size_t _length = 0;
+  bool _failed = false;
+
+  bool reserve(size_t length);
+};
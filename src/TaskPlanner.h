@@ -21,6 +21,16 @@ public:
     return t;
   }
 
+  void resetTiming() override {}
+
+  unsigned long nextWakeMs(unsigned long now) const override {
+    // 話題があるか、まだ確認していない予定があるうちはすぐ起こしてもらう
+    if (hasTopic() || (_taskDueSoon && !_alreadyAsked)) return now;
+    return now + 60000;
+  }
+
+  int priority() const override { return PriorityUrgent; }
+
 private:
   bool _taskDueSoon = true;  // デモ用
   bool _alreadyAsked = false;
@@ -0,0 +1,110 @@
+#include "TextUtils.h"
+
+size_t decodeUtf8(const char* p, uint32_t& codepoint) {
+  const uint8_t* s = (const uint8_t*)p;
+  if (!*s) return 0;
+
+  int extra;
+  if (*s < 0x80)            { codepoint = *s; extra = 0; }
+  else if ((*s >> 5) == 6)  { codepoint = *s & 0x1F; extra = 1; }
+  else if ((*s >> 4) == 14) { codepoint = *s & 0x0F; extra = 2; }
+  else if ((*s >> 3) == 30) { codepoint = *s & 0x07; extra = 3; }
+  else { codepoint = 0xFFFD; return 1; }  // 不正なバイト
+
+  size_t used = 1;
+  for (int i = 0; i < extra; ++i, ++used) {
+    if ((s[used] & 0xC0) != 0x80) {
+      codepoint = 0xFFFD;
+      return used;
+    }
+    codepoint = (codepoint << 6) | (s[used] & 0x3F);
+  }
+  return used;
+}
+
+bool isIgnorableCodepoint(uint32_t cp) {
+  if (cp < 0x80) {
+    return !isalnum((int)cp);
+  }
+  switch (cp) {
+    case 0xFFFD:                              // 不正なバイト
+    case 0x3000:                              // 全角スペース
+    case 0x3001: case 0x3002:                 // 、。
+    case 0x300C: case 0x300D:                 // 「」
+    case 0x30FC:                              // ー
+    case 0xFF01: case 0xFF1F: case 0xFF5E:    // ！？～
+    case 0x301C:                              // 〜
+      return true;
+  }
+  return false;
+}
+
+String normalizeUtterance(const String& text) {
+  String out;
+  out.reserve(text.length());
+
+  const char* p = text.c_str();
+  uint32_t cp;
+  size_t n;
+  while ((n = decodeUtf8(p, cp)) > 0) {
+    if (!isIgnorableCodepoint(cp)) {
+      if (cp < 0x80) {
+        out += (char)tolower((int)cp);
+      } else {
+        out.concat(p, n);
+      }
+    }
+    p += n;
+  }
+  return out;
+}
+
+uint32_t fnv1a32(const void* data, size_t length, uint32_t seed) {
+  const uint8_t* p = (const uint8_t*)data;
+  uint32_t h = seed;
+  for (size_t i = 0; i < length; ++i) {
+    h ^= p[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+void appendJsonString(String& out, const String& text) {
+  appendJsonString(out, text.c_str(), text.length());
+}
+
+void appendJsonString(String& out, const char* text, size_t length) {
+  // ArduinoJson の serializeJson と同じエスケープ（非 ASCII はそのまま）
+  out.reserve(out.length() + length + 2);
+  out += '"';
+  const char* p = text;
+  const char* end = text + length;
+  const char* run = p;  // エスケープ不要な区間はまとめて追記する
+  for (; p != end; ++p) {
+    unsigned char c = (unsigned char)*p;
+    const char* escaped = nullptr;
+    char unicode[7];
+    switch (c) {
+      case '"':  escaped = "\\\""; break;
+      case '\\': escaped = "\\\\"; break;
+      case '\b': escaped = "\\b"; break;
+      case '\f': escaped = "\\f"; break;
+      case '\n': escaped = "\\n"; break;
+      case '\r': escaped = "\\r"; break;
+      case '\t': escaped = "\\t"; break;
+      default:
+        if (c < 0x20) {
+          snprintf(unicode, sizeof(unicode), "\\u%04x", c);
+          escaped = unicode;
+        }
+        break;
+    }
+    if (escaped) {
+      out.concat(run, p - run);
+      out += escaped;
+      run = p + 1;
+    }
+  }
+  out.concat(run, p - run);
+  out += '"';
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <Arduino.h>
+
+// UTF-8 を 1 コードポイント読み出す。戻り値は消費したバイト数（終端なら 0）
+size_t decodeUtf8(const char* p, uint32_t& codepoint);
+
+// 分類やキャッシュのキーに効かない空白・記号か
+bool isIgnorableCodepoint(uint32_t codepoint);
+
+// 空白・記号を除き、英字を小文字にした発話（キャッシュキー用）
+String normalizeUtterance(const String& text);
+
+// 32bit FNV-1a。seed に前回の値を渡すと続きから計算できる
+uint32_t fnv1a32(const void* data, size_t length, uint32_t seed = 2166136261u);
+
+// JSON 文字列として out に追記する（前後の " も付ける）
+void appendJsonString(String& out, const String& text);
+void appendJsonString(String& out, const char* text, size_t length);
@@ -1,8 +1,13 @@
 #include "ThoughtPlanner.h"
 #include "LLMEngine.h" // LLM問い合わせのため
+#include "LogConfig.h"
+#include "LLMWorker.h"
+#include "JsonArena.h"
+#include "StringBuilder.h"
+#include "MemoryAccounting.h"
+#include "SDUtils.h"
 #include <Arduino.h>
 #include <vector>
-#include <map>
 #include <algorithm>
 
 
@@ -17,21 +22,42 @@ ThoughtPlanner::ThoughtPlanner(LLMEngine* engine) : llmEngine(engine) {
 }
 
 void ThoughtPlanner::tick() {
+  bool taken = false;
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    taken = tickLocked();
+  }
+  if (taken) savePool();  // SD への書き込みで割り込みを待たせないよう、ロックの外で
+}
+
+bool ThoughtPlanner::tickLocked() {
   unsigned long now = millis();
+  bool taken = false;
 
   switch (state) {
     case State::Idle:
       if (now - lastTrigger > intervalMs) {
-        Serial.println("[ThoughtPlanner] Triggering LLM request...");
         lastTrigger = now;
-        state = State::Waiting;
-        requestLLM();
+        String text;
+        taken = takeCandidate(text);
+        if (taken) {
+          // 作り置きの候補があれば待たずに話す
+          Serial.println("[ThoughtPlanner] Serving prefetched topic.");
+          speak(text);
+        } else {
+          Serial.println("[ThoughtPlanner] Pool is empty, waiting for refill...");
+          state = State::Waiting;
+          if (!refilling) refillPool();
+        }
+      }
+      if (state == State::Idle && !refilling && refillDueAt(now) == now) {
+        refillPool();
       }
       break;
 
     case State::Waiting:
-      // LLM応答待ち（非同期）
-      Serial.println("[ThoughtPlanner] Waiting for LLM response...");
+      // 補充待ち（ワーカーで処理中。届くと onBatchResponse で Ready になる）
+      THINK_LOG_DEBUG("[ThoughtPlanner] Waiting for LLM response...\n");
       break;
 
     case State::Ready:
@@ -44,9 +70,11 @@ void ThoughtPlanner::tick() {
       Serial.println("[ThoughtPlanner] Prompting state, should not happen.");
       break;
   }
+  return taken;
 }
 
 bool ThoughtPlanner::hasTopic() const {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (state == State::Ready) {
     Serial.println("[ThoughtPlanner] Topic is ready.");
   }
@@ -54,91 +82,304 @@ bool ThoughtPlanner::hasTopic() const {
 }
 
 PlannedTopic ThoughtPlanner::getTopic() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   Serial.println("[ThoughtPlanner] Returning topic: " + currentTopic.text);
   state = State::Idle;
   return currentTopic;
 }
 
-void ThoughtPlanner::requestLLM() {
-  String prompt = buildPrompt();
-  Serial.println("[ThoughtPlanner] Sending prompt to LLM:");
-  Serial.println(prompt);
-
-  LLMEngine* engine = llmEngine;
-  engine->generate(prompt, [this](const LLMResponse& response) {
-    if (this) {  // 明示的にチェック（ただし無意味なケースもある）
-      this->onLLMResponse(response.message);
+unsigned long ThoughtPlanner::nextWakeMs(unsigned long now) const {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  switch (state) {
+    case State::Idle: {
+      unsigned long speakAt = lastTrigger + intervalMs + 1;
+      unsigned long refillAt = refillDueAt(now);
+      return (long)(refillAt - speakAt) < 0 ? refillAt : speakAt;
     }
-  });
+    case State::Waiting:
+      return now + 500;  // 返答はワーカーから届くので、ときどき見に行く
+    default:
+      return now;
+  }
+}
+
+void ThoughtPlanner::cancel() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  if (state == State::Waiting) {
+    Serial.println("[ThoughtPlanner] Cancelling pending LLM request.");
+  }
+  pendingCancel.cancel();  // 補充中なら打ち切る（プールの残りはそのまま）
+  state = State::Idle;
+  lastTrigger = millis();  // 割り込み直後にまた話し始めないように
+}
+
+void ThoughtPlanner::resetTiming() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  lastTrigger = millis();
+}
+
+// ---- 候補のプール ----
+
+// 補充に失敗したら、この間隔を空けてから再試行する
+static const unsigned long kRefillRetryMs = 60000;
+
+void ThoughtPlanner::setPoolSize(size_t batch, size_t low) {
+  batchSize = batch > 0 ? batch : 1;
+  lowWater = low;
+}
+
+size_t ThoughtPlanner::poolSize() const {
+  return freshCount(millis());
+}
+
+size_t ThoughtPlanner::freshCount(unsigned long now) const {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  size_t count = 0;
+  for (const auto& c : pool) {
+    if (now - c.storedAt <= candidateTtlMs) ++count;
+  }
+  return count;
+}
+
+unsigned long ThoughtPlanner::refillDueAt(unsigned long now) const {
+  if (refilling || freshCount(now) >= lowWater) {
+    return now + intervalMs;  // 補充は不要。次の発話のときに見直す
+  }
+  if (refilledOnce && now - lastRefill < kRefillRetryMs) {
+    return lastRefill + kRefillRetryMs;
+  }
+  return now;
+}
+
+bool ThoughtPlanner::takeCandidate(String& text) {
+  unsigned long now = millis();
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  // 古くなった候補（最近の話題に触れたものなど）は捨てる
+  while (!pool.empty() && now - pool.front().storedAt > candidateTtlMs) {
+    pool.pop_front();
+  }
+  if (pool.empty()) {
+    accountPool();
+    return false;
+  }
+  text = pool.front().text;
+  pool.pop_front();
+  accountPool();
+  return true;
+}
+
+void ThoughtPlanner::accountPool() {
+  size_t bytes = 0;
+  for (const auto& c : pool) bytes += c.text.length() + sizeof(Candidate);
+  MemoryAccounting::instance().resized(MemoryAccounting::Planner, poolBytes, bytes);
+  poolBytes = bytes;
 }
 
-void ThoughtPlanner::onLLMResponse(const String& response) {
-  Serial.println("[ThoughtPlanner] Received response from LLM:");
-  Serial.println(response);
-  
-  currentTopic.text = response;
+void ThoughtPlanner::speak(const String& text) {
+  Serial.println("[ThoughtPlanner] Topic: " + text);
+  currentTopic.text = text;
   currentTopic.intent = IntentType::Chat;
   state = State::Ready;
 }
 
-String ThoughtPlanner::buildPrompt() {
-  int mode = random(0, 4); // 0〜3の4パターンからランダム
-  String suffixPrompt = "\n前後の説明は不要で、スタックチャンが自然に独り言を言うようにしてください。ポエムっぽいものはいらないです。どちらかというと豆知識的な。1度に話すのは１つのトピックでいいですよ。";
-  String prompt = "スタックチャンが自然につぶやくとしたら、どんな独り言を言うでしょう？";
+void ThoughtPlanner::refillPool() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  refilling = true;
+  lastRefill = millis();
+  refilledOnce = true;
+
+  std::vector<Message> messages;
+  messages.push_back(Message{"user", buildBatchPrompt()});
+  Serial.printf("[ThoughtPlanner] Requesting %u topic candidates...\n", (unsigned)batchSize);
+
+  CancelToken cancel;
+  pendingCancel = cancel;
+  LLMEngine* engine = llmEngine;
+  pendingRequest = LLMWorker::shared().submit([engine, messages, cancel](LLMResponse& response) {
+    response = engine->generate(messages, false, cancel);
+    return !response.message.isEmpty();
+  }, [this, cancel](const LLMResponse& response) {
+    onBatchResponse(cancel, response);
+  });
+  if (!pendingRequest) {
+    Serial.println("[ThoughtPlanner] LLM worker is busy, retry later.");
+    refilling = false;
+    if (state == State::Waiting) state = State::Idle;
+  }
+}
+
+void ThoughtPlanner::onBatchResponse(const CancelToken& cancel, const LLMResponse& response) {
+  std::vector<String> candidates;
+  if (!cancel.cancelled()) candidates = parseCandidates(response.message);
+
+  bool changed = false;
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    refilling = false;
+    // 割り込まれた後の返答は使わない（cancel() と同じロックの中で見る）
+    if (cancel.cancelled()) return;
+
+    Serial.printf("[ThoughtPlanner] Received %u topic candidates.\n", (unsigned)candidates.size());
+    unsigned long now = millis();
+    for (const auto& text : candidates) {
+      pool.push_back(Candidate{text, now});
+    }
+    accountPool();
+    changed = !candidates.empty();
+
+    if (state == State::Waiting) {
+      String text;
+      if (takeCandidate(text)) {
+        speak(text);
+        changed = true;
+      } else {
+        state = State::Idle;
+      }
+    }
+  }
+  if (changed) savePool();
+}
+
+std::vector<String> ThoughtPlanner::parseCandidates(String content) {
+  content.trim();
+  // JSON コードブロックを除去
+  if (content.startsWith("```")) {
+    int start = content.indexOf('\n');
+    int end = content.lastIndexOf("```");
+    if (start != -1 && end > start) content = content.substring(start + 1, end);
+  }
+
+  std::vector<String> candidates;
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
+  if (!deserializeJson(doc, content) && doc.is<JsonArray>()) {
+    for (JsonVariant v : doc.as<JsonArray>()) {
+      String text = v.as<String>();
+      text.trim();
+      if (!text.isEmpty()) candidates.push_back(text);
+    }
+    return candidates;
+  }
 
-  switch (mode) {
-    case 0: // 最近の話題に触れる
-    {
-      String recent = getRecentPhrases();
-      prompt = "最近話したこと: " + recent + "\nそのことについてスタックチャンがつぶやくとしたら？";
+  // 配列で返ってこなかったときは 1 行 1 候補とみなす（"1. " や "- " は外す）
+  int from = 0;
+  while (from < (int)content.length()) {
+    int nl = content.indexOf('\n', from);
+    if (nl < 0) nl = content.length();
+    String line = content.substring(from, nl);
+    from = nl + 1;
+    line.trim();
+    int i = 0;
+    while (i < (int)line.length() && (isdigit(line[i]) || line[i] == '.' || line[i] == '-' ||
+                                      line[i] == ')' || line[i] == ' ')) {
+      ++i;
     }
-    case 1: // 関係ない話をふと思いつく
-      prompt = "スタックチャンが、突然思いついたことを独り言のようにつぶやいてください。";
-    case 2: // 面白い雑談ネタ
-      prompt = "スタックチャンが、話題としてふさわしい雑談ネタを自然に言ってください。";
-    case 3: // ちょっと謎めいたことをつぶやく
-      prompt = "スタックチャンが、意味があるようでないような、ちょっと不思議なことを自然に言ってください。";
+    line = line.substring(i);
+    if (!line.isEmpty()) candidates.push_back(line);
   }
+  return candidates;
+}
 
-  return prompt + suffixPrompt;
+void ThoughtPlanner::enablePoolPersistence(const String& path) {
+  poolPath = path;
+  if (!poolPath.isEmpty()) loadPool();
 }
 
-String ThoughtPlanner::getRecentPhrases() {
-  auto history = llmEngine->getHistory();
+bool ThoughtPlanner::savePool() {
+  if (poolPath.isEmpty()) return false;
 
-  std::map<String, std::vector<String>> topicMap;
-  for (const auto& entry : history) {
-    if (entry.first == "user" || entry.first == "assistant") {
-      String topic = classifyTopic(entry.second); // キーワード分類
-      topicMap[topic].push_back(entry.second);
+  // millis() は再起動でリセットされるので、残り TTL で保存する
+  unsigned long now = millis();
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
+  JsonArray entries = doc.to<JsonArray>();
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    for (const auto& c : pool) {
+      unsigned long age = now - c.storedAt;
+      if (age > candidateTtlMs) continue;
+      JsonObject obj = entries.add<JsonObject>();
+      obj["text"] = c.text;
+      obj["ttl"] = candidateTtlMs - age;
     }
   }
+  return writeJsonToSD(poolPath.c_str(), doc);
+}
 
-  if (topicMap.empty()) return "";
+void ThoughtPlanner::loadPool() {
+  JsonArena::Turn turn;
+  JsonDocument doc(&JsonArena::instance());
+  if (!readJsonFromSD(poolPath.c_str(), doc)) return;
 
-  std::vector<String> topics;
-  for (const auto& pair : topicMap) {
-    topics.push_back(pair.first);
+  unsigned long now = millis();
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  pool.clear();
+  for (JsonObject obj : doc.as<JsonArray>()) {
+    unsigned long ttl = obj["ttl"] | 0UL;
+    if (ttl == 0 || ttl > candidateTtlMs) continue;
+    pool.push_back(Candidate{obj["text"].as<String>(), now - (candidateTtlMs - ttl)});
   }
+  accountPool();
+  Serial.printf("[ThoughtPlanner] Loaded %u prefetched topics.\n", (unsigned)pool.size());
+}
+
+String ThoughtPlanner::buildBatchPrompt() {
+  JsonArena::Turn turn;  // 組み立て中のバッファはアリーナから取る
+  StringBuilder prompt(768);
+  prompt << "スタックチャンが自然につぶやく独り言を" << (unsigned)batchSize << "個考えてください。\n"
+            "突然思いついたこと、雑談ネタ、ちょっと不思議なことを混ぜてください。";
+  appendRecentPhrases(prompt);
+  prompt << "\n前後の説明は不要で、スタックチャンが自然に独り言を言うようにしてください。"
+            "ポエムっぽいものはいらないです。どちらかというと豆知識的な。1つの独り言で話すのは1つのトピックでいいですよ。"
+            "\n返答は独り言の文字列だけを並べた JSON 配列にしてください。";
+  return prompt.toString();
+}
 
-  String selectedTopic = topics[random(topics.size())];
-  const auto& phrases = topicMap[selectedTopic];
+static const char* const kTopicNames[] = { "天気", "学校", "遊び", "その他" };
+static const size_t kTopicCount = sizeof(kTopicNames) / sizeof(kTopicNames[0]);
 
-  String result;
-  for (int i = 0; i < min(2, (int)phrases.size()); ++i) {
-    String phrase = phrases[random(phrases.size())];
-    result += "「" + phrase + "」";
+void ThoughtPlanner::appendRecentPhrases(StringBuilder& prompt) {
+  // 要約やワーカーの返答が履歴を書き換えないよう、読み終えるまでロックを持つ
+  LLMEngine::HistoryView view = llmEngine->getHistory();
+  const ConversationHistory& history = *view;
+
+  // 発話は写さず、履歴の位置だけをキーワードの分類ごとに集める
+  std::vector<size_t> byTopic[kTopicCount];
+  size_t present = 0;
+  for (size_t i = 0; i < history.size(); ++i) {
+    const Message& entry = history.at(i);
+    if (entry.role == "user" || entry.role == "assistant") {
+      std::vector<size_t>& indices = byTopic[classifyTopic(entry.content)];
+      if (indices.empty()) ++present;
+      indices.push_back(i);
+    }
   }
 
-  Serial.printf("[ThoughtPlanner] Selected topic: %s\n", selectedTopic.c_str());
-  Serial.println("[ThoughtPlanner] Sampled phrases: " + result);
+  if (present == 0) return;
 
-  return result;
+  // 話題のあった分類から 1 つ選ぶ
+  size_t pick = random(present);
+  size_t selected = 0;
+  for (; selected < kTopicCount; ++selected) {
+    if (byTopic[selected].empty()) continue;
+    if (pick == 0) break;
+    --pick;
+  }
+  const std::vector<size_t>& phrases = byTopic[selected];
+
+  prompt << "\n最近話したこと: ";
+  size_t sampledFrom = prompt.length();
+  for (int i = 0; i < min(2, (int)phrases.size()); ++i) {
+    prompt << "「" << history.at(phrases[random(phrases.size())]).content << "」";
+  }
+  Serial.printf("[ThoughtPlanner] Selected topic: %s\n", kTopicNames[selected]);
+  Serial.printf("[ThoughtPlanner] Sampled phrases: %s\n", prompt.c_str() + sampledFrom);
+  prompt << "\nそのことに触れたものを1つ入れてもいいです。";
 }
 
-String ThoughtPlanner::classifyTopic(const String& content) {
-  if (content.indexOf("晴") >= 0 || content.indexOf("雨") >= 0) return "天気";
-  if (content.indexOf("宿題") >= 0 || content.indexOf("学校") >= 0) return "学校";
-  if (content.indexOf("ゲーム") >= 0 || content.indexOf("遊") >= 0) return "遊び";
-  return "その他";
-}
\ No newline at end of file
+size_t ThoughtPlanner::classifyTopic(const String& content) {
+  if (content.indexOf("晴") >= 0 || content.indexOf("雨") >= 0) return 0;
+  if (content.indexOf("宿題") >= 0 || content.indexOf("学校") >= 0) return 1;
+  if (content.indexOf("ゲーム") >= 0 || content.indexOf("遊") >= 0) return 2;
+  return 3;
+}
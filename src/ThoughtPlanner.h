@@ -2,6 +2,10 @@
 #include "IPlanner.h"
 #include "LLMEngine.h"  // ← これを追加
 #include <vector>
+#include <deque>
+#include <mutex>
+
+class StringBuilder;
 
 class ThoughtPlanner : public IPlanner {
 public:
@@ -10,8 +14,23 @@ public:
   void tick() override;
   bool hasTopic() const override;
   PlannedTopic getTopic() override;
+  void cancel() override;
+  unsigned long nextWakeMs(unsigned long now) const override;
+  int priority() const override { return PriorityIdle; }
+
+  // 独り言の候補は 1 回の問い合わせで batch 個まとめて作り、プールに置いておく。
+  // 残りが lowWater を下回ったらアイドル中に補充する
+  void setPoolSize(size_t batch, size_t lowWater);
+  void setCandidateTtl(unsigned long ttlMs) { candidateTtlMs = ttlMs; }
+  size_t poolSize() const;
+
+  // path を指定するとプールを保存し、再起動後も読み込む（空文字で無効）
+  void enablePoolPersistence(const String& path);
+  bool savePool();
 
 private:
+  friend class ThoughtPlannerBench;  // examples/bench からプロンプトの組み立てを測る
+
   enum State {
     Idle,
     Prompting,
@@ -19,19 +38,46 @@ private:
     Ready
   };
 
-  volatile State state = State::Idle;
+  // state / lastTrigger / pendingCancel / refilling / pool は mutex で守る。
+  // 割り込み（cancel）はループのタスク、補充の返答はワーカーのタスクから届く
+  mutable std::recursive_mutex mutex;
+  State state = State::Idle;
   unsigned long lastTrigger = 0;
   unsigned long intervalMs = 600000;
   PlannedTopic currentTopic;
   LLMEngine* llmEngine; // LLMエンジンインスタンス
+  LLMHandle pendingRequest;  // 補充の問い合わせのハンドル
+  CancelToken pendingCancel;
+
+  struct Candidate {
+    String text;
+    unsigned long storedAt;
+  };
+  std::deque<Candidate> pool;
+  size_t poolBytes = 0;          // MemoryAccounting の Planner に計上済みの分
+  size_t batchSize = 5;
+  size_t lowWater = 2;
+  unsigned long candidateTtlMs = 6UL * 60 * 60 * 1000;
+  unsigned long lastRefill = 0;
+  bool refilledOnce = false;
+  bool refilling = false;
+  String poolPath;
 
-  void requestLLM(); // LLMにプロンプト送信
-  void onLLMResponse(const String& response); // コールバック
+  bool tickLocked();  // 候補をプールから取ったら true（保存はロックの外で）
+  bool takeCandidate(String& text);
+  void accountPool();  // mutex を持った状態で呼ぶ
+  size_t freshCount(unsigned long now) const;
+  unsigned long refillDueAt(unsigned long now) const;
+  void refillPool(); // LLMにまとめて候補を作らせる
+  void onBatchResponse(const CancelToken& cancel, const LLMResponse& response); // コールバック
+  void speak(const String& text);
+  void loadPool();
 
   std::vector<String> promptTemplates;
 
-  String buildPrompt();
-  String getRecentPhrases();
-  String classifyTopic(const String& content);
-  void resetTiming() override { lastTrigger = millis(); }
+  String buildBatchPrompt();
+  void appendRecentPhrases(StringBuilder& prompt);  // 最近の話題を 1 つ選んでプロンプトに足す
+  static std::vector<String> parseCandidates(String content);
+  static size_t classifyTopic(const String& content);  // キーワード分類（kTopicNames の添字）
+  void resetTiming() override;
 };
@@ -0,0 +1,133 @@
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/**
+ * ツール（function calling）の引数を構造体 1 つで記述するための仕組み。
+ *   構造体に visit() を書くと、そこから JSON スキーマと、引数を型付きで
+ *   取り出すデコーダーの両方が作られる。
+ *
+ *   struct SetAlarmArgs {
+ *     int hour = 0;
+ *     int minute = 0;
+ *     String label;
+ *     template <typename V> void visit(V& v) {
+ *       v.field("hour", hour, "時 (0-23)");
+ *       v.field("minute", minute, "分 (0-59)");
+ *       v.optional("label", label, "アラームの名前");
+ *     }
+ *   };
+ *
+ *   使える型は bool / int / long / unsigned / float / double / String。
+ */
+namespace toolargs {
+
+inline const char* jsonType(const bool&) { return "boolean"; }
+inline const char* jsonType(const int&) { return "integer"; }
+inline const char* jsonType(const long&) { return "integer"; }
+inline const char* jsonType(const unsigned&) { return "integer"; }
+inline const char* jsonType(const float&) { return "number"; }
+inline const char* jsonType(const double&) { return "number"; }
+inline const char* jsonType(const String&) { return "string"; }
+
+template <typename T>
+bool decodeValue(JsonVariantConst value, T& out) {
+  if (!value.is<T>()) return false;
+  out = value.as<T>();
+  return true;
+}
+
+inline bool decodeValue(JsonVariantConst value, String& out) {
+  if (!value.is<const char*>()) return false;
+  out = value.as<const char*>();
+  return true;
+}
+
+// visit() から parameters のスキーマを書き出す
+class SchemaWriter {
+public:
+  explicit SchemaWriter(JsonObject schema) {
+    schema["type"] = "object";
+    _properties = schema["properties"].to<JsonObject>();
+    _required = schema["required"].to<JsonArray>();
+  }
+
+  template <typename T>
+  void field(const char* name, T& value, const char* description) {
+    property(name, value, description);
+    _required.add(name);
+  }
+
+  template <typename T>
+  void optional(const char* name, T& value, const char* description) {
+    property(name, value, description);
+  }
+
+private:
+  JsonObject _properties;
+  JsonArray _required;
+
+  template <typename T>
+  void property(const char* name, const T& value, const char* description) {
+    JsonObject prop = _properties[name].to<JsonObject>();
+    prop["type"] = jsonType(value);
+    if (description && *description) prop["description"] = description;
+  }
+};
+
+// visit() の順に引数を取り出す。最初に見つかった誤りだけを覚えておく
+class Decoder {
+public:
+  explicit Decoder(JsonObjectConst args) : _args(args) {}
+
+  template <typename T>
+  void field(const char* name, T& value, const char*) {
+    read(name, value, true);
+  }
+
+  template <typename T>
+  void optional(const char* name, T& value, const char*) {
+    read(name, value, false);
+  }
+
+  bool ok() const { return _error.isEmpty(); }
+  const String& error() const { return _error; }
+
+private:
+  JsonObjectConst _args;
+  String _error;
+
+  template <typename T>
+  void read(const char* name, T& value, bool required) {
+    if (!ok()) return;
+    JsonVariantConst v = _args[name];
+    if (v.isNull()) {
+      if (required) _error = String("missing '") + name + "'";
+      return;
+    }
+    if (!decodeValue(v, value)) {
+      _error = String("'") + name + "' must be " + jsonType(value);
+    }
+  }
+};
+
+template <typename Args>
+void writeSchema(JsonObject schema) {
+  Args args = Args();
+  SchemaWriter writer(schema);
+  args.visit(writer);
+}
+
+template <typename Args>
+bool decode(JsonObjectConst raw, Args& args, String& error) {
+  if (raw.isNull()) {
+    error = "arguments must be an object";
+    return false;
+  }
+  Decoder decoder(raw);
+  args.visit(decoder);
+  error = decoder.error();
+  return decoder.ok();
+}
+
+}  // namespace toolargs
@@ -0,0 +1,118 @@
+#include "Trace.h"
+#include <new>
+#ifdef ESP_PLATFORM
+#include <esp_timer.h>
+#else
+#include <functional>
+#include <thread>
+#endif
+
+struct Trace::Event {
+  std::atomic<uint32_t> seq;  // 書き終えたら index + 1（0 は書き込み中）
+  const char* name;
+  uint64_t start;
+  uint32_t duration;
+  uint32_t task;
+  uint8_t core;
+};
+
+std::atomic<bool> Trace::_enabled{false};
+std::atomic<uint32_t> Trace::_next{0};
+Trace::Event* Trace::_events = nullptr;
+size_t Trace::_capacity = 0;
+
+bool Trace::enable(size_t capacity) {
+  // setup() から呼ぶ前提。バッファは記録中のタスクが触るので解放しない
+  if (!_events) {
+    if (capacity == 0) return false;
+    Event* events = new (std::nothrow) Event[capacity];
+    if (!events) {
+      Serial.println("[Trace] Failed to allocate trace buffer.");
+      return false;
+    }
+    for (size_t i = 0; i < capacity; ++i) events[i].seq.store(0, std::memory_order_relaxed);
+    _capacity = capacity;
+    _events = events;
+  }
+  _enabled.store(true, std::memory_order_release);
+  return true;
+}
+
+uint64_t Trace::now() {
+#ifdef ESP_PLATFORM
+  return esp_timer_get_time();
+#else
+  return micros();
+#endif
+}
+
+void Trace::record(const char* name, uint64_t startUs, uint64_t endUs) {
+  if (!_events) return;
+  uint32_t index = _next.fetch_add(1, std::memory_order_relaxed);
+  Event& e = _events[index % _capacity];
+  e.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  e.name = name;
+  e.start = startUs;
+  e.duration = (uint32_t)(endUs - startUs);
+#ifdef ESP_PLATFORM
+  e.task = (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+  e.core = (uint8_t)xPortGetCoreID();
+#else
+  e.task = (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+  e.core = 0;
+#endif
+  e.seq.store(index + 1, std::memory_order_release);
+}
+
+void Trace::clear() {
+  _next.store(0, std::memory_order_relaxed);
+}
+
+uint32_t Trace::dropped() {
+  uint32_t next = _next.load(std::memory_order_relaxed);
+  return next > _capacity ? next - _capacity : 0;
+}
+
+size_t Trace::dump(Print& out) {
+  out.print("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  // コアごとにプロセスとして並べる
+  out.print("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"core 0\"}},"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"core 1\"}}");
+
+  size_t written = 0;
+  if (_events) {
+    uint32_t end = _next.load(std::memory_order_acquire);
+    uint32_t begin = end > _capacity ? end - _capacity : 0;
+    for (uint32_t i = begin; i != end; ++i) {
+      Event& e = _events[i % _capacity];
+      if (e.seq.load(std::memory_order_acquire) != i + 1) continue;
+      const char* name = e.name;
+      uint64_t start = e.start;
+      uint32_t duration = e.duration;
+      uint32_t task = e.task;
+      uint8_t core = e.core;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (e.seq.load(std::memory_order_relaxed) != i + 1) continue;  // 読んでいる間に上書きされた
+
+      out.printf(",{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%u,\"pid\":%u,\"tid\":%u}",
+                 name, (unsigned long long)start, (unsigned)duration, (unsigned)core, (unsigned)task);
+      ++written;
+    }
+  }
+  out.print("]}\n");
+  return written;
+}
+
+bool Trace::dumpToFile(fs::FS& fs, const char* path) {
+  File file = fs.open(path, FILE_WRITE);
+  if (!file) {
+    Serial.printf("[Trace] Failed to open %s\n", path);
+    return false;
+  }
+  size_t written = dump(file);
+  file.close();
+  Serial.printf("[Trace] Wrote %u events to %s (%u dropped)\n",
+                (unsigned)written, path, (unsigned)dropped());
+  return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <atomic>
+
+// トレースを丸ごと無効にする（build_flags で -DSTACKCHAN_THINK_TRACE=0）
+#ifndef STACKCHAN_THINK_TRACE
+#define STACKCHAN_THINK_TRACE 1
+#endif
+
+/**
+ * ターンのどこで時間を使ったかを見るための軽量なスパン記録。
+ *   TRACE_SPAN("name") を置いたスコープの開始時刻と長さを、コアと
+ *   タスクの番号付きでリングバッファに書く。書き込みはロックを取らず、
+ *   どのタスクからでも呼べる。あふれたら古いものから上書きする。
+ *   enable() するまでは何も記録しない（スパンのコストはフラグを 1 回読むだけ）。
+ *
+ *   dump() は Chrome の trace_event 形式の JSON を書き出すので、
+ *   Perfetto（ui.perfetto.dev）や chrome://tracing でそのまま開ける。
+ *
+ *   name は文字列リテラルなど、プログラムの終わりまで残る文字列だけを渡すこと。
+ */
+class Trace {
+public:
+  // 初回だけ capacity 件分のバッファを確保する（以降の enable では大きさは変わらない）
+  static bool enable(size_t capacity = 1024);
+  static void disable() { _enabled.store(false, std::memory_order_relaxed); }
+  static bool enabled() { return _enabled.load(std::memory_order_relaxed); }
+
+  static uint64_t now();  // µs（両コアで共通の時計）
+  static void record(const char* name, uint64_t startUs, uint64_t endUs);
+  static void clear();
+
+  // 記録中でも呼べる。書きかけのスロットは飛ばす。戻り値は書き出したイベント数
+  static size_t dump(Print& out);
+  static bool dumpToFile(fs::FS& fs, const char* path);
+
+  static uint32_t dropped();  // 上書きで失ったイベント数
+
+private:
+  struct Event;
+  static std::atomic<bool> _enabled;
+  static std::atomic<uint32_t> _next;
+  static Event* _events;
+  static size_t _capacity;
+};
+
+class TraceSpan {
+public:
+  explicit TraceSpan(const char* name)
+    : _name(Trace::enabled() ? name : nullptr), _start(_name ? Trace::now() : 0) {}
+  ~TraceSpan() {
+    if (_name) Trace::record(_name, _start, Trace::now());
+  }
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+  const char* _name;
+  uint64_t _start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#if STACKCHAN_THINK_TRACE
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(_traceSpan, __LINE__)(name)
+#else
+#define TRACE_SPAN(name) do {} while (0)
+#endif
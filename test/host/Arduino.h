@@ -0,0 +1,397 @@
+#pragma once
+// PC（env:native）でライブラリを動かすための Arduino のスタンドイン。
+//   String / Print / Stream / Serial と、時間・乱数まわりの関数だけを持つ。
+//   中身は ESP32 の Arduino コアと同じ振る舞いになるように書いてあるが、
+//   String の確保の仕方（std::string を使う）までは真似していない。
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <thread>
+
+using std::max;
+using std::min;
+
+class String {
+public:
+  String() {}
+  String(const char* text) { if (text) _s = text; }
+  String(const char* text, size_t length) { if (text) _s.assign(text, length); }
+  String(const String& other) = default;
+  String(String&& other) = default;
+  explicit String(char c) : _s(1, c) {}
+  explicit String(unsigned char value, unsigned char base = 10) { fromUnsigned(value, base); }
+  explicit String(int value, unsigned char base = 10) { fromSigned(value, base); }
+  explicit String(unsigned int value, unsigned char base = 10) { fromUnsigned(value, base); }
+  explicit String(long value, unsigned char base = 10) { fromSigned(value, base); }
+  explicit String(unsigned long value, unsigned char base = 10) { fromUnsigned(value, base); }
+  explicit String(long long value, unsigned char base = 10) { fromSigned(value, base); }
+  explicit String(unsigned long long value, unsigned char base = 10) { fromUnsigned(value, base); }
+  explicit String(float value, unsigned int decimals = 2) { fromDouble(value, decimals); }
+  explicit String(double value, unsigned int decimals = 2) { fromDouble(value, decimals); }
+
+  String& operator=(const String& other) = default;
+  String& operator=(String&& other) = default;
+  String& operator=(const char* text) {
+    // ArduinoJson は (const char*)0 を入れて空にする
+    if (text) _s = text; else _s.clear();
+    return *this;
+  }
+
+  bool reserve(unsigned int size) { _s.reserve(size); return true; }
+  unsigned int length() const { return (unsigned int)_s.size(); }
+  bool isEmpty() const { return _s.empty(); }
+  const char* c_str() const { return _s.c_str(); }
+  char* begin() { return &_s[0]; }
+  char* end() { return &_s[0] + _s.size(); }
+  const char* begin() const { return _s.c_str(); }
+  const char* end() const { return _s.c_str() + _s.size(); }
+
+  bool concat(const String& other) { _s += other._s; return true; }
+  bool concat(const char* text) { if (text) _s += text; return text != nullptr; }
+  bool concat(const char* text, unsigned int length) {
+    if (!text) return false;
+    _s.append(text, length);
+    return true;
+  }
+  bool concat(char c) { _s += c; return true; }
+  bool concat(unsigned char value) { return concat(String(value)); }
+  bool concat(int value) { return concat(String(value)); }
+  bool concat(unsigned int value) { return concat(String(value)); }
+  bool concat(long value) { return concat(String(value)); }
+  bool concat(unsigned long value) { return concat(String(value)); }
+  bool concat(float value) { return concat(String(value)); }
+  bool concat(double value) { return concat(String(value)); }
+
+  template <typename T>
+  String& operator+=(const T& value) { concat(value); return *this; }
+  String& operator+=(const char* text) { concat(text); return *this; }
+
+  int compareTo(const String& other) const { return _s.compare(other._s); }
+  bool equals(const String& other) const { return _s == other._s; }
+  bool equals(const char* text) const { return _s == (text ? text : ""); }
+  bool equalsIgnoreCase(const String& other) const {
+    if (length() != other.length()) return false;
+    for (size_t i = 0; i < _s.size(); ++i) {
+      if (tolower((unsigned char)_s[i]) != tolower((unsigned char)other._s[i])) return false;
+    }
+    return true;
+  }
+  bool operator==(const String& other) const { return equals(other); }
+  bool operator==(const char* text) const { return equals(text); }
+  bool operator!=(const String& other) const { return !equals(other); }
+  bool operator!=(const char* text) const { return !equals(text); }
+  bool operator<(const String& other) const { return compareTo(other) < 0; }
+  bool operator>(const String& other) const { return compareTo(other) > 0; }
+  bool operator<=(const String& other) const { return compareTo(other) <= 0; }
+  bool operator>=(const String& other) const { return compareTo(other) >= 0; }
+
+  bool startsWith(const String& prefix) const { return startsWith(prefix, 0); }
+  bool startsWith(const String& prefix, unsigned int offset) const {
+    return offset <= _s.size() && _s.compare(offset, prefix.length(), prefix._s) == 0;
+  }
+  bool endsWith(const String& suffix) const {
+    return suffix.length() <= length() &&
+           _s.compare(length() - suffix.length(), suffix.length(), suffix._s) == 0;
+  }
+
+  char charAt(unsigned int index) const { return index < _s.size() ? _s[index] : 0; }
+  void setCharAt(unsigned int index, char c) { if (index < _s.size()) _s[index] = c; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  char& operator[](unsigned int index) {
+    static char dummy;
+    if (index >= _s.size()) { dummy = 0; return dummy; }
+    return _s[index];
+  }
+
+  int indexOf(char c, unsigned int from = 0) const { return position(_s.find(c, from)); }
+  int indexOf(const char* text, unsigned int from = 0) const { return position(_s.find(text, from)); }
+  int indexOf(const String& text, unsigned int from = 0) const { return position(_s.find(text._s, from)); }
+  int lastIndexOf(char c) const { return position(_s.rfind(c)); }
+  int lastIndexOf(char c, unsigned int from) const { return position(_s.rfind(c, from)); }
+  int lastIndexOf(const char* text) const { return position(_s.rfind(text)); }
+  int lastIndexOf(const String& text) const { return position(_s.rfind(text._s)); }
+  int lastIndexOf(const String& text, unsigned int from) const { return position(_s.rfind(text._s, from)); }
+
+  String substring(unsigned int from) const { return substring(from, length()); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from > to) std::swap(from, to);
+    if (from >= _s.size()) return String();
+    if (to > _s.size()) to = (unsigned int)_s.size();
+    return String(_s.c_str() + from, to - from);
+  }
+
+  void replace(char find, char with) { std::replace(_s.begin(), _s.end(), find, with); }
+  void replace(const String& find, const String& with) {
+    if (find.isEmpty()) return;
+    size_t pos = 0;
+    while ((pos = _s.find(find._s, pos)) != std::string::npos) {
+      _s.replace(pos, find.length(), with._s);
+      pos += with.length();
+    }
+  }
+  void remove(unsigned int index) { if (index < _s.size()) _s.erase(index); }
+  void remove(unsigned int index, unsigned int count) { if (index < _s.size()) _s.erase(index, count); }
+  void toLowerCase() { for (auto& c : _s) c = (char)tolower((unsigned char)c); }
+  void toUpperCase() { for (auto& c : _s) c = (char)toupper((unsigned char)c); }
+  void trim() {
+    size_t begin = 0;
+    while (begin < _s.size() && isspace((unsigned char)_s[begin])) ++begin;
+    size_t end = _s.size();
+    while (end > begin && isspace((unsigned char)_s[end - 1])) --end;
+    _s = _s.substr(begin, end - begin);
+  }
+
+  long toInt() const { return atol(_s.c_str()); }
+  float toFloat() const { return (float)atof(_s.c_str()); }
+  double toDouble() const { return atof(_s.c_str()); }
+
+  void getBytes(unsigned char* buf, unsigned int size, unsigned int index = 0) const {
+    toCharArray((char*)buf, size, index);
+  }
+  void toCharArray(char* buf, unsigned int size, unsigned int index = 0) const {
+    if (!size || !buf) return;
+    size_t n = index < _s.size() ? std::min<size_t>(size - 1, _s.size() - index) : 0;
+    memcpy(buf, _s.c_str() + (n ? index : 0), n);
+    buf[n] = '\0';
+  }
+
+private:
+  std::string _s;
+
+  static int position(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+
+  template <typename T>
+  void fromSigned(T value, unsigned char base) {
+    if (value < 0 && base == 10) {
+      _s = "-";
+      appendUnsigned((unsigned long long)(-(long long)value), base);
+    } else {
+      appendUnsigned((unsigned long long)value, base);
+    }
+  }
+  template <typename T>
+  void fromUnsigned(T value, unsigned char base) { appendUnsigned((unsigned long long)value, base); }
+  void appendUnsigned(unsigned long long value, unsigned char base) {
+    char digits[66];
+    int i = 0;
+    if (base < 2) base = 10;
+    do {
+      int d = (int)(value % base);
+      digits[i++] = (char)(d < 10 ? '0' + d : 'a' + d - 10);
+      value /= base;
+    } while (value > 0);
+    while (i > 0) _s += digits[--i];
+  }
+  void fromDouble(double value, unsigned int decimals) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", (int)decimals, value);
+    _s = buf;
+  }
+};
+
+// "abc" + String(...) のような式の型（ArduinoJson も参照する）
+class StringSumHelper : public String {
+public:
+  StringSumHelper(const String& s) : String(s) {}
+  StringSumHelper(const char* p) : String(p) {}
+};
+
+inline StringSumHelper operator+(const String& a, const String& b) {
+  StringSumHelper out(a);
+  out.concat(b);
+  return out;
+}
+inline StringSumHelper operator+(const String& a, const char* b) {
+  StringSumHelper out(a);
+  out.concat(b);
+  return out;
+}
+inline StringSumHelper operator+(const char* a, const String& b) {
+  StringSumHelper out(a);
+  out.concat(b);
+  return out;
+}
+inline StringSumHelper operator+(const String& a, char b) {
+  StringSumHelper out(a);
+  out.concat(b);
+  return out;
+}
+inline StringSumHelper operator+(const String& a, int b) { return a + String(b); }
+inline StringSumHelper operator+(const String& a, unsigned int b) { return a + String(b); }
+inline StringSumHelper operator+(const String& a, long b) { return a + String(b); }
+inline StringSumHelper operator+(const String& a, unsigned long b) { return a + String(b); }
+inline StringSumHelper operator+(const String& a, float b) { return a + String(b); }
+inline StringSumHelper operator+(const String& a, double b) { return a + String(b); }
+inline bool operator==(const char* a, const String& b) { return b == a; }
+inline bool operator!=(const char* a, const String& b) { return b != a; }
+
+class Print;
+
+class Printable {
+public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size-- && write(*buffer++)) ++n;
+    return n;
+  }
+  size_t write(const char* text) { return text ? write((const uint8_t*)text, strlen(text)) : 0; }
+  size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+  virtual void flush() {}
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char small[128];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+    if (n < 0) return 0;
+    if ((size_t)n < sizeof(small)) return write((const uint8_t*)small, n);
+
+    std::string big(n + 1, '\0');
+    va_start(args, format);
+    vsnprintf(&big[0], big.size(), format, args);
+    va_end(args);
+    return write((const uint8_t*)big.data(), n);
+  }
+
+  size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+  size_t print(const char* s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int n) { return print(String(n)); }
+  size_t print(unsigned int n) { return print(String(n)); }
+  size_t print(long n) { return print(String(n)); }
+  size_t print(unsigned long n) { return print(String(n)); }
+  size_t print(double n, int digits = 2) { return print(String(n, digits)); }
+  size_t print(const Printable& p) { return p.printTo(*this); }
+
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(const T& value) { size_t n = print(value); return n + println(); }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  unsigned long getTimeout() const { return _timeout; }
+
+  virtual size_t readBytes(char* buffer, size_t length);
+  virtual size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+  virtual String readString() {
+    String out;
+    int c;
+    while ((c = timedRead()) >= 0) out += (char)c;
+    return out;
+  }
+
+protected:
+  unsigned long _timeout = 1000;
+  unsigned long _startMillis = 0;
+  int timedRead();
+  int timedPeek();
+};
+
+// ---- 時間・乱数 ----
+
+namespace arduino_host {
+inline std::chrono::steady_clock::time_point startTime() {
+  static const auto start = std::chrono::steady_clock::now();
+  return start;
+}
+inline std::mt19937& rng() {
+  static std::mt19937 engine(5489u);
+  return engine;
+}
+}  // namespace arduino_host
+
+inline unsigned long millis() {
+  return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - arduino_host::startTime()).count();
+}
+
+inline unsigned long micros() {
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - arduino_host::startTime()).count();
+}
+
+inline void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void delayMicroseconds(unsigned int us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+inline void yield() { std::this_thread::yield(); }
+
+inline void randomSeed(unsigned long seed) { arduino_host::rng().seed((uint32_t)seed); }
+inline long random(long howbig) {
+  if (howbig <= 0) return 0;
+  return (long)(arduino_host::rng()() % (unsigned long)howbig);
+}
+inline long random(long howsmall, long howbig) {
+  if (howsmall >= howbig) return howsmall;
+  return random(howbig - howsmall) + howsmall;
+}
+
+inline int Stream::timedRead() {
+  _startMillis = millis();
+  do {
+    int c = read();
+    if (c >= 0) return c;
+    yield();
+  } while (millis() - _startMillis < _timeout);
+  return -1;
+}
+
+inline int Stream::timedPeek() {
+  _startMillis = millis();
+  do {
+    int c = peek();
+    if (c >= 0) return c;
+    yield();
+  } while (millis() - _startMillis < _timeout);
+  return -1;
+}
+
+inline size_t Stream::readBytes(char* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length) {
+    int c = timedRead();
+    if (c < 0) break;
+    *buffer++ = (char)c;
+    ++count;
+  }
+  return count;
+}
+
+// ---- Serial（標準出力に書く） ----
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long) {}
+  void end() {}
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+  size_t write(const uint8_t* buffer, size_t size) override { return fwrite(buffer, 1, size, stdout); }
+  void flush() override { fflush(stdout); }
+  using Print::write;
+  explicit operator bool() const { return true; }
+};
+
+inline HardwareSerial Serial;
@@ -0,0 +1,112 @@
+#pragma once
+// PC（env:native）用の fs::FS スタンドイン。
+//   ルートディレクトリの下に実ファイルとして読み書きする。
+//   "/history_chat.jnl" は <root>/history_chat.jnl になる。
+#include <Arduino.h>
+#include <errno.h>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+class File : public Stream {
+public:
+  File() {}
+  File(FILE* fp, const String& path)
+    : _fp(fp, [](FILE* f) { if (f) fclose(f); }), _path(path) {}
+
+  explicit operator bool() const { return _fp != nullptr; }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buf, size_t size) override {
+    return _fp ? fwrite(buf, 1, size, _fp.get()) : 0;
+  }
+  using Print::write;
+
+  int available() override {
+    if (!_fp) return 0;
+    long left = (long)size() - (long)position();
+    return left > 0 ? (int)left : 0;
+  }
+  int read() override {
+    if (!_fp) return -1;
+    int c = fgetc(_fp.get());
+    return c == EOF ? -1 : c;
+  }
+  size_t read(uint8_t* buf, size_t size) { return _fp ? fread(buf, 1, size, _fp.get()) : 0; }
+  int peek() override {
+    if (!_fp) return -1;
+    int c = fgetc(_fp.get());
+    if (c == EOF) return -1;
+    ungetc(c, _fp.get());
+    return c;
+  }
+  void flush() override { if (_fp) fflush(_fp.get()); }
+
+  bool seek(uint32_t pos) { return _fp && fseek(_fp.get(), pos, SEEK_SET) == 0; }
+  size_t position() const { return _fp ? (size_t)ftell(_fp.get()) : 0; }
+  size_t size() const {
+    if (!_fp) return 0;
+    fflush(_fp.get());
+    struct stat st;
+    return fstat(fileno(_fp.get()), &st) == 0 ? (size_t)st.st_size : 0;
+  }
+  const char* path() const { return _path.c_str(); }
+  void close() { _fp.reset(); }
+
+private:
+  std::shared_ptr<FILE> _fp;
+  String _path;
+};
+
+class FS {
+public:
+  explicit FS(const String& root = "") : _root(root) {}
+
+  // 読み書きするディレクトリ（テストごとに一時ディレクトリを指す）
+  void setRoot(const String& root) { _root = root; }
+  const String& root() const { return _root; }
+
+  File open(const String& path, const char* mode = FILE_READ, bool create = false) {
+    (void)create;
+    String full = resolve(path);
+    String m = mode;
+    m += "b";
+    FILE* fp = fopen(full.c_str(), m.c_str());
+    return fp ? File(fp, path) : File();
+  }
+  File open(const char* path, const char* mode = FILE_READ, bool create = false) {
+    return open(String(path), mode, create);
+  }
+
+  bool exists(const String& path) {
+    struct stat st;
+    return stat(resolve(path).c_str(), &st) == 0;
+  }
+  bool remove(const String& path) { return ::remove(resolve(path).c_str()) == 0; }
+  bool rename(const String& from, const String& to) {
+    return ::rename(resolve(from).c_str(), resolve(to).c_str()) == 0;
+  }
+  bool mkdir(const String& path) {
+    return ::mkdir(resolve(path).c_str(), 0755) == 0 || errno == EEXIST;
+  }
+  bool rmdir(const String& path) { return ::rmdir(resolve(path).c_str()) == 0; }
+
+private:
+  String _root;
+
+  String resolve(const String& path) const {
+    if (_root.isEmpty()) return path;
+    return path.startsWith("/") ? _root + path : _root + "/" + path;
+  }
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
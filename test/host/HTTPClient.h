@@ -0,0 +1,170 @@
+#pragma once
+// PC（env:native）用の HTTPClient スタンドイン。
+//   OpenAITransport が使う範囲（接続済みクライアントでの POST・keep-alive・
+//   ヘッダーの取り出し）だけを持つ。本文は呼び出し側が client から直接読む。
+#include <WiFiClient.h>
+#include <vector>
+
+#define HTTPC_ERROR_CONNECTION_REFUSED  (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED  (-2)
+#define HTTPC_ERROR_SEND_PAYLOAD_FAILED (-3)
+#define HTTPC_ERROR_NOT_CONNECTED       (-4)
+#define HTTPC_ERROR_CONNECTION_LOST     (-5)
+#define HTTPC_ERROR_NO_STREAM           (-6)
+#define HTTPC_ERROR_NO_HTTP_SERVER      (-7)
+#define HTTPC_ERROR_TOO_LESS_RAM        (-8)
+#define HTTPC_ERROR_ENCODING            (-9)
+#define HTTPC_ERROR_STREAM_WRITE        (-10)
+#define HTTPC_ERROR_READ_TIMEOUT        (-11)
+
+#define HTTP_CODE_OK 200
+
+class HTTPClient {
+public:
+  bool begin(WiFiClient& client, const String& url) {
+    _client = &client;
+    int hostStart = url.indexOf("://");
+    hostStart = hostStart < 0 ? 0 : hostStart + 3;
+    int pathStart = url.indexOf('/', hostStart);
+    _host = url.substring(hostStart, pathStart < 0 ? url.length() : pathStart);
+    _path = pathStart < 0 ? String("/") : url.substring(pathStart);
+    int colon = _host.indexOf(':');
+    String host = colon < 0 ? _host : _host.substring(0, colon);
+    _port = colon < 0 ? (url.startsWith("https://") ? 443 : 80) : (uint16_t)_host.substring(colon + 1).toInt();
+    _connectHost = host;
+    _requestHeaders = "";
+    _size = -1;
+    for (auto& h : _headers) h.value = "";
+    return true;
+  }
+
+  void setReuse(bool reuse) { _reuse = reuse; }
+  void setTimeout(uint16_t timeoutMs) { _timeoutMs = timeoutMs; }
+
+  void collectHeaders(const char* keys[], size_t count) {
+    _headers.clear();
+    for (size_t i = 0; i < count; ++i) _headers.push_back({keys[i], ""});
+  }
+
+  void addHeader(const String& name, const String& value) {
+    _requestHeaders += name;
+    _requestHeaders += ": ";
+    _requestHeaders += value;
+    _requestHeaders += "\r\n";
+  }
+
+  int POST(const String& payload) { return POST((const uint8_t*)payload.c_str(), payload.length()); }
+  int POST(const uint8_t* payload, size_t size) {
+    if (!_client) return HTTPC_ERROR_NOT_CONNECTED;
+    if (!_client->connected() && !_client->connect(_connectHost.c_str(), _port)) {
+      return HTTPC_ERROR_CONNECTION_REFUSED;
+    }
+
+    String head;
+    head += "POST " + _path + " HTTP/1.1\r\n";
+    head += "Host: " + _host + "\r\n";
+    head += _reuse ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    head += "Content-Length: " + String((unsigned long)size) + "\r\n";
+    head += _requestHeaders;
+    head += "\r\n";
+    if (_client->write((const uint8_t*)head.c_str(), head.length()) != head.length()) {
+      return HTTPC_ERROR_SEND_HEADER_FAILED;
+    }
+    if (size && _client->write(payload, size) != size) return HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+    return readResponseHeaders();
+  }
+
+  String header(const char* name) {
+    for (auto& h : _headers) {
+      if (h.name.equalsIgnoreCase(name)) return h.value;
+    }
+    return String();
+  }
+
+  int getSize() const { return _size; }
+
+  void end() {
+    if (!_reuse || !_canReuse) {
+      if (_client) _client->stop();
+    }
+    _client = nullptr;
+  }
+
+  static String errorToString(int error) {
+    switch (error) {
+      case HTTPC_ERROR_CONNECTION_REFUSED: return "connection refused";
+      case HTTPC_ERROR_SEND_HEADER_FAILED: return "send header failed";
+      case HTTPC_ERROR_SEND_PAYLOAD_FAILED: return "send payload failed";
+      case HTTPC_ERROR_NOT_CONNECTED: return "not connected";
+      case HTTPC_ERROR_CONNECTION_LOST: return "connection lost";
+      case HTTPC_ERROR_NO_HTTP_SERVER: return "no HTTP server";
+      case HTTPC_ERROR_READ_TIMEOUT: return "read Timeout";
+      default: return String();
+    }
+  }
+
+private:
+  struct Header {
+    String name;
+    String value;
+  };
+
+  WiFiClient* _client = nullptr;
+  String _host;
+  String _connectHost;
+  uint16_t _port = 80;
+  String _path;
+  String _requestHeaders;
+  std::vector<Header> _headers;
+  bool _reuse = true;
+  bool _canReuse = true;
+  uint16_t _timeoutMs = 5000;
+  int _size = -1;
+
+  bool readLine(String& line) {
+    line = "";
+    unsigned long started = millis();
+    for (;;) {
+      int c = _client->read();
+      if (c < 0) {
+        if (!_client->connected()) return false;
+        if (millis() - started > _timeoutMs) return false;
+        delay(1);
+        continue;
+      }
+      if (c == '\n') break;
+      if (c != '\r') line += (char)c;
+    }
+    return true;
+  }
+
+  int readResponseHeaders() {
+    String line;
+    if (!readLine(line)) {
+      return _client->connected() ? HTTPC_ERROR_READ_TIMEOUT : HTTPC_ERROR_CONNECTION_LOST;
+    }
+    if (!line.startsWith("HTTP/1.")) return HTTPC_ERROR_NO_HTTP_SERVER;
+    int code = line.substring(9, 12).toInt();
+    _canReuse = line.startsWith("HTTP/1.1");
+
+    for (;;) {
+      if (!readLine(line)) return HTTPC_ERROR_CONNECTION_LOST;
+      if (line.isEmpty()) break;
+      int colon = line.indexOf(':');
+      if (colon < 0) continue;
+      String name = line.substring(0, colon);
+      String value = line.substring(colon + 1);
+      value.trim();
+      if (name.equalsIgnoreCase("Content-Length")) _size = value.toInt();
+      if (name.equalsIgnoreCase("Connection")) {
+        String v = value;
+        v.toLowerCase();
+        if (v == "close") _canReuse = false;
+      }
+      for (auto& h : _headers) {
+        if (h.name.equalsIgnoreCase(name)) h.value = value;
+      }
+    }
+    return code;
+  }
+};
@@ -0,0 +1,17 @@
+#pragma once
+// PC（env:native）用の SD スタンドイン。
+//   SD はカレントディレクトリ直下の sdcard/ を読み書きする（SD.setRoot() で変えられる）。
+#include <FS.h>
+
+namespace fs {
+
+class SDFS : public FS {
+public:
+  SDFS() : FS("sdcard") {}
+  bool begin(...) { return mkdir(""); }
+  void end() {}
+};
+
+}  // namespace fs
+
+inline fs::SDFS SD;
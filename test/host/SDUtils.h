@@ -0,0 +1,44 @@
+#pragma once
+// PC（env:native）用の StackChan-SDCard スタンドイン。
+//   関数の形は本物と同じで、読み書き先は SD スタンドイン（sdcard/ ディレクトリ）。
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <SD.h>
+#include <vector>
+
+inline bool initSDCard() { return SD.begin(); }
+
+inline bool readLinesFromSD(const char* path, std::vector<String>& lines) {
+  File file = SD.open(path, FILE_READ);
+  if (!file) return false;
+  String line;
+  int c;
+  while ((c = file.read()) >= 0) {
+    if (c == '\n') {
+      line.trim();
+      if (!line.isEmpty()) lines.push_back(line);
+      line = "";
+    } else {
+      line += (char)c;
+    }
+  }
+  line.trim();
+  if (!line.isEmpty()) lines.push_back(line);
+  return true;
+}
+
+inline bool writeJsonToSD(const char* path, const JsonDocument& doc) {
+  File file = SD.open(path, FILE_WRITE);
+  if (!file) return false;
+  bool ok = serializeJson(doc, file) > 0;
+  file.close();
+  return ok;
+}
+
+inline bool readJsonFromSD(const char* path, JsonDocument& doc) {
+  File file = SD.open(path, FILE_READ);
+  if (!file) return false;
+  DeserializationError err = deserializeJson(doc, file);
+  file.close();
+  return !err;
+}
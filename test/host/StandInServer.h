@@ -0,0 +1,267 @@
+#pragma once
+// PC（env:native）のテスト・ベンチ用の、ループバックで動く小さな HTTP サーバー。
+//   OpenAI 互換エンドポイントの代わりに、handler が決めた応答を返す。
+//   接続ごとにスレッドを 1 本立て、keep-alive で複数のリクエストを受ける。
+//
+//   StandInServer server([](const StandInServer::Request& req, StandInServer::Response& res) {
+//     res.json(200, "{\"choices\":[...]}");
+//   });
+//   server.start();
+//   transport.setEndpoint(server.url());
+#include <Arduino.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class StandInServer {
+public:
+  struct Request {
+    String method;
+    String path;
+    String body;
+    String accept;
+    String authorization;
+  };
+
+  class Response {
+  public:
+    Response(int fd, StandInServer& server) : _fd(fd), _server(server) {}
+
+    // Content-Length 付きで一度に返す
+    void send(int code, const char* contentType, const String& body) {
+      String head = statusLine(code);
+      head += "Content-Type: ";
+      head += contentType;
+      head += "\r\nContent-Length: " + String((unsigned long)body.length()) + "\r\n\r\n";
+      raw(head);
+      raw(body);
+    }
+    void json(int code, const String& body) { send(code, "application/json", body); }
+
+    // Transfer-Encoding: chunked で少しずつ返す
+    void beginChunked(int code, const char* contentType) {
+      String head = statusLine(code);
+      head += "Content-Type: ";
+      head += contentType;
+      head += "\r\nTransfer-Encoding: chunked\r\n\r\n";
+      raw(head);
+    }
+    void chunk(const String& data) {
+      if (data.isEmpty()) return;
+      char size[16];
+      snprintf(size, sizeof(size), "%x\r\n", data.length());
+      raw(String(size) + data + "\r\n");
+    }
+    void endChunked() { raw("0\r\n\r\n"); }
+
+    // SSE（text/event-stream）の 1 イベント。beginChunked(200, "text/event-stream") の後に使う
+    void event(const String& data) { chunk("data: " + data + "\n\n"); }
+
+    // 応答の途中でも生のバイト列を書ける（壊れた応答・途切れた本文の再現用）
+    void raw(const String& data) {
+      if (_fd < 0 || data.isEmpty()) return;
+      size_t sent = 0;
+      while (sent < data.length()) {
+        ssize_t n = ::send(_fd, data.c_str() + sent, data.length() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+          _broken = true;
+          return;
+        }
+        sent += (size_t)n;
+      }
+    }
+
+    // ms だけ待つ。サーバーが止められたら早めに戻る
+    void pause(unsigned long ms) { _server.waitStopped(ms); }
+
+    // 応答の後で接続を閉じる（keep-alive をやめる）
+    void close() { _close = true; }
+
+    bool broken() const { return _broken; }
+    bool closing() const { return _close || _broken; }
+
+  private:
+    int _fd;
+    StandInServer& _server;
+    bool _close = false;
+    bool _broken = false;
+
+    static String statusLine(int code) {
+      return "HTTP/1.1 " + String(code) + (code == 200 ? " OK" : " Error") + "\r\n";
+    }
+  };
+
+  using Handler = std::function<void(const Request&, Response&)>;
+
+  explicit StandInServer(Handler handler) : _handler(std::move(handler)) {}
+  ~StandInServer() { stop(); }
+
+  // port = 0 なら空いているポートを使う
+  bool start(uint16_t port = 0) {
+    _listenFd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (_listenFd < 0) return false;
+    int one = 1;
+    setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (::bind(_listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(_listenFd, 8) != 0) {
+      ::close(_listenFd);
+      _listenFd = -1;
+      return false;
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(_listenFd, (sockaddr*)&addr, &len);
+    _port = ntohs(addr.sin_port);
+    _stopping = false;
+    _acceptThread = std::thread([this] { acceptLoop(); });
+    return true;
+  }
+
+  void stop() {
+    if (_listenFd < 0) return;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+      for (int fd : _connections) ::shutdown(fd, SHUT_RDWR);
+    }
+    _stopCv.notify_all();
+    ::shutdown(_listenFd, SHUT_RDWR);
+    ::close(_listenFd);
+    _listenFd = -1;
+    if (_acceptThread.joinable()) _acceptThread.join();
+    std::vector<std::thread> threads;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      threads.swap(_threads);
+    }
+    for (auto& t : threads) t.join();
+  }
+
+  uint16_t port() const { return _port; }
+  String url(const char* path = "/v1/chat/completions") const {
+    return "http://127.0.0.1:" + String((unsigned)_port) + path;
+  }
+
+  std::vector<Request> requests() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _requests;
+  }
+  size_t requestCount() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _requests.size();
+  }
+  size_t connectionCount() const { return _accepted; }
+
+private:
+  Handler _handler;
+  int _listenFd = -1;
+  uint16_t _port = 0;
+  std::thread _acceptThread;
+  std::vector<std::thread> _threads;
+  std::vector<int> _connections;
+  std::vector<Request> _requests;
+  mutable std::mutex _mutex;
+  std::condition_variable _stopCv;
+  bool _stopping = false;
+  std::atomic<size_t> _accepted{0};
+
+  void waitStopped(unsigned long ms) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _stopCv.wait_for(lock, std::chrono::milliseconds(ms), [this] { return _stopping; });
+  }
+
+  void acceptLoop() {
+    for (;;) {
+      int fd = ::accept(_listenFd, nullptr, nullptr);
+      if (fd < 0) return;
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_stopping) {
+        ::close(fd);
+        return;
+      }
+      ++_accepted;
+      _connections.push_back(fd);
+      _threads.emplace_back([this, fd] { serve(fd); });
+    }
+  }
+
+  static bool readLine(int fd, String& line) {
+    line = "";
+    char c;
+    for (;;) {
+      if (::recv(fd, &c, 1, 0) != 1) return false;
+      if (c == '\n') return true;
+      if (c != '\r') line += c;
+    }
+  }
+
+  void serve(int fd) {
+    for (;;) {
+      Request req;
+      String line;
+      if (!readLine(fd, line) || line.isEmpty()) break;
+      int sp1 = line.indexOf(' ');
+      int sp2 = line.indexOf(' ', sp1 + 1);
+      req.method = line.substring(0, sp1);
+      req.path = line.substring(sp1 + 1, sp2);
+
+      long contentLength = 0;
+      bool keepAlive = true;
+      bool ok = true;
+      for (;;) {
+        if (!readLine(fd, line)) {
+          ok = false;
+          break;
+        }
+        if (line.isEmpty()) break;
+        int colon = line.indexOf(':');
+        if (colon < 0) continue;
+        String name = line.substring(0, colon);
+        String value = line.substring(colon + 1);
+        value.trim();
+        name.toLowerCase();
+        if (name == "content-length") contentLength = value.toInt();
+        if (name == "accept") req.accept = value;
+        if (name == "authorization") req.authorization = value;
+        if (name == "connection" && value.equalsIgnoreCase("close")) keepAlive = false;
+      }
+      if (!ok) break;
+
+      std::vector<char> body(contentLength);
+      long got = 0;
+      while (got < contentLength) {
+        ssize_t n = ::recv(fd, body.data() + got, contentLength - got, 0);
+        if (n <= 0) break;
+        got += n;
+      }
+      if (got < contentLength) break;
+      req.body = String(body.data(), (unsigned int)contentLength);
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _requests.push_back(req);
+      }
+      Response res(fd, *this);
+      _handler(req, res);
+      if (res.closing() || !keepAlive) break;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto it = _connections.begin(); it != _connections.end(); ++it) {
+      if (*it == fd) {
+        _connections.erase(it);
+        break;
+      }
+    }
+    ::close(fd);
+  }
+};
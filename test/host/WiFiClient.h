@@ -0,0 +1,109 @@
+#pragma once
+// PC（env:native）用の WiFiClient スタンドイン。POSIX ソケットで TCP をそのまま張る。
+#include <Client.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class WiFiClient : public Client {
+public:
+  WiFiClient() {}
+  WiFiClient(const WiFiClient&) = delete;
+  WiFiClient& operator=(const WiFiClient&) = delete;
+  ~WiFiClient() override { stop(); }
+
+  int connect(const char* host, uint16_t port) override {
+    stop();
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", (unsigned)port);
+    if (getaddrinfo(host, service, &hints, &res) != 0 || !res) return 0;
+    int fd = ::socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && ::connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+      ::close(fd);
+      fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) return 0;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    _fd = fd;
+    _peerClosed = false;
+    return 1;
+  }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buf, size_t size) override {
+    if (_fd < 0) return 0;
+    size_t sent = 0;
+    while (sent < size) {
+      ssize_t n = ::send(_fd, buf + sent, size - sent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        stop();
+        break;
+      }
+      sent += (size_t)n;
+    }
+    return sent;
+  }
+  using Print::write;
+
+  int available() override {
+    if (_fd < 0) return 0;
+    int n = 0;
+    if (ioctl(_fd, FIONREAD, &n) != 0) return 0;
+    if (n == 0) pollClosed();
+    return n;
+  }
+  int read() override {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  int read(uint8_t* buf, size_t size) override {
+    if (_fd < 0 || available() <= 0) return -1;
+    ssize_t n = ::recv(_fd, buf, size, 0);
+    if (n <= 0) {
+      _peerClosed = true;
+      return -1;
+    }
+    return (int)n;
+  }
+  int peek() override {
+    if (_fd < 0 || available() <= 0) return -1;
+    uint8_t c;
+    return ::recv(_fd, &c, 1, MSG_PEEK) == 1 ? c : -1;
+  }
+  void stop() override {
+    if (_fd >= 0) ::close(_fd);
+    _fd = -1;
+    _peerClosed = false;
+  }
+  uint8_t connected() override {
+    if (_fd < 0) return 0;
+    if (available() > 0) return 1;
+    return !_peerClosed;
+  }
+  explicit operator bool() override { return connected(); }
+
+private:
+  int _fd = -1;
+  bool _peerClosed = false;
+
+  // 受信データが無いとき、相手が閉じたかどうかだけを確かめる
+  void pollClosed() {
+    pollfd p{_fd, POLLIN, 0};
+    if (::poll(&p, 1, 0) > 0 && (p.revents & (POLLIN | POLLHUP | POLLERR))) {
+      uint8_t c;
+      if (::recv(_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0) _peerClosed = true;
+    }
+  }
+};
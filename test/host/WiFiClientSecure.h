@@ -0,0 +1,10 @@
+#pragma once
+// PC（env:native）用の WiFiClientSecure スタンドイン。
+//   TLS は張らず、平文の TCP として振る舞う（テストはローカルの http:// に向ける）。
+#include <WiFiClient.h>
+
+class WiFiClientSecure : public WiFiClient {
+public:
+  void setInsecure() {}
+  void setCACert(const char*) {}
+};
@@ -0,0 +1,135 @@
+// ConversationHistory（リングバッファの会話履歴）のテスト（pio test -e native -f test_conversation_history）
+#include <unity.h>
+#include <vector>
+#include "ConversationHistory.h"
+#include "LLMEngine.h"
+
+static std::vector<String> contents(const ConversationHistory& history) {
+  std::vector<String> out;
+  for (const auto& message : history) {
+    out.push_back(String(message.role.c_str()) + ":" + message.content);
+  }
+  return out;
+}
+
+static void assertContents(const std::vector<String>& expected, const ConversationHistory& history) {
+  std::vector<String> actual = contents(history);
+  TEST_ASSERT_EQUAL(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    TEST_ASSERT_EQUAL_STRING(expected[i].c_str(), actual[i].c_str());
+  }
+}
+
+static void pushNumbered(ConversationHistory& history, int from, int count) {
+  for (int i = from; i < from + count; ++i) {
+    history.push(i % 2 == 0 ? "user" : "assistant", "発話" + String(i));
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_push_wraps_and_drops_oldest() {
+  ConversationHistory history(64 * 1024);
+  pushNumbered(history, 0, ConversationHistory::kCapacity + 3);
+  TEST_ASSERT_TRUE(history.full());
+  TEST_ASSERT_EQUAL_STRING("発話3", history.at(0).content.c_str());
+  TEST_ASSERT_EQUAL_STRING("発話18", history.back().content.c_str());
+}
+
+// バイト数は JSON 断片の長さの合計で、出し入れしても食い違わない
+void test_bytes_follow_fragments() {
+  ConversationHistory history(64 * 1024);
+  pushNumbered(history, 0, 5);
+  size_t expected = 0;
+  for (size_t i = 0; i < history.size(); ++i) expected += history.entryBytes(i);
+  TEST_ASSERT_EQUAL_UINT(expected, history.bytes());
+
+  history.popFront();
+  history.popBack();
+  expected = 0;
+  for (size_t i = 0; i < history.size(); ++i) expected += history.entryBytes(i);
+  TEST_ASSERT_EQUAL_UINT(expected, history.bytes());
+
+  history.clear();
+  TEST_ASSERT_EQUAL_UINT(0, history.bytes());
+}
+
+void test_messages_json_keeps_order() {
+  ConversationHistory history(64 * 1024);
+  history.setSystemPrompt("sys");
+  history.setSummary("前の話");
+  history.push("user", "a\"b");
+  history.push("assistant", "c");
+  String out;
+  history.appendMessagesJson(out);
+  TEST_ASSERT_EQUAL_STRING(
+      "{\"role\":\"system\",\"content\":\"sys\"},"
+      "{\"role\":\"system\",\"content\":\"これまでの会話の要約: 前の話\"},"
+      "{\"role\":\"user\",\"content\":\"a\\\"b\"},"
+      "{\"role\":\"assistant\",\"content\":\"c\"}",
+      out.c_str());
+}
+
+void test_push_front_ignored_when_full() {
+  ConversationHistory history(64 * 1024);
+  pushNumbered(history, 0, ConversationHistory::kCapacity);
+  std::vector<String> before = contents(history);
+  history.pushFront(Message("user", "入らない"));
+  assertContents(before, history);
+}
+
+// ターン中の押し出しを取り消す手順（LLMEngine::rollbackTurn と同じ）で、
+// 先頭がリングの端をまたいでいても元の並びとバイト数に戻る
+void test_evictions_during_turn_restore_across_wrap() {
+  ConversationHistory history(64 * 1024);
+  pushNumbered(history, 0, ConversationHistory::kCapacity + 5);  // 先頭は 5 番目のスロット
+  history.popFront();
+  history.popFront();
+  std::vector<String> before = contents(history);
+  size_t bytes = history.bytes();
+  size_t kept = history.size();
+
+  // ターン: 1 件足して古い発話 3 件を押し出し、リングが一杯になるまでさらに足す
+  std::vector<Message> evicted;
+  history.push("user", "ターンの質問");
+  for (int i = 0; i < 3; ++i) {
+    evicted.push_back(history.popFront());
+    --kept;
+  }
+  pushNumbered(history, 100, (int)(ConversationHistory::kCapacity - history.size()));
+
+  while (history.size() > kept) history.popBack();
+  for (auto it = evicted.rbegin(); it != evicted.rend(); ++it) history.pushFront(*it);
+  assertContents(before, history);
+  TEST_ASSERT_EQUAL_UINT(bytes, history.bytes());
+}
+
+// LLMEngine 越しに、予算で押し出しが起きたターンを取り消す
+void test_engine_rollback_after_eviction_within_turn() {
+  LLMEngine llm("sk-test");
+  llm.setHistoryBudget(64 * 1024);
+  for (int i = 0; i < (int)ConversationHistory::kCapacity + 3; ++i) {
+    if (i % 2 == 0) llm.addUserMessage("質問" + String(i));
+    else llm.addAssistantMessage("答え" + String(i));
+  }
+  llm.setHistoryBudget(llm.getHistory()->bytes());
+  std::vector<String> before = contents(*llm.getHistory());
+
+  llm.beginTurn();
+  llm.addUserMessage("ターンの質問");
+  llm.addAssistantMessage("ターンのとても長い答え。押し出しが何件か起きるくらいの長さにしておく。");
+  llm.rollbackTurn();
+  assertContents(before, *llm.getHistory());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_push_wraps_and_drops_oldest);
+  RUN_TEST(test_bytes_follow_fragments);
+  RUN_TEST(test_messages_json_keeps_order);
+  RUN_TEST(test_push_front_ignored_when_full);
+  RUN_TEST(test_evictions_during_turn_restore_across_wrap);
+  RUN_TEST(test_engine_rollback_after_eviction_within_turn);
+  return UNITY_END();
+}
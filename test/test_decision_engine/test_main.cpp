@@ -0,0 +1,185 @@
+// LLMDecisionEngine のテスト（pio test -e native -f test_decision_engine）
+#include <unity.h>
+#include <deque>
+#include <mutex>
+#include "LLMDecisionEngine.h"
+#include "StandInServer.h"
+
+static const char* kPlainReply =
+    "{\"choices\":[{\"message\":{\"role\":\"assistant\",\"content\":\"ok\"}}]}";
+
+// 応答は script に積んだ順に返す。空なら tool_calls なしの普通の返答
+static std::mutex scriptMutex;
+static std::deque<String> script;
+
+static StandInServer server([](const StandInServer::Request&, StandInServer::Response& res) {
+  String body = kPlainReply;
+  {
+    std::lock_guard<std::mutex> lock(scriptMutex);
+    if (!script.empty()) {
+      body = script.front();
+      script.pop_front();
+    }
+  }
+  res.json(200, body);
+});
+static OpenAITransport transport;
+
+static void pushReply(const String& body) {
+  std::lock_guard<std::mutex> lock(scriptMutex);
+  script.push_back(body);
+}
+
+// name の並びをそのまま tool_calls にした応答
+static String toolCallsReply(std::initializer_list<const char*> names) {
+  String calls;
+  int id = 0;
+  for (const char* name : names) {
+    if (!calls.isEmpty()) calls += ",";
+    calls += "{\"id\":\"call_" + String(id++) + "\",\"type\":\"function\","
+             "\"function\":{\"name\":\"" + String(name) + "\",\"arguments\":\"{}\"}}";
+  }
+  return "{\"choices\":[{\"message\":{\"role\":\"assistant\",\"content\":null,"
+         "\"tool_calls\":[" + calls + "]}}]}";
+}
+
+class LightProvider : public IFunctionProvider {
+public:
+  void registerFunctions(LLMDecisionEngine& engine) override {
+    JsonDocument schema;
+    schema["type"] = "object";
+    engine.registerTool("set_light", "ライトを点ける", schema,
+                        [](JsonObject) { return String("on"); });
+  }
+};
+
+static String lastRequestBody() {
+  std::vector<StandInServer::Request> requests = server.requests();
+  return requests.empty() ? String() : requests.back().body;
+}
+
+void setUp() {
+  std::lock_guard<std::mutex> lock(scriptMutex);
+  script.clear();
+}
+void tearDown() {}
+
+void test_direct_registration_survives_rebuild() {
+  LLMDecisionEngine engine("sk-test");
+  engine.setTransport(&transport);
+  JsonDocument schema;
+  schema["type"] = "object";
+  engine.registerTool("get_time", "時刻を返す", schema, [](JsonObject) { return String("12:00"); });
+
+  LightProvider provider;
+  engine.setActiveProviders({&provider});
+  engine.buildFunctionSchema();
+  uint32_t builds = engine.stats().schemaBuilds;
+
+  // provider を入れ替えて作り直しても、直接登録したツールは残る
+  engine.setActiveProviders({&provider});
+  engine.buildFunctionSchema();
+  TEST_ASSERT_EQUAL_UINT32(builds + 1, engine.stats().schemaBuilds);
+
+  engine.addMessage("user", "", "いま何時？");
+  String content;
+  TEST_ASSERT_TRUE(engine.evaluate(content));
+  String body = lastRequestBody();
+  TEST_ASSERT_TRUE(body.indexOf("\"get_time\"") >= 0);
+  TEST_ASSERT_TRUE(body.indexOf("\"set_light\"") >= 0);
+}
+
+void test_provider_functions_are_replaced_on_rebuild() {
+  LLMDecisionEngine engine("sk-test");
+  engine.setTransport(&transport);
+  LightProvider provider;
+  engine.setActiveProviders({&provider});
+  engine.buildFunctionSchema();
+
+  engine.setActiveProviders({});
+  engine.buildFunctionSchema();
+
+  engine.addMessage("user", "", "ライトつけて");
+  String content;
+  TEST_ASSERT_TRUE(engine.evaluate(content));
+  TEST_ASSERT_TRUE(lastRequestBody().indexOf("\"set_light\"") < 0);
+}
+
+// 動いた順を記録するツールを登録する。concurrent のものは少し待ってから記録する
+static void registerRecorders(LLMDecisionEngine& engine, std::vector<String>& order, std::mutex& orderMutex) {
+  JsonDocument schema;
+  schema["type"] = "object";
+  auto recorder = [&order, &orderMutex](const char* name, unsigned long waitMs) {
+    return [&order, &orderMutex, name, waitMs](JsonObject) {
+      delay(waitMs);
+      std::lock_guard<std::mutex> lock(orderMutex);
+      order.push_back(name);
+      return String(name);
+    };
+  };
+  engine.registerTool("first", "1 番目", schema, recorder("first", 0));
+  engine.registerTool("fetch_a", "並列 A", schema, recorder("fetch_a", 30), true);
+  engine.registerTool("fetch_b", "並列 B", schema, recorder("fetch_b", 30), true);
+  engine.registerTool("last", "最後", schema, recorder("last", 0));
+}
+
+void test_tools_run_in_model_order() {
+  LLMDecisionEngine engine("sk-test");
+  engine.setTransport(&transport);
+  std::vector<String> order;
+  std::mutex orderMutex;
+  registerRecorders(engine, order, orderMutex);
+
+  // 並列のツールが順番のツールの後ろに並んでいても、前のツールより先には動かない
+  pushReply(toolCallsReply({"last", "fetch_a", "fetch_b", "first"}));
+  engine.addMessage("user", "", "順番に動かして");
+  String content;
+  TEST_ASSERT_TRUE(engine.runToolLoop(content));
+
+  TEST_ASSERT_EQUAL(4, (int)order.size());
+  TEST_ASSERT_EQUAL_STRING("last", order[0].c_str());
+  TEST_ASSERT_TRUE(order[1] == "fetch_a" || order[1] == "fetch_b");
+  TEST_ASSERT_TRUE(order[2] == "fetch_a" || order[2] == "fetch_b");
+  TEST_ASSERT_EQUAL_STRING("first", order[3].c_str());
+
+  // 結果は tool_call_id の順で 2 回目のリクエストに載る
+  String body = lastRequestBody();
+  int last = body.indexOf("\"tool_call_id\":\"call_0\"");
+  int first = body.indexOf("\"tool_call_id\":\"call_3\"");
+  TEST_ASSERT_TRUE(last >= 0 && first > last);
+  TEST_ASSERT_EQUAL_UINT32(2, engine.stats().toolLoopSteps);
+}
+
+void test_last_step_does_not_run_tools() {
+  LLMDecisionEngine engine("sk-test");
+  engine.setTransport(&transport);
+  std::vector<String> order;
+  std::mutex orderMutex;
+  registerRecorders(engine, order, orderMutex);
+  engine.setToolLoopBudget(2, 20000);
+
+  // 2 回とも tool_calls が返る。2 回目の結果は送れないので動かさない
+  pushReply(toolCallsReply({"first"}));
+  pushReply(toolCallsReply({"last"}));
+  engine.addMessage("user", "", "ずっとツールを呼ぶ");
+  String content;
+  size_t before = server.requestCount();
+  TEST_ASSERT_FALSE(engine.runToolLoop(content));
+
+  TEST_ASSERT_EQUAL(2, (int)(server.requestCount() - before));
+  TEST_ASSERT_EQUAL(1, (int)order.size());
+  TEST_ASSERT_EQUAL_STRING("first", order[0].c_str());
+}
+
+int main() {
+  server.start();
+  transport.setEndpoint(server.url());
+  UNITY_BEGIN();
+  RUN_TEST(test_direct_registration_survives_rebuild);
+  RUN_TEST(test_provider_functions_are_replaced_on_rebuild);
+  RUN_TEST(test_tools_run_in_model_order);
+  RUN_TEST(test_last_step_does_not_run_tools);
+  int failures = UNITY_END();
+  server.stop();
+  return failures;
+}
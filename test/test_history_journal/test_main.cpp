@@ -0,0 +1,199 @@
+// HistoryJournal のテスト（pio test -e native -f test_history_journal）
+//   FsJournalStorage を test/host の fs::FS（一時ディレクトリに読み書きする）に載せて、
+//   実際のファイルを切り詰めたり壊したりしてから読み直す。
+#include <unity.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+#include "HistoryJournal.h"
+
+static fs::FS disk;
+
+struct Replayed {
+  std::vector<String> contents;
+  String systemPrompt;
+
+  HistoryJournal::Applier applier() {
+    return [this](const HistoryJournal::Record& record) {
+      if (record.op == HistoryJournal::Op::Clear) {
+        contents.clear();
+        systemPrompt = record.content;
+      } else if (record.op == HistoryJournal::Op::Append) {
+        contents.push_back(record.content);
+      }
+    };
+  }
+};
+
+static std::vector<uint8_t> readFile(const char* path) {
+  std::vector<uint8_t> data;
+  File file = disk.open(path, FILE_READ);
+  data.resize(file.size());
+  if (!data.empty()) file.read(data.data(), data.size());
+  return data;
+}
+
+static void writeFile(const char* path, const std::vector<uint8_t>& data) {
+  File file = disk.open(path, FILE_WRITE);
+  file.write(data.data(), data.size());
+}
+
+// system プロンプトと発話 3 件を書いた状態にする
+static void writeThreeMessages() {
+  FsJournalStorage storage(disk);
+  HistoryJournal journal(storage, "");
+  Replayed replayed;
+  journal.open("chat", replayed.applier());
+  TEST_ASSERT_TRUE(journal.append({HistoryJournal::clearRecord("system")}));
+  TEST_ASSERT_TRUE(journal.append({HistoryJournal::appendRecord("user", "おはよう")}));
+  TEST_ASSERT_TRUE(journal.append({HistoryJournal::appendRecord("assistant", "おはよう！今日もがんばろう")}));
+  TEST_ASSERT_TRUE(journal.append({HistoryJournal::appendRecord("user", "雨が降ってるね")}));
+}
+
+void setUp() {
+  char dir[] = "/tmp/journal_test_XXXXXX";
+  TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+  disk.setRoot(dir);
+}
+
+void tearDown() {
+  disk.remove("/history_chat.jnl");
+  disk.remove("/history_chat.jnl.tmp");
+  disk.remove("/history_chat.snap");
+  disk.rmdir("");
+}
+
+void test_replays_appended_records() {
+  writeThreeMessages();
+
+  FsJournalStorage storage(disk);
+  HistoryJournal journal(storage, "");
+  Replayed replayed;
+  TEST_ASSERT_TRUE(journal.open("chat", replayed.applier()));
+  TEST_ASSERT_EQUAL_STRING("system", replayed.systemPrompt.c_str());
+  TEST_ASSERT_EQUAL(3, (int)replayed.contents.size());
+  TEST_ASSERT_EQUAL_STRING("雨が降ってるね", replayed.contents[2].c_str());
+  TEST_ASSERT_EQUAL_UINT32(0, journal.stats().tornTails);
+}
+
+// 最後のレコードを書いている途中で電源が落ちた
+void test_drops_torn_tail_and_keeps_appending() {
+  writeThreeMessages();
+  std::vector<uint8_t> data = readFile("/history_chat.jnl");
+  data.resize(data.size() - 5);
+  writeFile("/history_chat.jnl", data);
+
+  FsJournalStorage storage(disk);
+  HistoryJournal journal(storage, "");
+  Replayed replayed;
+  TEST_ASSERT_TRUE(journal.open("chat", replayed.applier()));
+  TEST_ASSERT_EQUAL(2, (int)replayed.contents.size());
+  TEST_ASSERT_EQUAL_UINT32(1, journal.stats().tornTails);
+
+  // 切れた末尾は落としてあるので、次の追記は正しいレコードの後ろに続く
+  TEST_ASSERT_TRUE(journal.append({HistoryJournal::appendRecord("user", "晴れてきた")}));
+  HistoryJournal reopened(storage, "");
+  Replayed again;
+  TEST_ASSERT_TRUE(reopened.open("chat", again.applier()));
+  TEST_ASSERT_EQUAL(3, (int)again.contents.size());
+  TEST_ASSERT_EQUAL_STRING("晴れてきた", again.contents[2].c_str());
+  TEST_ASSERT_EQUAL_UINT32(0, reopened.stats().tornTails);
+}
+
+// 最後のレコードの本文が化けた（CRC が合わない）
+void test_stops_at_crc_mismatch() {
+  writeThreeMessages();
+  std::vector<uint8_t> data = readFile("/history_chat.jnl");
+  data[data.size() - 1] ^= 0xFF;
+  writeFile("/history_chat.jnl", data);
+
+  FsJournalStorage storage(disk);
+  HistoryJournal journal(storage, "");
+  Replayed replayed;
+  TEST_ASSERT_TRUE(journal.open("chat", replayed.applier()));
+  TEST_ASSERT_EQUAL(2, (int)replayed.contents.size());
+  TEST_ASSERT_EQUAL_STRING("おはよう！今日もがんばろう", replayed.contents[1].c_str());
+  TEST_ASSERT_EQUAL_UINT32(1, journal.stats().tornTails);
+}
+
+// 圧縮後に古い世代のジャーナルが残っていても再生しない
+void test_ignores_journal_from_older_generation() {
+  writeThreeMessages();
+  std::vector<uint8_t> stale = readFile("/history_chat.jnl");
+
+  FsJournalStorage storage(disk);
+  HistoryJournal journal(storage, "");
+  Replayed replayed;
+  journal.open("chat", replayed.applier());
+  TEST_ASSERT_TRUE(journal.compact({HistoryJournal::clearRecord("system"),
+                                    HistoryJournal::appendRecord("user", "まとめた")}));
+  writeFile("/history_chat.jnl", stale);  // 古いジャーナルを消す前に落ちた
+
+  HistoryJournal reopened(storage, "");
+  Replayed again;
+  TEST_ASSERT_TRUE(reopened.open("chat", again.applier()));
+  TEST_ASSERT_EQUAL(1, (int)again.contents.size());
+  TEST_ASSERT_EQUAL_STRING("まとめた", again.contents[0].c_str());
+  TEST_ASSERT_FALSE(disk.exists("/history_chat.jnl"));
+}
+
+// 別のトピックを開いても、park した状態で戻ってこられる
+void test_parked_topic_survives_other_open() {
+  writeThreeMessages();
+  FsJournalStorage storage(disk);
+  HistoryJournal journal(storage, "");
+  Replayed replayed;
+  journal.open("chat", replayed.applier());
+  journal.park({HistoryJournal::clearRecord("system"), HistoryJournal::appendRecord("user", "おはよう")});
+
+  Replayed other;
+  journal.open("weather", other.applier());
+  Replayed back;
+  TEST_ASSERT_TRUE(journal.open("chat", back.applier()));
+  TEST_ASSERT_EQUAL_UINT32(1, journal.stats().parkedHits);
+  TEST_ASSERT_EQUAL(1, (int)back.contents.size());
+}
+
+// 新しい形式で書かれたスナップショットは読めないが、追記も圧縮もせずにそのまま残す
+void test_keeps_snapshot_with_newer_format() {
+  writeThreeMessages();
+  FsJournalStorage storage(disk);
+  HistoryJournal writer(storage, "");
+  Replayed replayed;
+  writer.open("chat", replayed.applier());
+  TEST_ASSERT_TRUE(writer.compact({HistoryJournal::clearRecord("system"),
+                                   HistoryJournal::appendRecord("user", "まとめた")}));
+  std::vector<uint8_t> snapshot = readFile("/history_chat.snap");
+  snapshot[3] = HistoryJournal::kFormatVersion + 1;  // "SCH" の直後が形式バージョン
+  writeFile("/history_chat.snap", snapshot);
+
+  HistoryJournal journal(storage, "");
+  Replayed again;
+  TEST_ASSERT_FALSE(journal.open("chat", again.applier()));
+  TEST_ASSERT_TRUE(journal.readOnly());
+  TEST_ASSERT_FALSE(journal.append({HistoryJournal::clearRecord("system")}));
+  TEST_ASSERT_FALSE(journal.compact({HistoryJournal::clearRecord("system")}));
+
+  std::vector<uint8_t> after = readFile("/history_chat.snap");
+  TEST_ASSERT_EQUAL(snapshot.size(), after.size());
+  TEST_ASSERT_TRUE(snapshot == after);
+  TEST_ASSERT_FALSE(disk.exists("/history_chat.jnl"));
+
+  // 読める別のトピックに切り替えれば、また書ける
+  Replayed other;
+  journal.open("weather", other.applier());
+  TEST_ASSERT_FALSE(journal.readOnly());
+  TEST_ASSERT_TRUE(journal.append({HistoryJournal::clearRecord("system")}));
+  disk.remove("/history_weather.jnl");
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_replays_appended_records);
+  RUN_TEST(test_drops_torn_tail_and_keeps_appending);
+  RUN_TEST(test_stops_at_crc_mismatch);
+  RUN_TEST(test_ignores_journal_from_older_generation);
+  RUN_TEST(test_parked_topic_survives_other_open);
+  RUN_TEST(test_keeps_snapshot_with_newer_format);
+  return UNITY_END();
+}
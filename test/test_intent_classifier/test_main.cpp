@@ -0,0 +1,108 @@
+// LocalIntentClassifier / EngineManager のローカル分類のテスト（pio test -e native -f test_intent_classifier）
+#include <unity.h>
+#include "EngineManager.h"
+#include "StandInServer.h"
+
+// リモート分類は常に "chat" と答える
+static StandInServer server([](const StandInServer::Request&, StandInServer::Response& res) {
+  res.json(200, "{\"choices\":[{\"message\":{\"role\":\"assistant\",\"content\":\"chat\"}}]}");
+});
+
+class EchoEngine : public IEngine {
+public:
+  explicit EchoEngine(const char* name) : _name(name) {}
+  LLMResponse generateReply(const String&) override { return LLMResponse(_name); }
+
+private:
+  String _name;
+};
+
+static const std::vector<String> kWeather = {
+  "今日の天気は？", "明日は雨が降る？", "天気予報を教えて", "傘はいるかな", "外は晴れてる？"
+};
+static const std::vector<String> kTimer = {
+  "タイマーを3分セットして", "5分後に教えて", "アラームをかけて", "10分計って", "タイマー止めて"
+};
+static const std::vector<String> kChat = {
+  "こんにちは", "お話ししよう", "元気？", "ひまだなあ", "今日は楽しかった"
+};
+
+static LocalIntentClassifier classifier;
+static const std::vector<String> kIntents = { "weather", "timer", "chat" };
+
+// EngineManager の既定の閾値
+static const float kThreshold = 0.8f;
+
+void setUp() {
+  classifier.clear();
+  for (const auto& s : kWeather) classifier.addExample("weather", s);
+  for (const auto& s : kTimer) classifier.addExample("timer", s);
+  for (const auto& s : kChat) classifier.addExample("chat", s);
+}
+
+void tearDown() {}
+
+static void assertLocal(const char* utterance, const char* intent) {
+  LocalIntentClassifier::Result r = classifier.classify(utterance, kIntents);
+  TEST_ASSERT_EQUAL_STRING_MESSAGE(intent, r.intent.c_str(), utterance);
+  TEST_ASSERT_TRUE_MESSAGE(r.confidence >= kThreshold, utterance);
+}
+
+static void assertOutOfDomain(const char* utterance) {
+  LocalIntentClassifier::Result r = classifier.classify(utterance, kIntents);
+  TEST_ASSERT_TRUE_MESSAGE(r.confidence < kThreshold, utterance);
+}
+
+void test_in_domain_is_confident() {
+  assertLocal("明日の天気を教えて", "weather");
+  assertLocal("雨降るかな", "weather");
+  assertLocal("タイマーを5分セット", "timer");
+  assertLocal("3分計って", "timer");
+  assertLocal("こんにちは、元気？", "chat");
+  assertLocal("ひまだなー", "chat");
+}
+
+// 長い文でも、例文と重ならなければ事後確率が 1 に張り付かない
+void test_out_of_domain_is_not_confident() {
+  assertOutOfDomain("量子コンピュータの仕組みを説明して");
+  assertOutOfDomain("株価の見通しはどう思う");
+  assertOutOfDomain("ピザを注文したい");
+}
+
+void test_intent_without_examples_is_never_confident() {
+  LocalIntentClassifier::Result r = classifier.classify("今日の天気は？", { "music" });
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, r.confidence);
+}
+
+void test_out_of_domain_falls_back_to_remote() {
+  EchoEngine weather("weather"), timer("timer"), chat("chat");
+  EngineManager manager("test-key");
+  manager.registerEngine("weather", &weather, kWeather);
+  manager.registerEngine("timer", &timer, kTimer);
+  manager.registerEngine("chat", &chat, kChat);
+
+  size_t before = server.requestCount();
+  TEST_ASSERT_EQUAL_STRING("weather", manager.handle("明日の天気を教えて").message.c_str());
+  TEST_ASSERT_EQUAL(1, (int)manager.localHitCount());
+  TEST_ASSERT_EQUAL(0, (int)manager.remoteFallbackCount());
+  TEST_ASSERT_EQUAL(0, (int)(server.requestCount() - before));
+
+  // ローカルでは timer に寄るが、確信が無いのでリモートの答えに従う
+  TEST_ASSERT_EQUAL_STRING("chat", manager.handle("量子コンピュータの仕組みを説明して").message.c_str());
+  TEST_ASSERT_EQUAL(1, (int)manager.localHitCount());
+  TEST_ASSERT_EQUAL(1, (int)manager.remoteFallbackCount());
+  TEST_ASSERT_EQUAL(1, (int)(server.requestCount() - before));
+}
+
+int main() {
+  server.start();
+  OpenAITransport::shared().setEndpoint(server.url());
+  UNITY_BEGIN();
+  RUN_TEST(test_in_domain_is_confident);
+  RUN_TEST(test_out_of_domain_is_not_confident);
+  RUN_TEST(test_intent_without_examples_is_never_confident);
+  RUN_TEST(test_out_of_domain_falls_back_to_remote);
+  int failures = UNITY_END();
+  server.stop();
+  return failures;
+}
@@ -0,0 +1,161 @@
+// LLMWorker のテスト（pio test -e native -f test_llm_worker）
+//   PC では LLMWorker は std::thread で動く。ESP32 の FreeRTOS タスクと同じく、
+//   ジョブはワーカーのスレッドで 1 つずつ順に動き、キューが一杯なら submit() は断る。
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "LLMWorker.h"
+#include "StandInServer.h"
+
+static StandInServer server([](const StandInServer::Request&, StandInServer::Response& res) {
+  res.json(200,
+           "{\"choices\":[{\"message\":{\"role\":\"assistant\","
+           "\"content\":\"{\\\"message\\\":\\\"やっほー\\\",\\\"emotion\\\":\\\"happy\\\"}\"}}]}");
+});
+
+void setUp() {}
+void tearDown() {}
+
+void test_runs_jobs_in_order_on_worker_thread() {
+  LLMWorker worker;
+  std::thread::id caller = std::this_thread::get_id();
+  std::vector<int> order;
+  std::mutex orderMutex;
+  std::atomic<bool> onWorker{true};
+
+  std::vector<LLMHandle> handles;
+  for (int i = 0; i < 3; ++i) {
+    handles.push_back(worker.submit([&, i](LLMResponse& response) {
+      if (std::this_thread::get_id() == caller) onWorker = false;
+      {
+        std::lock_guard<std::mutex> lock(orderMutex);
+        order.push_back(i);
+      }
+      response.message = String(i);
+      return i != 1;  // 2 番目だけ失敗させる
+    }));
+  }
+  for (auto& handle : handles) {
+    TEST_ASSERT_NOT_NULL(handle.get());
+    TEST_ASSERT_TRUE(handle->wait(1000));
+  }
+
+  TEST_ASSERT_TRUE(onWorker);
+  TEST_ASSERT_EQUAL(3, (int)order.size());
+  for (int i = 0; i < 3; ++i) TEST_ASSERT_EQUAL(i, order[i]);
+  TEST_ASSERT_TRUE(handles[0]->succeeded());
+  TEST_ASSERT_FALSE(handles[1]->succeeded());
+  TEST_ASSERT_EQUAL_STRING("2", handles[2]->result().message.c_str());
+  TEST_ASSERT_EQUAL_UINT32(3, worker.stats().completed);
+}
+
+void test_callback_runs_before_handle_completes() {
+  LLMWorker worker;
+  std::atomic<bool> calledBack{false};
+  LLMHandle handle = worker.submit(
+      [](LLMResponse& response) {
+        response.message = "done";
+        return true;
+      },
+      [&](const LLMResponse& response) { calledBack = response.message == "done"; });
+  TEST_ASSERT_TRUE(handle->wait(1000));
+  TEST_ASSERT_TRUE(calledBack);
+}
+
+void test_rejects_when_queue_is_full() {
+  LLMWorker worker(1);
+  std::atomic<bool> started{false};
+  std::atomic<bool> release{false};
+
+  // 1 件目はワーカーが取り出してから止めておく。2 件目がキューを埋める
+  LLMHandle busy = worker.submit([&](LLMResponse&) {
+    started = true;
+    while (!release) delay(1);
+    return true;
+  });
+  while (!started) delay(1);
+  LLMHandle queued = worker.submit([](LLMResponse&) { return true; });
+  LLMHandle rejected = worker.submit([](LLMResponse&) { return true; });
+
+  TEST_ASSERT_NOT_NULL(busy.get());
+  TEST_ASSERT_NOT_NULL(queued.get());
+  TEST_ASSERT_NULL(rejected.get());
+  TEST_ASSERT_EQUAL_UINT32(1, worker.stats().rejected);
+  TEST_ASSERT_FALSE(queued->done());
+
+  release = true;
+  TEST_ASSERT_TRUE(queued->wait(1000));
+  TEST_ASSERT_EQUAL_UINT32(1, worker.stats().maxQueued);
+}
+
+void test_destructor_drains_queue() {
+  std::atomic<int> ran{0};
+  {
+    LLMWorker worker(4);
+    for (int i = 0; i < 4; ++i) {
+      worker.submit([&](LLMResponse&) {
+        delay(5);
+        ++ran;
+        return true;
+      });
+    }
+  }
+  TEST_ASSERT_EQUAL(4, ran.load());
+}
+
+// LLMEngine::generate はワーカーで発話を積み、問い合わせ、返答を履歴に足す
+void test_engine_generate_through_worker() {
+  LLMWorker worker;
+  OpenAITransport transport(server.url());
+  LLMEngine llm("sk-test");
+  llm.setWorker(&worker);
+  llm.setTransport(&transport);
+
+  String spoken;
+  LLMHandle handle = llm.generate("こんにちは", [&](LLMResponse response) { spoken = response.message; });
+  TEST_ASSERT_NOT_NULL(handle.get());
+  TEST_ASSERT_TRUE(handle->wait(5000));
+  TEST_ASSERT_TRUE(handle->succeeded());
+  TEST_ASSERT_EQUAL_STRING("やっほー", spoken.c_str());
+  TEST_ASSERT_EQUAL(2, (int)llm.getHistory()->size());
+}
+
+// キューで待っている間に取り消されたら、問い合わせずに失敗として返る
+void test_engine_generate_cancelled_in_queue() {
+  LLMWorker worker;
+  OpenAITransport transport(server.url());
+  LLMEngine llm("sk-test");
+  llm.setWorker(&worker);
+  llm.setTransport(&transport);
+
+  std::atomic<bool> release{false};
+  worker.submit([&](LLMResponse&) {
+    while (!release) delay(1);
+    return true;
+  });
+  CancelToken cancel;
+  size_t before = server.requestCount();
+  LLMHandle handle = llm.generate("こんにちは", nullptr, cancel);
+  cancel.cancel();
+  release = true;
+
+  TEST_ASSERT_TRUE(handle->wait(1000));
+  TEST_ASSERT_FALSE(handle->succeeded());
+  TEST_ASSERT_EQUAL(0, (int)(server.requestCount() - before));
+  TEST_ASSERT_EQUAL(0, (int)llm.getHistory()->size());
+}
+
+int main() {
+  server.start();
+  UNITY_BEGIN();
+  RUN_TEST(test_runs_jobs_in_order_on_worker_thread);
+  RUN_TEST(test_callback_runs_before_handle_completes);
+  RUN_TEST(test_rejects_when_queue_is_full);
+  RUN_TEST(test_destructor_drains_queue);
+  RUN_TEST(test_engine_generate_through_worker);
+  RUN_TEST(test_engine_generate_cancelled_in_queue);
+  int failures = UNITY_END();
+  server.stop();
+  return failures;
+}
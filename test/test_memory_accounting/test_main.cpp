@@ -0,0 +1,163 @@
+// MemoryAccounting / TaggedAllocator / JsonArena の計上のテスト（pio test -e native -f test_memory_accounting）
+#include <unity.h>
+#include "JsonArena.h"
+#include "MemoryAccounting.h"
+
+// 集計はプロセスで 1 つなので、各テストは呼ぶ前との差で確かめる
+static MemoryAccounting& accounting = MemoryAccounting::instance();
+
+static size_t current(MemoryAccounting::Subsystem subsystem) {
+  return accounting.usage(subsystem).current;
+}
+
+class CapturePrint : public Print {
+public:
+  String text;
+  size_t write(uint8_t c) override {
+    text += (char)c;
+    return 1;
+  }
+};
+
+void setUp() {
+  accounting.resetPeaks();
+}
+
+void tearDown() {}
+
+void test_tagged_allocator_tracks_current_and_peak() {
+  TaggedAllocator& allocator = TaggedAllocator::of(MemoryAccounting::Planner);
+  MemoryAccounting::Usage before = accounting.usage(MemoryAccounting::Planner);
+
+  void* a = allocator.allocate(100);
+  void* b = allocator.allocate(50);
+  TEST_ASSERT_NOT_NULL(a);
+  TEST_ASSERT_NOT_NULL(b);
+  TEST_ASSERT_EQUAL_UINT(before.current + 150, current(MemoryAccounting::Planner));
+
+  a = allocator.reallocate(a, 300);
+  TEST_ASSERT_NOT_NULL(a);
+  TEST_ASSERT_EQUAL_UINT(before.current + 350, current(MemoryAccounting::Planner));
+
+  a = allocator.reallocate(a, 20);
+  TEST_ASSERT_EQUAL_UINT(before.current + 70, current(MemoryAccounting::Planner));
+
+  allocator.deallocate(a);
+  allocator.deallocate(b);
+  MemoryAccounting::Usage after = accounting.usage(MemoryAccounting::Planner);
+  TEST_ASSERT_EQUAL_UINT(before.current, after.current);
+  TEST_ASSERT_EQUAL_UINT(before.current + 350, after.peak);
+  TEST_ASSERT_EQUAL_UINT(before.allocations + 3, after.allocations);  // 2 回の確保と 1 回の拡張
+  TEST_ASSERT_EQUAL_UINT(before.frees + 3, after.frees);              // 1 回の縮小と 2 回の解放
+}
+
+// サブシステムごとに別々に数える
+void test_subsystems_are_counted_separately() {
+  size_t history = current(MemoryAccounting::History);
+  size_t decision = current(MemoryAccounting::DecisionEngine);
+
+  void* p = TaggedAllocator::of(MemoryAccounting::History).allocate(64);
+  TEST_ASSERT_EQUAL_UINT(history + 64, current(MemoryAccounting::History));
+  TEST_ASSERT_EQUAL_UINT(decision, current(MemoryAccounting::DecisionEngine));
+
+  TaggedAllocator::of(MemoryAccounting::History).deallocate(p);
+  TEST_ASSERT_EQUAL_UINT(history, current(MemoryAccounting::History));
+}
+
+void test_json_document_is_tagged() {
+  size_t before = current(MemoryAccounting::DecisionEngine);
+  {
+    JsonDocument doc(&TaggedAllocator::of(MemoryAccounting::DecisionEngine));
+    for (int i = 0; i < 32; ++i) {
+      doc["items"].add(String("item-") + String(i));
+    }
+    TEST_ASSERT_GREATER_THAN(before, current(MemoryAccounting::DecisionEngine));
+
+    // 縮めた分は解放として数える
+    size_t grown = current(MemoryAccounting::DecisionEngine);
+    doc.clear();
+    doc.shrinkToFit();
+    TEST_ASSERT_LESS_THAN_UINT(grown, current(MemoryAccounting::DecisionEngine));
+  }
+  TEST_ASSERT_EQUAL_UINT(before, current(MemoryAccounting::DecisionEngine));
+}
+
+void test_resized_and_freed_never_go_negative() {
+  size_t before = current(MemoryAccounting::Planner);
+  accounting.resized(MemoryAccounting::Planner, 0, 40);
+  TEST_ASSERT_EQUAL_UINT(before + 40, current(MemoryAccounting::Planner));
+  accounting.resized(MemoryAccounting::Planner, 40, 10);
+  TEST_ASSERT_EQUAL_UINT(before + 10, current(MemoryAccounting::Planner));
+  accounting.resized(MemoryAccounting::Planner, 10, 10);
+  TEST_ASSERT_EQUAL_UINT(before + 10, current(MemoryAccounting::Planner));
+
+  // 数え漏れがあっても 0 で止まる
+  accounting.freed(MemoryAccounting::Planner, before + 1000);
+  TEST_ASSERT_EQUAL_UINT(0, current(MemoryAccounting::Planner));
+}
+
+void test_budget_marks_subsystem_in_report() {
+  TaggedAllocator& allocator = TaggedAllocator::of(MemoryAccounting::Planner);
+  accounting.setBudget(MemoryAccounting::Planner, current(MemoryAccounting::Planner) + 64);
+  TEST_ASSERT_FALSE(accounting.overBudget(MemoryAccounting::Planner));
+
+  void* p = allocator.allocate(128);
+  TEST_ASSERT_TRUE(accounting.overBudget(MemoryAccounting::Planner));
+
+  CapturePrint out;
+  accounting.report(out);
+  TEST_ASSERT_TRUE(out.text.indexOf("history") >= 0);
+  TEST_ASSERT_TRUE(out.text.indexOf("decision") >= 0);
+  TEST_ASSERT_TRUE(out.text.indexOf("arena") >= 0);
+  int planner = out.text.indexOf("planner");
+  TEST_ASSERT_TRUE(planner >= 0);
+  int lineEnd = out.text.indexOf('\n', planner);
+  TEST_ASSERT_TRUE(out.text.substring(planner, lineEnd).indexOf("OVER BUDGET") >= 0);
+
+  allocator.deallocate(p);
+  TEST_ASSERT_FALSE(accounting.overBudget(MemoryAccounting::Planner));
+  accounting.setBudget(MemoryAccounting::Planner, 0);
+}
+
+// アリーナの中の確保はブロックごと、収まらない分はヒープに回した大きさで数え、
+// Turn の終わりにまとめて戻る
+void test_arena_counts_fallbacks_and_resets() {
+  JsonArena& arena = JsonArena::instance();
+  TEST_ASSERT_TRUE(arena.configure(256, JsonArena::Memory::Internal));
+  size_t before = current(MemoryAccounting::Arena);
+  JsonArena::Stats stats = arena.stats();
+  {
+    JsonArena::Turn turn;
+    void* small = arena.allocate(64);
+    TEST_ASSERT_NOT_NULL(small);
+    size_t inArena = current(MemoryAccounting::Arena);
+    TEST_ASSERT_GREATER_OR_EQUAL(before + 64, inArena);
+
+    void* large = arena.allocate(1024);
+    TEST_ASSERT_NOT_NULL(large);
+    TEST_ASSERT_EQUAL_UINT(stats.fallbacks + 1, arena.stats().fallbacks);
+    TEST_ASSERT_GREATER_OR_EQUAL(inArena + 1024, current(MemoryAccounting::Arena));
+
+    arena.deallocate(large);
+    TEST_ASSERT_EQUAL_UINT(inArena, current(MemoryAccounting::Arena));
+
+    // 最後のブロックはその場で伸ばす
+    small = arena.reallocate(small, 128);
+    TEST_ASSERT_GREATER_OR_EQUAL(before + 128, current(MemoryAccounting::Arena));
+    TEST_ASSERT_EQUAL_UINT(stats.fallbacks + 1, arena.stats().fallbacks);
+  }
+  TEST_ASSERT_EQUAL_UINT(before, current(MemoryAccounting::Arena));
+  TEST_ASSERT_EQUAL_UINT(stats.resets + 1, arena.stats().resets);
+  arena.configure(0);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_tagged_allocator_tracks_current_and_peak);
+  RUN_TEST(test_subsystems_are_counted_separately);
+  RUN_TEST(test_json_document_is_tagged);
+  RUN_TEST(test_resized_and_freed_never_go_negative);
+  RUN_TEST(test_budget_marks_subsystem_in_report);
+  RUN_TEST(test_arena_counts_fallbacks_and_resets);
+  return UNITY_END();
+}
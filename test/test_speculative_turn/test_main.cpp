@@ -0,0 +1,98 @@
+// LLMEngine の投機実行ターン（beginTurn / commitTurn / rollbackTurn）のテスト
+//   （pio test -e native -f test_speculative_turn）
+#include <unity.h>
+#include <vector>
+#include "LLMEngine.h"
+
+static const char* kLongReply =
+    "それはね、とっても長いお話なんだ。むかしむかし、ある山の奥に小さなロボットが住んでいて、"
+    "毎朝お日さまと一緒に目を覚まして、森の動物たちにおはようを言って回っていたんだよ。";
+
+static std::vector<String> snapshot(const LLMEngine& llm) {
+  LLMEngine::HistoryView view = llm.getHistory();
+  std::vector<String> out;
+  for (const auto& message : *view) {
+    out.push_back(String(message.role.c_str()) + ":" + message.content);
+  }
+  return out;
+}
+
+static void assertSameHistory(const std::vector<String>& expected, const LLMEngine& llm) {
+  std::vector<String> actual = snapshot(llm);
+  TEST_ASSERT_EQUAL(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    TEST_ASSERT_EQUAL_STRING(expected[i].c_str(), actual[i].c_str());
+  }
+}
+
+static void fill(LLMEngine& llm, int messages) {
+  llm.resetConversation();
+  for (int i = 0; i < messages; ++i) {
+    if (i % 2 == 0) llm.addUserMessage("質問" + String(i));
+    else llm.addAssistantMessage("答え" + String(i));
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_rollback_removes_turn_messages() {
+  LLMEngine llm("sk-test");
+  fill(llm, 4);
+  std::vector<String> before = snapshot(llm);
+
+  llm.beginTurn();
+  llm.addUserMessage("投機の質問");
+  llm.addAssistantMessage("投機の答え");
+  llm.rollbackTurn();
+  assertSameHistory(before, llm);
+}
+
+void test_commit_keeps_turn_messages() {
+  LLMEngine llm("sk-test");
+  fill(llm, 2);
+  llm.beginTurn();
+  llm.addUserMessage("確定する質問");
+  llm.commitTurn();
+  TEST_ASSERT_EQUAL(3, (int)llm.getHistory()->size());
+}
+
+// 長い返答が予算を超え、同じターンの user 発話と古い発話を押し出してから取り消す
+void test_rollback_after_eviction_within_turn() {
+  LLMEngine llm("sk-test");
+  llm.setHistoryBudget(64 * 1024);
+  fill(llm, 4);
+  llm.setHistoryBudget(llm.getHistory()->bytes() + 32);
+  std::vector<String> before = snapshot(llm);
+
+  llm.beginTurn();
+  llm.addUserMessage("短い質問");
+  llm.addAssistantMessage(kLongReply);
+  TEST_ASSERT_EQUAL(1, (int)llm.getHistory()->size());  // 直近の 1 件だけが残る
+  llm.rollbackTurn();
+  assertSameHistory(before, llm);
+}
+
+// 件数の上限で押し出された場合も、ターン開始時のリングに戻る
+void test_rollback_after_capacity_eviction() {
+  LLMEngine llm("sk-test");
+  llm.setHistoryBudget(64 * 1024);
+  fill(llm, ConversationHistory::kCapacity);
+  std::vector<String> before = snapshot(llm);
+
+  llm.beginTurn();
+  llm.addUserMessage("投機の質問");
+  llm.addAssistantMessage("投機の答え");
+  llm.addUserMessage("もう 1 つ");
+  llm.rollbackTurn();
+  assertSameHistory(before, llm);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_rollback_removes_turn_messages);
+  RUN_TEST(test_commit_keeps_turn_messages);
+  RUN_TEST(test_rollback_after_eviction_within_turn);
+  RUN_TEST(test_rollback_after_capacity_eviction);
+  return UNITY_END();
+}
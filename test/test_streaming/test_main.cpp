@@ -0,0 +1,105 @@
+// ストリーミング返答のテスト（pio test -e native -f test_streaming）
+//   スタンドインサーバーが OpenAI と同じ形の SSE を少しずつ返し、
+//   ChatEngine が文ごとにコールバックへ渡すこと・二重に読み上げないことを確かめる。
+#include <unity.h>
+#include <SD.h>
+#include <vector>
+#include "ChatEngine.h"
+#include "StandInServer.h"
+
+// 返答本文（{"message":...,"emotion":...}）をこの単位に切って delta で送る
+static const char* kPieces[] = {
+  "{\"message\":\"こんに", "ちは！", "今日は晴", "れだね。\",\"emo", "tion\":\"happy\"}",
+};
+static const unsigned long kGapMs = 80;
+
+static String deltaEvent(const char* piece) {
+  JsonDocument doc;
+  doc["choices"][0]["delta"]["content"] = piece;
+  String data;
+  serializeJson(doc, data);
+  return data;
+}
+
+static StandInServer server([](const StandInServer::Request& req, StandInServer::Response& res) {
+  if (req.accept.indexOf("text/event-stream") < 0) {
+    res.json(200,
+             "{\"choices\":[{\"message\":{\"role\":\"assistant\","
+             "\"content\":\"{\\\"message\\\":\\\"まとめて返すね。\\\",\\\"emotion\\\":\\\"neutral\\\"}\"}}]}");
+    return;
+  }
+  res.beginChunked(200, "text/event-stream");
+  for (const char* piece : kPieces) {
+    res.event(deltaEvent(piece));
+    res.pause(kGapMs);
+  }
+  res.event("[DONE]");
+  res.endChunked();
+});
+static OpenAITransport transport;
+
+void setUp() {}
+void tearDown() {}
+
+void test_streams_sentences_and_marks_spoken() {
+  ChatEngine chat("sk-test");
+  chat.getLLMEngine()->setTransport(&transport);
+  std::vector<String> sentences;
+  std::vector<unsigned long> spokenAt;
+  chat.setSentenceCallback([&](const String& sentence) {
+    sentences.push_back(sentence);
+    spokenAt.push_back(millis());
+  });
+
+  unsigned long started = millis();
+  LLMResponse reply = chat.generateReply("こんにちは");
+  unsigned long finished = millis();
+
+  TEST_ASSERT_TRUE(reply.alreadySpoken);
+  TEST_ASSERT_EQUAL_STRING("こんにちは！今日は晴れだね。", reply.message.c_str());
+  TEST_ASSERT_EQUAL(2, (int)sentences.size());
+  TEST_ASSERT_EQUAL_STRING("こんにちは！", sentences[0].c_str());
+  TEST_ASSERT_EQUAL_STRING("今日は晴れだね。", sentences[1].c_str());
+  // 最初の文は返答を受け取り終わる前に渡っている
+  Serial.printf("first sentence after %lu ms, reply after %lu ms\n",
+                spokenAt[0] - started, finished - started);
+  TEST_ASSERT_TRUE(finished - spokenAt[0] >= 2 * kGapMs);
+}
+
+void test_without_callback_reply_is_not_spoken() {
+  ChatEngine chat("sk-test");
+  chat.getLLMEngine()->setTransport(&transport);
+
+  LLMResponse reply = chat.generateReply("こんにちは");
+  TEST_ASSERT_FALSE(reply.alreadySpoken);
+  TEST_ASSERT_EQUAL_STRING("まとめて返すね。", reply.message.c_str());
+}
+
+// 投機実行中は確定するまで話さない。呼び出し側が読み上げる
+void test_speculative_turn_is_not_streamed() {
+  ChatEngine chat("sk-test");
+  chat.getLLMEngine()->setTransport(&transport);
+  int spoken = 0;
+  chat.setSentenceCallback([&](const String&) { ++spoken; });
+
+  chat.beginTurn();
+  LLMResponse reply = chat.generateReply("こんにちは");
+  chat.commitTurn();
+  TEST_ASSERT_FALSE(reply.alreadySpoken);
+  TEST_ASSERT_EQUAL(0, spoken);
+}
+
+int main() {
+  char dir[] = "/tmp/streaming_test_XXXXXX";
+  SD.setRoot(mkdtemp(dir));
+  SD.mkdir("/spiffs");
+  server.start();
+  transport.setEndpoint(server.url());
+  UNITY_BEGIN();
+  RUN_TEST(test_streams_sentences_and_marks_spoken);
+  RUN_TEST(test_without_callback_reply_is_not_spoken);
+  RUN_TEST(test_speculative_turn_is_not_streamed);
+  int failures = UNITY_END();
+  server.stop();
+  return failures;
+}
@@ -0,0 +1,66 @@
+// OpenAITransport / HttpBodyStream のテスト（pio test -e native -f test_transport）
+#include <unity.h>
+#include <ArduinoJson.h>
+#include <thread>
+#include "OpenAITransport.h"
+#include "StandInServer.h"
+
+// 本文の途中で止まるサーバー。Content-Length より短いところで 5 秒黙る
+static StandInServer server([](const StandInServer::Request& req, StandInServer::Response& res) {
+  if (req.path == "/stall") {
+    res.raw("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: 200\r\n\r\n");
+    res.raw("{\"choices\":[{\"message\":{\"content\":\"");
+    res.pause(5000);
+    res.close();
+    return;
+  }
+  res.json(200, "{\"choices\":[{\"message\":{\"content\":\"hello\"}}]}");
+});
+
+void setUp() {}
+void tearDown() {}
+
+void test_reads_complete_body() {
+  OpenAITransport transport(server.url("/ok"));
+  JsonDocument doc;
+  int code = transport.post("sk-test", "{}", [&](HttpBodyStream& body) {
+    return !deserializeJson(doc, body);
+  });
+  TEST_ASSERT_EQUAL(200, code);
+  TEST_ASSERT_EQUAL_STRING("hello", doc["choices"][0]["message"]["content"] | "");
+}
+
+// 本文の受信中に取り消すと、30 秒の読み出しタイムアウトを待たずに戻る
+void test_cancel_mid_body_returns_promptly() {
+  OpenAITransport transport(server.url("/stall"));
+  CancelToken cancel;
+  unsigned long cancelledAt = 0;
+  std::thread canceller([&] {
+    delay(200);
+    cancelledAt = millis();
+    cancel.cancel();
+  });
+
+  JsonDocument doc;
+  int code = transport.post("sk-test", "{}", [&](HttpBodyStream& body) {
+    // deserializeJson は Stream::readBytes で 1 バイトずつ待つ
+    return !deserializeJson(doc, body);
+  }, "application/json", cancel);
+  unsigned long returnedAt = millis();
+  canceller.join();
+
+  unsigned long latency = returnedAt - cancelledAt;
+  Serial.printf("cancel latency: %lu ms\n", latency);
+  TEST_ASSERT_EQUAL(OpenAITransport::kCancelled, code);
+  TEST_ASSERT_LESS_THAN_UINT32(100, latency);
+}
+
+int main() {
+  server.start();
+  UNITY_BEGIN();
+  RUN_TEST(test_reads_complete_body);
+  RUN_TEST(test_cancel_mid_body_returns_promptly);
+  int failures = UNITY_END();
+  server.stop();
+  return failures;
+}